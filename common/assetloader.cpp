@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+
+#include <GL/glew.h>
+
+#include "assetloader.hpp"
+#include "assetpack.hpp"
+#include "hash.hpp"
+#include "shader.hpp"
+#include "textureresidency.hpp"
+
+namespace
+{
+    // Hash of every source file in turn, 0 if one can't be read. Packed
+    // files use the hash stored in the pack rather than opening the source.
+    uint64_t hashSources(const std::vector<std::string>& paths)
+    {
+        uint64_t hash = 0;
+        const AssetPack* pack = AssetPack::mounted();
+        for (const std::string& path : paths)
+        {
+            uint64_t fileHash;
+            PackBlob blob;
+            if (pack && pack->find(path.c_str(), blob))
+                fileHash = blob.contentHash;
+            else
+            {
+                MappedFile file;
+                if (!file.open(path.c_str()))
+                    return 0;
+                fileHash = hashBytes(file.data(), file.size());
+            }
+            hash = hash == 0 ? fileHash : hashBytes(&fileHash, sizeof(fileHash), hash);
+        }
+        return hash;
+    }
+}
+
+bool ModelHandle::load()
+{
+    staged.reset(new Model(options));
+    return staged->load(path().c_str());
+}
+
+bool ModelHandle::upload()
+{
+    staged->upload();
+    
+    // Carry the material over and retire the old buffers
+    if (current)
+    {
+        staged->textures = current->textures;
+        staged->material = current->material;
+        staged->textureID = current->textureID;
+        staged->ka = current->ka;
+        staged->kd = current->kd;
+        staged->ks = current->ks;
+        staged->Ns = current->Ns;
+        current->deleteBuffers();
+    }
+    current.swap(staged);
+    staged.reset();
+    return true;
+}
+
+void ModelHandle::release()
+{
+    if (current)
+        current->deleteBuffers();
+    current.reset();
+}
+
+bool TextureHandle::load()
+{
+    if (!TextureCache::fetch(path().c_str(), cookedFile, cooked, image))
+        return false;
+
+    // Copy the levels out here rather than have the driver do it on the GL thread
+    span = UploadSpan();
+    if (ring && cooked.levelCount > 0 && ring->stage(cooked, staged, span))
+        cookedFile.close();
+    return true;
+}
+
+bool TextureHandle::upload()
+{
+    if (span.size > 0)
+    {
+        // The levels source from the ring, a fence frees them once read
+        ring->bind();
+        id = Image::upload(staged, id);
+        ring->unbind();
+        ring->submit(span);
+        textureBytes = cooked.bytes();
+        span = UploadSpan();
+        staged = TextureView();
+    }
+    else if (cooked.levelCount > 0)
+    {
+        id = Image::upload(cooked, id);
+        textureBytes = cooked.bytes();
+    }
+    else
+    {
+        id = Image::upload(image, id);
+
+        // The mip chain adds a third on top of the base level
+        textureBytes = image.bytes() * 4 / 3;
+    }
+    cooked = TextureView();
+    cookedFile.close();
+    image = ImageData();
+    uploads++;
+    return true;
+}
+
+size_t TextureHandle::uploadBytes() const
+{
+    // Staged levels cost the GL thread no copy
+    return span.size > 0 ? 0 : image.bytes() + cooked.bytes();
+}
+
+void TextureHandle::release()
+{
+    glDeleteTextures(1, &id);
+    id = 0;
+    textureBytes = 0;
+}
+
+std::vector<std::string> ShaderHandle::sources() const
+{
+    std::vector<std::string> paths;
+    paths.push_back(path());
+    paths.push_back(fragmentPath);
+    return paths;
+}
+
+bool ShaderHandle::load()
+{
+    return ReadShaderFile(path().c_str(), vertexCode) && ReadShaderFile(fragmentPath.c_str(), fragmentCode);
+}
+
+bool ShaderHandle::upload()
+{
+    // A broken edit keeps the previous program running, a broken first
+    // compile fails the asset
+    unsigned int compiled = CachedShaderProgram(vertexCode, fragmentCode, path().c_str(), fragmentPath.c_str());
+    vertexCode.clear();
+    fragmentCode.clear();
+    if (compiled == 0)
+    {
+        if (program != 0)
+            printf("Keeping the previous %s / %s program\n", path().c_str(), fragmentPath.c_str());
+        return false;
+    }
+    glDeleteProgram(program);
+    program = compiled;
+    uniforms.reflect(program);
+    return true;
+}
+
+void ShaderHandle::release()
+{
+    glDeleteProgram(program);
+    program = 0;
+    uniforms.reflect(0);
+}
+
+AssetLoader::AssetLoader(unsigned int threads, size_t queueCapacity)
+    : finished(queueCapacity), outstanding(0), stopping(false), pool(threads)
+{
+}
+
+AssetLoader::~AssetLoader()
+{
+    // Nobody drains the queue any more, let the workers wind down
+    stopping.store(true, std::memory_order_release);
+}
+
+std::shared_ptr<ModelHandle> AssetLoader::loadModel(const char* path, const ModelOptions& options)
+{
+    std::shared_ptr<ModelHandle> handle = std::make_shared<ModelHandle>(path, options);
+    request(handle);
+    return handle;
+}
+
+std::shared_ptr<TextureHandle> AssetLoader::loadTexture(const char* path)
+{
+    std::shared_ptr<TextureHandle> handle = std::make_shared<TextureHandle>(path, uploadRing);
+    request(handle);
+    if (residency)
+        residency->manage(handle);
+    return handle;
+}
+
+std::shared_ptr<ShaderHandle> AssetLoader::loadShader(const char* vertexPath, const char* fragmentPath)
+{
+    std::shared_ptr<ShaderHandle> handle = std::make_shared<ShaderHandle>(vertexPath, fragmentPath);
+    request(handle);
+    return handle;
+}
+
+void AssetLoader::reload(const std::shared_ptr<AssetHandle>& asset)
+{
+    // Whoever clears inFlight next sees the flag and loads it again
+    asset->dirty.store(true, std::memory_order_release);
+    if (asset->inFlight.exchange(true, std::memory_order_acq_rel))
+        return;
+    asset->dirty.store(false, std::memory_order_release);
+    request(asset);
+}
+
+void AssetLoader::finish(const std::shared_ptr<AssetHandle>& asset)
+{
+    asset->inFlight.store(false, std::memory_order_release);
+    outstanding.fetch_sub(1, std::memory_order_release);
+    if (stopping.load(std::memory_order_acquire) || !asset->dirty.load(std::memory_order_acquire))
+        return;
+    if (asset->inFlight.exchange(true, std::memory_order_acq_rel))
+        return;
+    asset->dirty.store(false, std::memory_order_release);
+    request(asset);
+}
+
+bool AssetLoader::wait(const std::shared_ptr<AssetHandle>& asset)
+{
+    while (!asset->isReady() && !asset->hasFailed())
+    {
+        if (update() == 0)
+            std::this_thread::yield();
+    }
+    return asset->isReady();
+}
+
+void AssetLoader::request(std::shared_ptr<AssetHandle> asset)
+{
+    asset->inFlight.store(true, std::memory_order_relaxed);
+    outstanding.fetch_add(1, std::memory_order_relaxed);
+    pool.submit([this, asset]() {
+        if (stopping.load(std::memory_order_acquire))
+            return;
+        asset->hash.store(hashSources(asset->sources()), std::memory_order_release);
+        if (!asset->load())
+        {
+            // A failed reload leaves the ready asset as it was
+            printf("Could not load %s\n", asset->path().c_str());
+            if (!asset->isReady())
+                asset->state.store(AssetFailed, std::memory_order_release);
+            finish(asset);
+            return;
+        }
+
+        // Wait for the GL thread to drain the queue if it is full
+        while (!finished.push(asset))
+        {
+            if (stopping.load(std::memory_order_acquire))
+                return;
+            std::this_thread::yield();
+        }
+    });
+}
+
+size_t AssetLoader::update(double budgetMilliseconds, size_t budgetBytes)
+{
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    size_t uploaded = 0;
+    size_t bytes = 0;
+
+    for (;;)
+    {
+        // An asset that didn't fit last frame goes first
+        std::shared_ptr<AssetHandle> asset;
+        if (deferred)
+            asset.swap(deferred);
+        else if (!finished.pop(asset))
+            break;
+
+        size_t size = asset->uploadBytes();
+        if (uploaded > 0 && bytes + size > budgetBytes)
+        {
+            deferred.swap(asset);
+            break;
+        }
+
+        // A failed reload leaves the ready asset as it was
+        if (asset->upload())
+            asset->state.store(AssetReady, std::memory_order_release);
+        else if (!asset->isReady())
+            asset->state.store(AssetFailed, std::memory_order_release);
+        finish(asset);
+        uploaded++;
+        bytes += size;
+
+        double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (elapsed >= budgetMilliseconds)
+            break;
+    }
+    return uploaded;
+}
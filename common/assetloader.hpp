@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "model.hpp"
+#include "image.hpp"
+#include "texturecache.hpp"
+#include "mappedfile.hpp"
+#include "mpmcqueue.hpp"
+#include "threadpool.hpp"
+#include "uploadring.hpp"
+#include "shaderprogram.hpp"
+
+class TextureResidency;
+
+enum AssetState
+{
+    AssetLoading,
+    AssetReady,
+    AssetFailed
+};
+
+// Something the loader fills in later, poll isReady() before using it.
+// An asset can be reloaded; a ready one keeps its old GL object until the new
+// one has been built, and keeps it for good if the reload fails.
+class AssetHandle
+{
+public:
+    virtual ~AssetHandle() {}
+
+    bool isReady() const { return state.load(std::memory_order_acquire) == AssetReady; }
+    bool hasFailed() const { return state.load(std::memory_order_acquire) == AssetFailed; }
+    const std::string& path() const { return sourcePath; }
+
+    // hash of the source files, taken on the worker as part of each load;
+    // 0 until the first load has read them
+    uint64_t contentHash() const { return hash.load(std::memory_order_acquire); }
+
+    // files the asset is built from
+    virtual std::vector<std::string> sources() const { return std::vector<std::string>(1, sourcePath); }
+
+    // GL memory held once uploaded, an estimate where GL doesn't say
+    virtual size_t gpuBytes() const = 0;
+
+    // GL thread: delete the GL objects
+    virtual void release() = 0;
+
+protected:
+    explicit AssetHandle(const char* path)
+        : state(AssetLoading), inFlight(false), dirty(false), hash(0), sourcePath(path) {}
+
+    // worker thread: read and decode
+    virtual bool load() = 0;
+
+    // GL thread: create or replace the GL objects; false if they couldn't
+    // be built, which fails an asset that has none yet
+    virtual bool upload() = 0;
+    virtual size_t uploadBytes() const = 0;
+
+private:
+    friend class AssetLoader;
+    std::atomic<int> state;
+    std::atomic<bool> inFlight;
+    std::atomic<bool> dirty;        // changed again while a load was running
+    std::atomic<uint64_t> hash;
+    std::string sourcePath;
+};
+
+class ModelHandle : public AssetHandle
+{
+public:
+    ModelHandle(const char* path, const ModelOptions& options) : AssetHandle(path), options(options) {}
+
+    // null until ready; a reload swaps in a new Model, so fetch it every frame
+    Model* get() const { return current.get(); }
+
+    size_t gpuBytes() const override { return current ? current->gpuBytes() : 0; }
+    void release() override;
+
+protected:
+    bool load() override;
+    bool upload() override;
+    size_t uploadBytes() const override { return staged->uploadBytes(); }
+
+private:
+    ModelOptions options;
+    std::unique_ptr<Model> current;
+    std::unique_ptr<Model> staged;
+};
+
+class TextureHandle : public AssetHandle
+{
+public:
+    // 0 until ready, reloads respecify the same texture object
+    unsigned int id = 0;
+
+    // with a ring the worker copies the levels into it, and upload() only
+    // points GL at them
+    explicit TextureHandle(const char* path, UploadRing* ring = nullptr) : AssetHandle(path), ring(ring) {}
+
+    size_t gpuBytes() const override { return textureBytes; }
+    void release() override;
+
+protected:
+    bool load() override;
+    bool upload() override;
+    size_t uploadBytes() const override;
+
+private:
+    friend class TextureResidency;
+
+    // either a mapped .cgtex or decoded pixels, the .cgtex's levels staged
+    // in the ring when there was room
+    MappedFile cookedFile;
+    TextureView cooked;
+    ImageData image;
+    UploadRing* ring;
+    UploadSpan span;
+    TextureView staged;
+    size_t textureBytes = 0;
+    unsigned int uploads = 0;   // bumped by every upload, a reload brings back all levels
+};
+
+class ShaderHandle : public AssetHandle
+{
+public:
+    // 0 until ready, changes when a reload compiles
+    unsigned int program = 0;
+
+    // program's uniforms and attributes, reflected again with every compile
+    ShaderProgram uniforms;
+
+    ShaderHandle(const char* vertexPath, const char* fragmentPath)
+        : AssetHandle(vertexPath), fragmentPath(fragmentPath) {}
+
+    std::vector<std::string> sources() const override;
+
+    // the driver keeps the program's size to itself
+    size_t gpuBytes() const override { return 0; }
+    void release() override;
+
+protected:
+    // the sources are read on a worker, compiling needs the GL thread
+    bool load() override;
+    bool upload() override;
+    size_t uploadBytes() const override { return vertexCode.size() + fragmentCode.size(); }
+
+private:
+    std::string fragmentPath;
+    std::string vertexCode;
+    std::string fragmentCode;
+};
+
+// Parses models and decodes images on a worker pool. Finished assets queue
+// up for the GL thread, which uploads them in update() within a per-frame
+// time and byte budget so big scenes stream in without hitches.
+class AssetLoader
+{
+public:
+    // threads = 0 uses every core but one
+    explicit AssetLoader(unsigned int threads = 0, size_t queueCapacity = 256);
+    ~AssetLoader();
+
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+
+    // start loading, the handle becomes ready after a later update()
+    std::shared_ptr<ModelHandle> loadModel(const char* path, const ModelOptions& options = ModelOptions());
+    std::shared_ptr<TextureHandle> loadTexture(const char* path);
+    std::shared_ptr<ShaderHandle> loadShader(const char* vertexPath, const char* fragmentPath);
+
+    // textures requested from now on stage their levels in ring, which must
+    // outlive the loader
+    void setUploadRing(UploadRing* ring) { uploadRing = ring; }
+
+    // textures requested from now on are kept within residency's budget
+    void setResidency(TextureResidency* residency) { this->residency = residency; }
+
+    // start loading an asset of a kind made elsewhere, such as a material
+    void load(const std::shared_ptr<AssetHandle>& asset) { request(asset); }
+
+    // load an asset again; a change that arrives while a load is running
+    // is loaded once that one has finished
+    void reload(const std::shared_ptr<AssetHandle>& asset);
+
+    // block until the asset is ready or failed, uploading as it goes
+    bool wait(const std::shared_ptr<AssetHandle>& asset);
+
+    // upload finished assets on the GL thread until either budget runs out;
+    // at least one asset is uploaded per call so large ones still get through.
+    // Returns the number of assets uploaded.
+    size_t update(double budgetMilliseconds = 2.0, size_t budgetBytes = 16 * 1024 * 1024);
+
+    // requested assets that are neither ready nor failed
+    size_t pending() const { return outstanding.load(std::memory_order_acquire); }
+
+private:
+    // The pool is declared last so its workers stop before the queue goes away
+    MpmcQueue<std::shared_ptr<AssetHandle>> finished;
+    std::shared_ptr<AssetHandle> deferred;
+    std::atomic<size_t> outstanding;
+    std::atomic<bool> stopping;
+    UploadRing* uploadRing = nullptr;
+    TextureResidency* residency = nullptr;
+    ThreadPool pool;
+
+    void request(std::shared_ptr<AssetHandle> asset);
+
+    // a load has ended either way, start the next if the asset changed since
+    void finish(const std::shared_ptr<AssetHandle>& asset);
+};
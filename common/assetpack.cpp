@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <system_error>
+
+#include "assetpack.hpp"
+#include "cachefile.hpp"
+#include "hash.hpp"
+
+namespace
+{
+    struct PackHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t entryCount;
+        uint32_t slotCount;     // power of two
+        uint64_t slotsOffset;
+        uint64_t namesOffset;
+        uint64_t namesSize;
+    };
+
+    // A slot with an empty name is free
+    struct PackEntry
+    {
+        uint64_t nameHash;
+        uint64_t contentHash;
+        uint64_t offset;
+        uint64_t size;
+        uint32_t nameOffset;
+        uint32_t nameLength;
+    };
+
+    const char packMagic[4] = { 'C', 'G', 'P', 'K' };
+
+    // Forward slashes with . and .. folded, so spellings of a path agree
+    std::string normalName(const std::filesystem::path& path)
+    {
+        return path.lexically_normal().generic_string();
+    }
+
+    // Append path to a name already in normal form, folding . and .. as it
+    // goes so no filesystem paths are built per lookup. A .. with nothing
+    // left to fold is kept, and then matches no directory.
+    void appendNormal(std::string& name, const char* path)
+    {
+        const char* segment = path;
+        for (;;)
+        {
+            const char* end = strchr(segment, '/');
+            size_t length = end ? size_t(end - segment) : strlen(segment);
+            if (length == 2 && segment[0] == '.' && segment[1] == '.')
+            {
+                size_t slash = name.rfind('/');
+                size_t last = slash == std::string::npos ? 0 : slash + 1;
+                if (name.size() > last && name.compare(last, std::string::npos, "..") != 0)
+                    name.resize(slash == std::string::npos ? 0 : slash);
+                else
+                    name += name.empty() ? ".." : "/..";
+            }
+            else if (length > 0 && !(length == 1 && segment[0] == '.'))
+            {
+                if (!name.empty())
+                    name += '/';
+                name.append(segment, length);
+            }
+            if (!end)
+                break;
+            segment = end + 1;
+        }
+    }
+
+    uint64_t nameHash(const std::string& name)
+    {
+        return hashBytes(name.data(), name.size());
+    }
+}
+
+std::atomic<const AssetPack*> AssetPack::mountedPack(nullptr);
+
+bool AssetPack::open(const char* path, bool looseOverrides)
+{
+    close();
+    if (!file.open(path))
+        return false;
+
+    PackHeader header;
+    bool valid = file.size() >= sizeof(header);
+    if (valid)
+    {
+        memcpy(&header, file.data(), sizeof(header));
+        uint64_t slotBytes = uint64_t(header.slotCount) * sizeof(PackEntry);
+        valid = memcmp(header.magic, packMagic, sizeof(packMagic)) == 0 && header.version == version &&
+                header.slotCount > 0 && (header.slotCount & (header.slotCount - 1)) == 0 &&
+                header.entryCount <= header.slotCount &&
+                header.slotsOffset <= file.size() && slotBytes <= file.size() - header.slotsOffset &&
+                header.namesOffset <= file.size() && header.namesSize <= file.size() - header.namesOffset;
+    }
+
+    // Every entry must lie inside the file, so find() needs no checks
+    for (uint32_t i = 0; valid && i < header.slotCount; i++)
+    {
+        PackEntry entry;
+        memcpy(&entry, file.data() + header.slotsOffset + i * sizeof(PackEntry), sizeof(entry));
+        valid = entry.nameOffset <= header.namesSize && entry.nameLength <= header.namesSize - entry.nameOffset &&
+                entry.offset <= file.size() && entry.size <= file.size() - entry.offset;
+    }
+    if (!valid)
+    {
+        printf("Asset pack %s is corrupt\n", path);
+        file.close();
+        return false;
+    }
+
+    slots = file.data() + header.slotsOffset;
+    slotCount = header.slotCount;
+    names = file.data() + header.namesOffset;
+    entries = header.entryCount;
+
+    // Both directories are normalised once here, lookups only append to them
+    std::error_code error;
+    std::filesystem::path directory = std::filesystem::absolute(std::filesystem::path(path).parent_path(), error);
+    root = normalName(directory.relative_path());
+    workingDirectory = normalName(std::filesystem::current_path(error).relative_path());
+
+    // Loose files are stat'd once here rather than on every lookup
+    if (looseOverrides)
+    {
+        std::filesystem::file_time_type packTime = std::filesystem::last_write_time(path, error);
+        loose.reset(new std::atomic<bool>[slotCount]);
+        for (uint32_t i = 0; i < slotCount; i++)
+        {
+            PackEntry entry;
+            memcpy(&entry, slots + size_t(i) * sizeof(PackEntry), sizeof(entry));
+            std::filesystem::file_time_type looseTime;
+            if (entry.nameLength != 0)
+            {
+                std::string loosePath = "/" + root + (root.empty() ? "" : "/") +
+                                        std::string(names + entry.nameOffset, entry.nameLength);
+                looseTime = std::filesystem::last_write_time(loosePath, error);
+            }
+            loose[i].store(entry.nameLength != 0 && !error && looseTime > packTime, std::memory_order_relaxed);
+        }
+    }
+    return true;
+}
+
+void AssetPack::close()
+{
+    file.close();
+    slots = nullptr;
+    slotCount = 0;
+    names = nullptr;
+    entries = 0;
+    root.clear();
+    workingDirectory.clear();
+    loose.reset();
+}
+
+bool AssetPack::find(const char* path, PackBlob& blob) const
+{
+    uint32_t slot;
+    if (!findSlot(path, slot) || (loose && loose[slot].load(std::memory_order_relaxed)))
+        return false;
+
+    PackEntry entry;
+    memcpy(&entry, slots + size_t(slot) * sizeof(PackEntry), sizeof(entry));
+    blob.data = file.data() + entry.offset;
+    blob.size = entry.size;
+    blob.contentHash = entry.contentHash;
+    return true;
+}
+
+void AssetPack::preferLoose(const char* path) const
+{
+    uint32_t slot;
+    if (loose && findSlot(path, slot))
+        loose[slot].store(true, std::memory_order_relaxed);
+}
+
+bool AssetPack::findSlot(const char* path, uint32_t& slot) const
+{
+    if (!file.isOpen())
+        return false;
+
+    // Name relative to the pack's directory
+    std::string name;
+    if (path[0] != '/')
+        name = workingDirectory;
+    appendNormal(name, path);
+    if (!root.empty())
+    {
+        if (name.size() <= root.size() || name.compare(0, root.size(), root) != 0 || name[root.size()] != '/')
+            return false;
+        name.erase(0, root.size() + 1);
+    }
+    if (name.empty())
+        return false;
+
+    // Linear probing from the hashed slot until a free one
+    uint64_t hash = nameHash(name);
+    uint32_t mask = slotCount - 1;
+    slot = uint32_t(hash) & mask;
+    for (uint32_t probe = 0; probe < slotCount; probe++, slot = (slot + 1) & mask)
+    {
+        PackEntry entry;
+        memcpy(&entry, slots + size_t(slot) * sizeof(PackEntry), sizeof(entry));
+        if (entry.nameLength == 0)
+            return false;
+        if (entry.nameHash == hash && entry.nameLength == name.size() &&
+            memcmp(names + entry.nameOffset, name.data(), name.size()) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool AssetPack::write(const char* packPath, const std::vector<PackSource>& sources)
+{
+    // Keep the table at most half full
+    uint32_t slotCount = 1;
+    while (slotCount < sources.size() * 2)
+        slotCount *= 2;
+
+    // Table of contents and names
+    std::vector<PackEntry> table(slotCount);
+    memset(table.data(), 0, table.size() * sizeof(PackEntry));
+    std::string nameBlock;
+    std::vector<uint32_t> slotOf(sources.size());
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        std::string name = normalName(sources[i].name);
+        uint64_t hash = nameHash(name);
+        uint32_t slot = uint32_t(hash) & (slotCount - 1);
+        while (table[slot].nameLength != 0)
+        {
+            if (table[slot].nameHash == hash && nameBlock.compare(table[slot].nameOffset, table[slot].nameLength, name) == 0)
+            {
+                printf("%s is packed twice\n", name.c_str());
+                return false;
+            }
+            slot = (slot + 1) & (slotCount - 1);
+        }
+        table[slot].nameHash = hash;
+        table[slot].contentHash = sources[i].contentHash;
+        table[slot].nameOffset = static_cast<uint32_t>(nameBlock.size());
+        table[slot].nameLength = static_cast<uint32_t>(name.size());
+        nameBlock += name;
+        slotOf[i] = slot;
+    }
+
+    // Blob offsets, in the order given so related files stay together
+    std::vector<MappedFile> blobs(sources.size());
+    uint64_t offset = CacheFile::alignUp(sizeof(PackHeader));
+    uint64_t slotsOffset = offset;
+    offset = CacheFile::alignUp(offset + table.size() * sizeof(PackEntry));
+    uint64_t namesOffset = offset;
+    offset = CacheFile::alignUp(offset + nameBlock.size());
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        if (!blobs[i].open(sources[i].path.c_str()))
+        {
+            printf("Could not read %s\n", sources[i].path.c_str());
+            return false;
+        }
+        table[slotOf[i]].offset = offset;
+        table[slotOf[i]].size = blobs[i].size();
+        offset = CacheFile::alignUp(offset + blobs[i].size());
+    }
+
+    PackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, packMagic, sizeof(packMagic));
+    header.version = version;
+    header.entryCount = static_cast<uint32_t>(sources.size());
+    header.slotCount = slotCount;
+    header.slotsOffset = slotsOffset;
+    header.namesOffset = namesOffset;
+    header.namesSize = nameBlock.size();
+
+    // Write to a temporary file first so readers never see a partial pack
+    std::string temporaryPath = CacheFile::temporaryPath(packPath);
+    FILE* out = fopen(temporaryPath.c_str(), "wb");
+    if (out == NULL)
+    {
+        printf("Could not write asset pack %s\n", packPath);
+        return false;
+    }
+
+    offset = 0;
+    bool ok = CacheFile::writePadded(out, &header, sizeof(header), offset) &&
+              CacheFile::writePadded(out, table.data(), table.size() * sizeof(PackEntry), offset) &&
+              CacheFile::writePadded(out, nameBlock.data(), nameBlock.size(), offset);
+    for (size_t i = 0; ok && i < blobs.size(); i++)
+        ok = CacheFile::writePadded(out, blobs[i].data(), blobs[i].size(), offset);
+    ok = fclose(out) == 0 && ok;
+
+    if (!CacheFile::commit(temporaryPath, packPath, ok))
+    {
+        printf("Could not write asset pack %s\n", packPath);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mappedfile.hpp"
+
+// One packed file, pointing into the mapping
+struct PackBlob
+{
+    const char* data = nullptr;
+    size_t size = 0;
+    uint64_t contentHash = 0;   // hash of the source the blob was cooked from
+};
+
+// A file to pack: name relative to the pack, where to read it from and the
+// hash of its source
+struct PackSource
+{
+    std::string name;
+    std::string path;
+    uint64_t contentHash = 0;
+};
+
+// Single-file .cgpak archive: header, an open-addressed table of contents
+// keyed by the hashed name, the names, then 16-byte aligned blobs. The whole
+// file is mapped once, so a lookup is one probe sequence and a pointer into
+// the mapping, and blobs can be uploaded to GL without copying.
+class AssetPack
+{
+public:
+    static const uint32_t version = 1;
+
+    // map the pack, names resolve relative to the directory it is in.
+    // looseOverrides is for development: loose files already newer than the
+    // pack are found once here, and they and any passed to preferLoose()
+    // are left to the file system instead of being served from the pack.
+    bool open(const char* path, bool looseOverrides = false);
+    void close();
+    bool isOpen() const { return file.isOpen(); }
+
+    // blob stored for a path, given relative to the working directory as it
+    // was when the pack was opened; false for an overridden loose file
+    bool find(const char* path, PackBlob& blob) const;
+
+    // stop serving path from the pack once its loose file has been edited,
+    // safe from any thread; does nothing unless opened with looseOverrides
+    void preferLoose(const char* path) const;
+
+    size_t entryCount() const { return entries; }
+
+    // write sources into a new pack, replacing any older one atomically
+    static bool write(const char* packPath, const std::vector<PackSource>& sources);
+
+    // The pack the mesh and texture caches read from before the file system.
+    // Mount before loading starts and keep it open while it is mounted.
+    static void mount(const AssetPack* pack) { mountedPack.store(pack, std::memory_order_release); }
+    static const AssetPack* mounted() { return mountedPack.load(std::memory_order_acquire); }
+
+private:
+    MappedFile file;
+    // absolute and normal, without the leading /
+    std::string root;
+    std::string workingDirectory;
+    std::unique_ptr<std::atomic<bool>[]> loose;   // per slot, null without looseOverrides
+    const char* slots = nullptr;
+    uint32_t slotCount = 0;
+    const char* names = nullptr;
+    size_t entries = 0;
+
+    // slot holding path's entry
+    bool findSlot(const char* path, uint32_t& slot) const;
+
+    static std::atomic<const AssetPack*> mountedPack;
+};
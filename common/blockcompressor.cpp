@@ -0,0 +1,621 @@
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "blockcompressor.hpp"
+#include "threadpool.hpp"
+
+namespace
+{
+    // Blocks per call before the rows are split across threads
+    const size_t parallelThreshold = 1024;
+
+    // Texels of one block as floats, rows of four
+    struct Block
+    {
+        float texels[16][4];
+    };
+
+    void loadBlock(const ImageData& image, int bx, int by, Block& block)
+    {
+        for (int y = 0; y < 4; y++)
+        {
+            int sy = std::min(by * 4 + y, image.height - 1);
+            for (int x = 0; x < 4; x++)
+            {
+                int sx = std::min(bx * 4 + x, image.width - 1);
+                const unsigned char* texel = &image.pixels[(size_t(sy) * image.width + sx) * image.channels];
+                float* out = block.texels[y * 4 + x];
+                for (int c = 0; c < 4; c++)
+                    out[c] = c < image.channels ? texel[c] : (c == 3 ? 255.0f : 0.0f);
+            }
+        }
+    }
+
+    void writeLittle16(unsigned char* out, unsigned int value)
+    {
+        out[0] = static_cast<unsigned char>(value & 0xFF);
+        out[1] = static_cast<unsigned char>(value >> 8);
+    }
+
+    unsigned int readLittle16(const unsigned char* in)
+    {
+        return in[0] | (in[1] << 8);
+    }
+
+    // ---- BC1 colour -------------------------------------------------------
+
+    unsigned int packColour(const float* rgb)
+    {
+        int r = static_cast<int>(std::min(31.0f, std::max(0.0f, rgb[0] * (31.0f / 255.0f) + 0.5f)));
+        int g = static_cast<int>(std::min(63.0f, std::max(0.0f, rgb[1] * (63.0f / 255.0f) + 0.5f)));
+        int b = static_cast<int>(std::min(31.0f, std::max(0.0f, rgb[2] * (31.0f / 255.0f) + 0.5f)));
+        return static_cast<unsigned int>((r << 11) | (g << 5) | b);
+    }
+
+    void unpackColour(unsigned int colour, int* rgb)
+    {
+        int r = (colour >> 11) & 31;
+        int g = (colour >> 5) & 63;
+        int b = colour & 31;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    // Four colour palette in index order: c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+    void colourPalette(unsigned int c0, unsigned int c1, bool fourColour, int palette[4][3])
+    {
+        unpackColour(c0, palette[0]);
+        unpackColour(c1, palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            if (fourColour)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            else
+            {
+                palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                palette[3][c] = 0;
+            }
+        }
+    }
+
+    // Nearest palette entry per texel, returns the squared error
+    float colourIndices(const Block& block, unsigned int c0, unsigned int c1, uint32_t& indices)
+    {
+        int palette[4][3];
+        colourPalette(c0, c1, true, palette);
+        indices = 0;
+        float total = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            const float* texel = block.texels[i];
+            float best = 1e30f;
+            int bestIndex = 0;
+            for (int p = 0; p < 4; p++)
+            {
+                float dr = texel[0] - palette[p][0];
+                float dg = texel[1] - palette[p][1];
+                float db = texel[2] - palette[p][2];
+                float error = dr * dr + dg * dg + db * db;
+                if (error < best)
+                {
+                    best = error;
+                    bestIndex = p;
+                }
+            }
+            indices |= uint32_t(bestIndex) << (i * 2);
+            total += best;
+        }
+        return total;
+    }
+
+    // Quantise two endpoints into four colour order (c0 > c1), returns the error
+    float fitColours(const Block& block, const float* a, const float* b, unsigned int& c0, unsigned int& c1,
+                     uint32_t& indices)
+    {
+        c0 = packColour(a);
+        c1 = packColour(b);
+        if (c0 < c1)
+            std::swap(c0, c1);
+        if (c0 == c1)
+        {
+            // One colour, every index 0 decodes to it in either mode
+            int rgb[3];
+            unpackColour(c0, rgb);
+            indices = 0;
+            float total = 0.0f;
+            for (int i = 0; i < 16; i++)
+                for (int c = 0; c < 3; c++)
+                    total += (block.texels[i][c] - rgb[c]) * (block.texels[i][c] - rgb[c]);
+            return total;
+        }
+        return colourIndices(block, c0, c1, indices);
+    }
+
+    void encodeColour(const Block& block, BlockQuality quality, unsigned char* out)
+    {
+        // Mean, range and covariance of the colours
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        float low[3] = { 255.0f, 255.0f, 255.0f };
+        float high[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                mean[c] += block.texels[i][c] / 16.0f;
+                low[c] = std::min(low[c], block.texels[i][c]);
+                high[c] = std::max(high[c], block.texels[i][c]);
+            }
+        }
+        float covariance[3][3] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            float d[3] = { block.texels[i][0] - mean[0], block.texels[i][1] - mean[1], block.texels[i][2] - mean[2] };
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 3; c++)
+                    covariance[r][c] += d[r] * d[c];
+        }
+
+        // The channel that varies most, and which others fall as it rises
+        int dominant = 0;
+        for (int c = 1; c < 3; c++)
+        {
+            if (covariance[c][c] > covariance[dominant][dominant])
+                dominant = c;
+        }
+
+        // Bounding box along the right diagonal, inset a little since the
+        // corners are rarely used
+        for (int c = 0; c < 3; c++)
+        {
+            float inset = (high[c] - low[c]) / 16.0f;
+            low[c] += inset;
+            high[c] -= inset;
+            if (covariance[dominant][c] < 0.0f)
+                std::swap(low[c], high[c]);
+        }
+
+        unsigned int c0, c1;
+        uint32_t indices;
+        float best = fitColours(block, high, low, c0, c1, indices);
+
+        if (quality == BlockHigh && best > 0.0f)
+        {
+            // Principal axis of the colours by power iteration, starting from
+            // the dominant channel's row so it can't start orthogonal
+            float axis[3] = { covariance[dominant][0], covariance[dominant][1], covariance[dominant][2] };
+            for (int iteration = 0; iteration < 8; iteration++)
+            {
+                float next[3];
+                for (int r = 0; r < 3; r++)
+                    next[r] = covariance[r][0] * axis[0] + covariance[r][1] * axis[1] + covariance[r][2] * axis[2];
+                float length = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+                if (length < 1e-6f)
+                    break;
+                for (int c = 0; c < 3; c++)
+                    axis[c] = next[c] / length;
+            }
+            float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+            for (int c = 0; c < 3; c++)
+                axis[c] = length > 1e-6f ? axis[c] / length : 0.0f;
+
+            // Extremes along the axis
+            float minimum = 1e30f, maximum = -1e30f;
+            for (int i = 0; i < 16; i++)
+            {
+                float t = 0.0f;
+                for (int c = 0; c < 3; c++)
+                    t += (block.texels[i][c] - mean[c]) * axis[c];
+                minimum = std::min(minimum, t);
+                maximum = std::max(maximum, t);
+            }
+            float a[3], b[3];
+            for (int c = 0; c < 3; c++)
+            {
+                a[c] = mean[c] + axis[c] * maximum;
+                b[c] = mean[c] + axis[c] * minimum;
+            }
+
+            unsigned int t0, t1;
+            uint32_t tIndices;
+            float error = fitColours(block, a, b, t0, t1, tIndices);
+            if (error < best)
+            {
+                best = error;
+                c0 = t0;
+                c1 = t1;
+                indices = tIndices;
+            }
+
+            // Least squares endpoints for the chosen indices, a few rounds
+            const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+            for (int iteration = 0; iteration < 3 && best > 0.0f; iteration++)
+            {
+                float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+                float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+                for (int i = 0; i < 16; i++)
+                {
+                    float alpha = weights[(indices >> (i * 2)) & 3];
+                    float beta = 1.0f - alpha;
+                    aa += alpha * alpha;
+                    ab += alpha * beta;
+                    bb += beta * beta;
+                    for (int c = 0; c < 3; c++)
+                    {
+                        ax[c] += alpha * block.texels[i][c];
+                        bx[c] += beta * block.texels[i][c];
+                    }
+                }
+                float determinant = aa * bb - ab * ab;
+                if (fabsf(determinant) < 1e-6f)
+                    break;
+                for (int c = 0; c < 3; c++)
+                {
+                    a[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+                    b[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+                }
+                error = fitColours(block, a, b, t0, t1, tIndices);
+                if (error >= best)
+                    break;
+                best = error;
+                c0 = t0;
+                c1 = t1;
+                indices = tIndices;
+            }
+        }
+
+        writeLittle16(out, c0);
+        writeLittle16(out + 2, c1);
+        for (int i = 0; i < 4; i++)
+            out[4 + i] = static_cast<unsigned char>((indices >> (i * 8)) & 0xFF);
+    }
+
+    void decodeColour(const unsigned char* in, bool alwaysFourColour, unsigned char* out, int stride)
+    {
+        unsigned int c0 = readLittle16(in);
+        unsigned int c1 = readLittle16(in + 2);
+        int palette[4][3];
+        colourPalette(c0, c1, alwaysFourColour || c0 > c1, palette);
+        uint32_t indices = in[4] | (in[5] << 8) | (in[6] << 16) | (uint32_t(in[7]) << 24);
+        for (int i = 0; i < 16; i++)
+        {
+            int index = (indices >> (i * 2)) & 3;
+            for (int c = 0; c < 3; c++)
+                out[i * stride + c] = static_cast<unsigned char>(palette[index][c]);
+        }
+    }
+
+    // ---- BC4 single channel ----------------------------------------------
+
+    // Palette in index order for either mode
+    void valuePalette(int v0, int v1, int palette[8])
+    {
+        palette[0] = v0;
+        palette[1] = v1;
+        if (v0 > v1)
+        {
+            for (int i = 1; i < 7; i++)
+                palette[i + 1] = ((7 - i) * v0 + i * v1) / 7;
+        }
+        else
+        {
+            for (int i = 1; i < 5; i++)
+                palette[i + 1] = ((5 - i) * v0 + i * v1) / 5;
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+
+    int valueIndices(const float* values, int v0, int v1, uint64_t& indices)
+    {
+        int palette[8];
+        valuePalette(v0, v1, palette);
+        indices = 0;
+        int total = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            int value = static_cast<int>(values[i]);
+            int best = 1 << 30;
+            int bestIndex = 0;
+            for (int p = 0; p < 8; p++)
+            {
+                int error = (value - palette[p]) * (value - palette[p]);
+                if (error < best)
+                {
+                    best = error;
+                    bestIndex = p;
+                }
+            }
+            indices |= uint64_t(bestIndex) << (i * 3);
+            total += best;
+        }
+        return total;
+    }
+
+    void encodeValues(const float* values, BlockQuality quality, unsigned char* out)
+    {
+        int low = 255, high = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            low = std::min(low, static_cast<int>(values[i]));
+            high = std::max(high, static_cast<int>(values[i]));
+        }
+
+        // Eight value mode over the range
+        int v0 = high, v1 = low;
+        uint64_t indices;
+        int best = valueIndices(values, v0, v1, indices);
+
+        if (quality == BlockHigh && best > 0)
+        {
+            // Tighten the range, the ends are often outliers
+            for (int dh = 0; dh <= 4; dh++)
+            {
+                for (int dl = 0; dl <= 4; dl++)
+                {
+                    int t0 = high - dh, t1 = low + dl;
+                    if (t0 <= t1 || (dh == 0 && dl == 0))
+                        continue;
+                    uint64_t tIndices;
+                    int error = valueIndices(values, t0, t1, tIndices);
+                    if (error < best)
+                    {
+                        best = error;
+                        v0 = t0;
+                        v1 = t1;
+                        indices = tIndices;
+                    }
+                }
+            }
+
+            // Six value mode, with exact 0 and 255 for the extremes
+            int innerLow = 255, innerHigh = 0;
+            for (int i = 0; i < 16; i++)
+            {
+                int value = static_cast<int>(values[i]);
+                if (value > 0 && value < 255)
+                {
+                    innerLow = std::min(innerLow, value);
+                    innerHigh = std::max(innerHigh, value);
+                }
+            }
+            if (innerLow <= innerHigh)
+            {
+                uint64_t tIndices;
+                int error = valueIndices(values, innerLow, innerHigh, tIndices);
+                if (error < best)
+                {
+                    best = error;
+                    v0 = innerLow;
+                    v1 = innerHigh;
+                    indices = tIndices;
+                }
+            }
+        }
+
+        out[0] = static_cast<unsigned char>(v0);
+        out[1] = static_cast<unsigned char>(v1);
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = static_cast<unsigned char>((indices >> (i * 8)) & 0xFF);
+    }
+
+    void decodeValues(const unsigned char* in, unsigned char* out, int stride)
+    {
+        int palette[8];
+        valuePalette(in[0], in[1], palette);
+        uint64_t indices = 0;
+        for (int i = 0; i < 6; i++)
+            indices |= uint64_t(in[2 + i]) << (i * 8);
+        for (int i = 0; i < 16; i++)
+            out[i * stride] = static_cast<unsigned char>(palette[(indices >> (i * 3)) & 7]);
+    }
+
+    void encodeBlock(const Block& block, BlockFormat format, BlockQuality quality, unsigned char* out)
+    {
+        float values[16];
+        switch (format)
+        {
+        case BlockBC1:
+            encodeColour(block, quality, out);
+            break;
+        case BlockBC3:
+            for (int i = 0; i < 16; i++)
+                values[i] = block.texels[i][3];
+            encodeValues(values, quality, out);
+            encodeColour(block, quality, out + 8);
+            break;
+        case BlockBC4:
+            for (int i = 0; i < 16; i++)
+                values[i] = block.texels[i][0];
+            encodeValues(values, quality, out);
+            break;
+        case BlockBC5:
+            for (int c = 0; c < 2; c++)
+            {
+                for (int i = 0; i < 16; i++)
+                    values[i] = block.texels[i][c];
+                encodeValues(values, quality, out + c * 8);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+size_t BlockCompressor::blockBytes(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockBC1:
+    case BlockBC4:
+        return 8;
+    case BlockBC3:
+    case BlockBC5:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+size_t BlockCompressor::compressedSize(BlockFormat format, int width, int height)
+{
+    return size_t((width + 3) / 4) * size_t((height + 3) / 4) * blockBytes(format);
+}
+
+int BlockCompressor::channelCount(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockBC1: return 3;
+    case BlockBC3: return 4;
+    case BlockBC4: return 1;
+    case BlockBC5: return 2;
+    default: return 0;
+    }
+}
+
+BlockFormat BlockCompressor::formatFor(const ImageData& image, MipContent content)
+{
+    if (image.channels == 1)
+        return BlockBC4;
+    if (image.channels == 2 || content == MipNormal)
+        return BlockBC5;
+
+    // Data stored as grey RGB only needs one channel
+    size_t texels = size_t(image.width) * image.height;
+    const unsigned char* pixels = image.pixels.data();
+    if (content == MipLinear)
+    {
+        bool grey = true;
+        for (size_t i = 0; grey && i < texels; i++)
+        {
+            const unsigned char* texel = pixels + i * image.channels;
+            grey = texel[0] == texel[1] && texel[1] == texel[2];
+        }
+        if (grey)
+            return BlockBC4;
+    }
+
+    if (image.channels == 4)
+    {
+        for (size_t i = 0; i < texels; i++)
+        {
+            if (pixels[i * 4 + 3] != 255)
+                return BlockBC3;
+        }
+    }
+    return BlockBC1;
+}
+
+bool BlockCompressor::encode(const ImageData& image, BlockFormat format, BlockQuality quality,
+                             CompressedImage& out, unsigned int threads)
+{
+    if (format == BlockNone || image.width <= 0 || image.height <= 0 ||
+        image.channels < 1 || image.channels > 4)
+        return false;
+
+    int blocksWide = (image.width + 3) / 4;
+    int blocksHigh = (image.height + 3) / 4;
+    size_t bytes = blockBytes(format);
+    out.width = image.width;
+    out.height = image.height;
+    out.format = format;
+    out.blocks.resize(compressedSize(format, image.width, image.height));
+
+    // Every row of blocks writes only its own bytes
+    if (size_t(blocksWide) * blocksHigh < parallelThreshold)
+        threads = 1;
+    parallelFor(blocksHigh, threads, [&](size_t begin, size_t end) {
+        Block block;
+        for (size_t by = begin; by < end; by++)
+        {
+            for (int bx = 0; bx < blocksWide; bx++)
+            {
+                loadBlock(image, bx, static_cast<int>(by), block);
+                encodeBlock(block, format, quality, &out.blocks[(by * blocksWide + bx) * bytes]);
+            }
+        }
+    });
+    return true;
+}
+
+void BlockCompressor::decode(BlockFormat format, const unsigned char* blocks, int width, int height, ImageData& out)
+{
+    int channels = channelCount(format);
+    out.width = width;
+    out.height = height;
+    out.channels = channels;
+    out.pixels.assign(size_t(width) * height * channels, 0);
+    if (channels == 0)
+        return;
+
+    int blocksWide = (width + 3) / 4;
+    int blocksHigh = (height + 3) / 4;
+    size_t bytes = blockBytes(format);
+    unsigned char texels[16 * 4];
+    for (int by = 0; by < blocksHigh; by++)
+    {
+        for (int bx = 0; bx < blocksWide; bx++)
+        {
+            const unsigned char* in = blocks + (size_t(by) * blocksWide + bx) * bytes;
+            switch (format)
+            {
+            case BlockBC1:
+                decodeColour(in, false, texels, channels);
+                break;
+            case BlockBC3:
+                decodeValues(in, texels + 3, channels);
+                decodeColour(in + 8, true, texels, channels);
+                break;
+            case BlockBC4:
+                decodeValues(in, texels, channels);
+                break;
+            case BlockBC5:
+                decodeValues(in, texels, channels);
+                decodeValues(in + 8, texels + 1, channels);
+                break;
+            default:
+                break;
+            }
+
+            // Drop the texels past the edge
+            for (int y = 0; y < 4 && by * 4 + y < height; y++)
+            {
+                for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+                {
+                    memcpy(&out.pixels[((size_t(by) * 4 + y) * width + bx * 4 + x) * channels],
+                           &texels[(y * 4 + x) * channels], channels);
+                }
+            }
+        }
+    }
+}
+
+double BlockCompressor::psnr(const ImageData& original, const ImageData& decoded, int channels)
+{
+    if (original.width != decoded.width || original.height != decoded.height)
+        return 0.0;
+
+    // Channels an image lacks read as opaque black, as the loader pads them
+    size_t texels = size_t(original.width) * original.height;
+    double sum = 0.0;
+    for (size_t i = 0; i < texels; i++)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            int a = c < original.channels ? original.pixels[i * original.channels + c] : (c == 3 ? 255 : 0);
+            int b = c < decoded.channels ? decoded.pixels[i * decoded.channels + c] : (c == 3 ? 255 : 0);
+            sum += double(a - b) * (a - b);
+        }
+    }
+    double mse = sum / (double(texels) * channels);
+    if (mse <= 0.0)
+        return 100.0;
+    return std::min(100.0, 10.0 * log10(255.0 * 255.0 / mse));
+}
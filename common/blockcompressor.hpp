@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+#include "image.hpp"
+#include "mipgenerator.hpp"
+
+enum BlockFormat
+{
+    BlockNone,      // uncompressed texels
+    BlockBC1,       // RGB, 4 bits per texel
+    BlockBC3,       // RGBA with a separate alpha block, 8 bits per texel
+    BlockBC4,       // one channel, 4 bits per texel
+    BlockBC5        // two channels, 8 bits per texel
+};
+
+enum BlockQuality
+{
+    BlockFast,      // bounding box endpoints
+    BlockHigh       // principal axis endpoints refined by least squares
+};
+
+// One image in 4x4 blocks, edge blocks repeat the last row and column
+struct CompressedImage
+{
+    int width = 0;
+    int height = 0;
+    BlockFormat format = BlockNone;
+    std::vector<unsigned char> blocks;
+};
+
+// BCn (S3TC / RGTC) encoder and decoder
+class BlockCompressor
+{
+public:
+    // bytes per 4x4 block
+    static size_t blockBytes(BlockFormat format);
+
+    // bytes for an image of the size, 0 for BlockNone
+    static size_t compressedSize(BlockFormat format, int width, int height);
+
+    // channels the format stores: 3, 4, 1 and 2
+    static int channelCount(BlockFormat format);
+
+    // BC5 for normals, BC4 for single channel or grey data, BC3 when any
+    // texel is translucent and BC1 otherwise
+    static BlockFormat formatFor(const ImageData& image, MipContent content);
+
+    // threads = 0 uses every core, rows of blocks are split between them
+    static bool encode(const ImageData& image, BlockFormat format, BlockQuality quality,
+                       CompressedImage& out, unsigned int threads = 0);
+
+    // back to channelCount(format) channels, for checking and for drivers
+    // without the format
+    static void decode(BlockFormat format, const unsigned char* blocks, int width, int height, ImageData& out);
+
+    // peak signal to noise ratio in dB over the first channels of both images,
+    // 100 when they match exactly
+    static double psnr(const ImageData& original, const ImageData& decoded, int channels);
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <filesystem>
+#include <system_error>
+
+#include "mappedfile.hpp"
+#include "hash.hpp"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+// Helpers shared by the binary cache formats (.cgmesh, .cgtex)
+namespace CacheFile
+{
+    // Identifies the source file a cache was baked from, stored in its header
+    struct SourceKey
+    {
+        uint64_t size;
+        int64_t mtime;
+        uint64_t hash;
+    };
+
+    // Blobs start at 16-byte aligned offsets so they can be used in place
+    const uint64_t alignment = 16;
+
+    inline uint64_t alignUp(uint64_t value)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    // Write size bytes then zeros up to the next aligned offset
+    inline bool writePadded(FILE* file, const void* data, uint64_t size, uint64_t& offset)
+    {
+        static const char zeros[alignment] = {};
+        if (size > 0 && fwrite(data, 1, size, file) != size)
+            return false;
+        uint64_t padding = alignUp(offset + size) - (offset + size);
+        if (padding > 0 && fwrite(zeros, 1, padding, file) != padding)
+            return false;
+        offset += size + padding;
+        return true;
+    }
+
+    // Name to write path's replacement under before renaming it into place.
+    // Unique to the process and the call, so workers or cook runs writing
+    // the same cache at once never share a half-written file.
+    inline std::string temporaryPath(const std::string& path)
+    {
+        static std::atomic<unsigned long> counter(0);
+#ifdef _WIN32
+        long process = _getpid();
+#else
+        long process = getpid();
+#endif
+        return path + "." + std::to_string(process) + "-" + std::to_string(counter.fetch_add(1)) + ".tmp";
+    }
+
+    // Size and modification time of a source, plus its content hash when asked for
+    inline bool sourceKey(const char* sourcePath, SourceKey& key, bool hashContents)
+    {
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(sourcePath, error);
+        if (error)
+            return false;
+        std::filesystem::file_time_type mtime = std::filesystem::last_write_time(sourcePath, error);
+        if (error)
+            return false;
+
+        key.size = static_cast<uint64_t>(size);
+        key.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+        key.hash = 0;
+
+        if (hashContents)
+        {
+            MappedFile file;
+            if (!file.open(sourcePath))
+                return false;
+            key.hash = hashBytes(file.data(), file.size());
+        }
+        return true;
+    }
+
+    // Rename a fully written temporary over path, or remove it when it was
+    // not written or the rename fails; true once path holds the new file
+    inline bool commit(const std::string& temporaryPath, const std::string& path, bool written = true)
+    {
+        std::error_code error;
+        if (written)
+            std::filesystem::rename(temporaryPath, path, error);
+        if (!written || error)
+        {
+            std::filesystem::remove(temporaryPath, error);
+            return false;
+        }
+        return true;
+    }
+
+    // Overwrite size bytes at offset of an existing file in place, for
+    // header fields that can change without the rest being rewritten
+    inline bool patch(const char* path, uint64_t offset, const void* data, size_t size)
+    {
+        FILE* file = fopen(path, "r+b");
+        if (file == NULL)
+            return false;
+        bool ok = fseek(file, static_cast<long>(offset), SEEK_SET) == 0 && fwrite(data, 1, size, file) == size;
+        return fclose(file) == 0 && ok;
+    }
+
+    // True when the key baked into the cache at path still describes
+    // sourcePath. A touched but unchanged source still matches by content;
+    // the new time goes into the header at keyOffset so later starts skip
+    // the hash.
+    inline bool matchesSource(const char* sourcePath, const SourceKey& baked, const std::string& path,
+                              uint64_t keyOffset)
+    {
+        SourceKey key;
+        if (!sourceKey(sourcePath, key, false) || key.size != baked.size)
+            return false;
+        if (key.mtime == baked.mtime)
+            return true;
+        if (!sourceKey(sourcePath, key, true) || key.hash != baked.hash)
+            return false;
+        patch(path.c_str(), keyOffset + offsetof(SourceKey, mtime), &key.mtime, sizeof(key.mtime));
+        return true;
+    }
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <filesystem>
+#include <set>
+#include <system_error>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "filewatcher.hpp"
+
+namespace
+{
+    long long modificationTime(const std::string& path)
+    {
+        std::error_code error;
+        std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+        return error ? 0 : static_cast<long long>(time.time_since_epoch().count());
+    }
+
+    // Directory part and file name part of a path
+    void splitPath(const std::string& path, std::string& directory, std::string& name)
+    {
+        std::filesystem::path full(path);
+        directory = full.has_parent_path() ? full.parent_path().string() : std::string(".");
+        name = full.filename().string();
+    }
+}
+
+FileWatcher::FileWatcher()
+{
+#ifdef __linux__
+    inotifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFD < 0)
+        printf("inotify unavailable, falling back to polling file times\n");
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+    if (inotifyFD >= 0)
+        close(inotifyFD);
+#endif
+}
+
+bool FileWatcher::watch(const std::string& path, Callback callback)
+{
+    WatchedFile& file = files[path];
+    file.callbacks.push_back(callback);
+    file.mtime = modificationTime(path);
+    if (file.callbacks.size() > 1)
+        return true;
+
+#ifdef __linux__
+    if (inotifyFD >= 0)
+    {
+        std::string directory, name;
+        splitPath(path, directory, name);
+        if (directoryFiles.find(directory) == directoryFiles.end())
+        {
+            int wd = inotify_add_watch(inotifyFD, directory.c_str(),
+                                       IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd < 0)
+            {
+                printf("Could not watch %s\n", directory.c_str());
+                return false;
+            }
+            directories[wd] = directory;
+        }
+        directoryFiles[directory].push_back(path);
+    }
+#endif
+    return true;
+}
+
+void FileWatcher::poll()
+{
+    std::set<std::string> changed;
+
+#ifdef __linux__
+    if (inotifyFD >= 0)
+    {
+        // Drain every pending event
+        alignas(struct inotify_event) char buffer[4096];
+        for (;;)
+        {
+            ssize_t length = read(inotifyFD, buffer, sizeof(buffer));
+            if (length <= 0)
+                break;
+            for (char* p = buffer; p < buffer + length; )
+            {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+                p += sizeof(struct inotify_event) + event->len;
+                if (event->len == 0)
+                    continue;
+
+                std::map<int, std::string>::const_iterator directory = directories.find(event->wd);
+                if (directory == directories.end())
+                    continue;
+                for (const std::string& path : directoryFiles[directory->second])
+                {
+                    std::string dir, name;
+                    splitPath(path, dir, name);
+                    if (name == event->name)
+                        changed.insert(path);
+                }
+            }
+        }
+    }
+    else
+#endif
+    {
+        for (std::map<std::string, WatchedFile>::value_type& entry : files)
+        {
+            long long mtime = modificationTime(entry.first);
+            if (mtime != 0 && mtime != entry.second.mtime)
+            {
+                entry.second.mtime = mtime;
+                changed.insert(entry.first);
+            }
+        }
+    }
+
+    for (const std::string& path : changed)
+    {
+        printf("Changed %s\n", path.c_str());
+        for (const Callback& callback : files[path].callbacks)
+            callback(path);
+    }
+}
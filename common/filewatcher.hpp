@@ -0,0 +1,47 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Reports changes to individual files. On Linux it uses inotify on the
+// parent directories, so editors that save by writing a new file and
+// renaming it over the old one are still seen; elsewhere poll() compares
+// modification times.
+class FileWatcher
+{
+public:
+    typedef std::function<void(const std::string& path)> Callback;
+
+    FileWatcher();
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // call back whenever path is written, several callbacks per file are fine
+    bool watch(const std::string& path, Callback callback);
+
+    // non-blocking; runs the callbacks of files changed since the last call,
+    // each at most once however many events the save produced
+    void poll();
+
+private:
+    struct WatchedFile
+    {
+        std::vector<Callback> callbacks;
+        long long mtime = 0;
+    };
+
+    // keyed by the path as given to watch()
+    std::map<std::string, WatchedFile> files;
+
+#ifdef __linux__
+    int inotifyFD;
+
+    // watch descriptor -> directory, and directory -> files watched in it
+    std::map<int, std::string> directories;
+    std::map<std::string, std::vector<std::string>> directoryFiles;
+#endif
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+// 64-bit FNV-1a style hash that consumes eight bytes per step. Used to key
+// on-disk caches by content, not for anything security related.
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0xCBF29CE484222325ull)
+{
+    const uint64_t prime = 0x100000001B3ull;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t h = seed ^ (size * prime);
+
+    size_t words = size / 8;
+    for (size_t i = 0; i < words; i++)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i * 8, 8);
+        h = (h ^ word) * prime;
+        h ^= h >> 29;
+    }
+    for (size_t i = words * 8; i < size; i++)
+        h = (h ^ bytes[i]) * prime;
+
+    // Final avalanche
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return h;
+}
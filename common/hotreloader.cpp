@@ -0,0 +1,25 @@
+#include "hotreloader.hpp"
+#include "assetpack.hpp"
+
+HotReloader::HotReloader(AssetLoader& loader)
+    : loader(loader)
+{
+}
+
+void HotReloader::track(const std::shared_ptr<AssetHandle>& asset)
+{
+    // Weak, so watching doesn't keep a dropped asset alive
+    std::weak_ptr<AssetHandle> weak = asset;
+    for (const std::string& path : asset->sources())
+    {
+        watcher.watch(path, [this, weak](const std::string& changed) {
+            // An edited source must not keep coming back from the pack
+            const AssetPack* pack = AssetPack::mounted();
+            if (pack)
+                pack->preferLoose(changed.c_str());
+            std::shared_ptr<AssetHandle> strong = weak.lock();
+            if (strong)
+                loader.reload(strong);
+        });
+    }
+}
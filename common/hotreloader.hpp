@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "assetloader.hpp"
+#include "filewatcher.hpp"
+
+// Reloads loader assets whenever one of their source files changes on disk
+class HotReloader
+{
+public:
+    explicit HotReloader(AssetLoader& loader);
+
+    // watch every source file of asset
+    void track(const std::shared_ptr<AssetHandle>& asset);
+
+    // run callback when path changes, for owners that key other state on it
+    void watch(const std::string& path, FileWatcher::Callback callback) { watcher.watch(path, callback); }
+
+    // call once a frame on the GL thread before AssetLoader::update()
+    void poll() { watcher.poll(); }
+
+private:
+    AssetLoader& loader;
+    FileWatcher watcher;
+};
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include <GL/glew.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.hpp"
+#include "image.hpp"
+#include "texturecache.hpp"
+#include "mappedfile.hpp"
+
+namespace
+{
+    // GL format for a channel count, 0 if there isn't one
+    GLenum pixelFormat(int channels)
+    {
+        switch (channels)
+        {
+        case 1: return GL_RED;
+        case 2: return GL_RG;
+        case 3: return GL_RGB;
+        case 4: return GL_RGBA;
+        default: return 0;
+        }
+    }
+
+    // GL format for a block format, 0 if there isn't one
+    GLenum compressedFormat(BlockFormat format)
+    {
+        switch (format)
+        {
+        case BlockBC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BlockBC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BlockBC4: return GL_COMPRESSED_RED_RGTC1;
+        case BlockBC5: return GL_COMPRESSED_RG_RGTC2;
+        default: return 0;
+        }
+    }
+
+    // RGTC is core since 3.0, S3TC is an extension every desktop driver has.
+    // Core profiles list extensions one at a time, which GLEW 1.13 doesn't.
+    bool supportsBlockFormat(BlockFormat format)
+    {
+        static const bool s3tc = []() {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint i = 0; i < count; i++)
+            {
+                const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+                if (name && strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+                    return true;
+            }
+            return false;
+        }();
+        return format == BlockBC4 || format == BlockBC5 || s3tc;
+    }
+
+    void setSampling(GLenum target = GL_TEXTURE_2D)
+    {
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    int textureChannels(const TextureView& texture)
+    {
+        return texture.format == BlockNone ? texture.channels : BlockCompressor::channelCount(texture.format);
+    }
+}
+
+bool Image::decode(const char* path, ImageData& out, bool flipVertically)
+{
+    MappedFile file;
+    if (!file.open(path) || file.size() > size_t(INT_MAX))
+    {
+        printf("Texture %s failed to load.\n", path);
+        return false;
+    }
+
+    // stb's flip flag is global unless set per thread; clear it for this
+    // thread and flip while copying out instead, which costs nothing extra
+    stbi_set_flip_vertically_on_load_thread(0);
+
+    int width, height, channels;
+    unsigned char* data = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(file.data()),
+                                                static_cast<int>(file.size()), &width, &height, &channels, 0);
+    if (data == NULL)
+    {
+        printf("Texture %s failed to load: %s\n", path, stbi_failure_reason());
+        return false;
+    }
+
+    out.width = width;
+    out.height = height;
+    out.channels = channels;
+    size_t rowBytes = size_t(width) * channels;
+    out.pixels.resize(rowBytes * height);
+    for (int y = 0; y < height; y++)
+    {
+        int source = flipVertically ? height - 1 - y : y;
+        memcpy(&out.pixels[size_t(y) * rowBytes], data + size_t(source) * rowBytes, rowBytes);
+    }
+    stbi_image_free(data);
+    return true;
+}
+
+unsigned int Image::upload(const ImageData& image, unsigned int texture)
+{
+    GLenum format = pixelFormat(image.channels);
+    if (format == 0)
+        return texture;
+
+    unsigned int textureID = texture;
+    if (textureID == 0)
+        glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+
+    // Rows of 1 and 3 channel images are not 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    setSampling();
+    return textureID;
+}
+
+unsigned int Image::upload(const TextureView& texture, unsigned int textureID)
+{
+    GLenum format = pixelFormat(textureChannels(texture));
+    if (format == 0 || texture.levelCount == 0)
+        return textureID;
+
+    if (textureID == 0)
+        glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+
+    // Every level is already built, so the driver doesn't generate any
+    for (int i = 0; i < texture.levelCount; i++)
+        uploadLevel(texture, textureID, i);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levelCount - 1);
+
+    setSampling();
+    return textureID;
+}
+
+void Image::uploadLevel(const TextureView& texture, unsigned int textureID, int level)
+{
+    GLenum format = pixelFormat(textureChannels(texture));
+    if (format == 0 || textureID == 0 || level < 0 || level >= texture.levelCount)
+        return;
+
+    // Blocks the driver can't sample are decoded here instead
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    const MipView& mip = texture.levels[level];
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (texture.format != BlockNone && supportsBlockFormat(texture.format))
+    {
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, compressedFormat(texture.format), mip.width, mip.height, 0,
+                               static_cast<GLsizei>(mip.size), mip.data);
+    }
+    else if (texture.format != BlockNone)
+    {
+        ImageData decoded;
+        BlockCompressor::decode(texture.format, mip.data, mip.width, mip.height, decoded);
+        glTexImage2D(GL_TEXTURE_2D, level, format, mip.width, mip.height, 0, format, GL_UNSIGNED_BYTE, decoded.pixels.data());
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, level, format, mip.width, mip.height, 0, format, GL_UNSIGNED_BYTE, mip.data);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void Image::dropLevel(unsigned int textureID, int level)
+{
+    // A zero sized image holds no storage
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+}
+
+unsigned int Image::createArray(const TextureView& texture, int layers)
+{
+    GLenum format = pixelFormat(textureChannels(texture));
+    if (format == 0 || texture.levelCount == 0 || layers <= 0)
+        return 0;
+
+    unsigned int arrayID;
+    glGenTextures(1, &arrayID);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, arrayID);
+
+    // Storage only, layers are filled in one at a time by uploadLayer
+    bool compressed = texture.format != BlockNone && supportsBlockFormat(texture.format);
+    for (int i = 0; i < texture.levelCount; i++)
+    {
+        const MipView& level = texture.levels[i];
+        if (compressed)
+        {
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, compressedFormat(texture.format), level.width, level.height,
+                                   layers, 0, static_cast<GLsizei>(level.size * layers), NULL);
+        }
+        else
+        {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, i, format, level.width, level.height, layers, 0, format,
+                         GL_UNSIGNED_BYTE, NULL);
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, texture.levelCount - 1);
+
+    setSampling(GL_TEXTURE_2D_ARRAY);
+    return arrayID;
+}
+
+void Image::uploadLayer(const TextureView& texture, unsigned int arrayID, int layer)
+{
+    GLenum format = pixelFormat(textureChannels(texture));
+    if (format == 0 || arrayID == 0)
+        return;
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, arrayID);
+    bool compressed = texture.format != BlockNone && supportsBlockFormat(texture.format);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < texture.levelCount; i++)
+    {
+        const MipView& level = texture.levels[i];
+        if (compressed)
+        {
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, level.width, level.height, 1,
+                                      compressedFormat(texture.format), static_cast<GLsizei>(level.size), level.data);
+        }
+        else if (texture.format != BlockNone)
+        {
+            ImageData decoded;
+            BlockCompressor::decode(texture.format, level.data, level.width, level.height, decoded);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, level.width, level.height, 1, format,
+                            GL_UNSIGNED_BYTE, decoded.pixels.data());
+        }
+        else
+        {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, level.width, level.height, 1, format,
+                            GL_UNSIGNED_BYTE, level.data);
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+bool Image::canSample(const TextureView& texture)
+{
+    return texture.format == BlockNone || supportsBlockFormat(texture.format);
+}
+
+unsigned int Image::createRegionTexture(const TextureView& texture, int width, int height)
+{
+    GLenum format = pixelFormat(textureChannels(texture));
+    if (format == 0 || !canSample(texture))
+        return 0;
+
+    unsigned int regionID;
+    glGenTextures(1, &regionID);
+    glBindTexture(GL_TEXTURE_2D, regionID);
+    if (texture.format != BlockNone)
+    {
+        glCompressedTexImage2D(GL_TEXTURE_2D, 0, compressedFormat(texture.format), width, height, 0,
+                               static_cast<GLsizei>(BlockCompressor::compressedSize(texture.format, width, height)), NULL);
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return regionID;
+}
+
+void Image::uploadRegion(const TextureView& texture, unsigned int regionID, int x, int y,
+                         int width, int height, const unsigned char* data, size_t size)
+{
+    glBindTexture(GL_TEXTURE_2D, regionID);
+    if (texture.format != BlockNone)
+    {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, compressedFormat(texture.format),
+                                  static_cast<GLsizei>(size), data);
+        return;
+    }
+    GLenum format = pixelFormat(texture.channels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, format, GL_UNSIGNED_BYTE, data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
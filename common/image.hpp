@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+// Decoded 8-bit image, rows bottom to top as OpenGL expects
+struct ImageData
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<unsigned char> pixels;
+
+    size_t bytes() const { return pixels.size(); }
+};
+
+struct TextureView;
+
+class Image
+{
+public:
+    // decode a PNG/JPEG/... file, safe to call from any number of threads at
+    // once; the flip is done here rather than through stb's shared flag
+    static bool decode(const char* path, ImageData& out, bool flipVertically = true);
+
+    // create a mipmapped, repeating 2D texture, or respecify texture when it
+    // is not 0; GL thread only, returns 0 on failure
+    static unsigned int upload(const ImageData& image, unsigned int texture = 0);
+
+    // the same from a prebuilt mip chain, e.g. a mapped .cgtex; block
+    // compressed levels upload as they are
+    static unsigned int upload(const TextureView& texture, unsigned int textureID = 0);
+
+    // respecify one level of a 2D texture from a prebuilt chain, or free
+    // one level's storage; levels below GL_TEXTURE_BASE_LEVEL can be freed
+    // and the texture still samples. GL thread only
+    static void uploadLevel(const TextureView& texture, unsigned int textureID, int level);
+    static void dropLevel(unsigned int textureID, int level);
+
+    // an empty mipmapped, repeating 2D array texture with room for layers
+    // textures shaped like texture; GL thread only, returns 0 on failure
+    static unsigned int createArray(const TextureView& texture, int layers);
+
+    // copy every level of texture into one layer of an array from
+    // createArray, which must have been made from the same shape
+    static void uploadLayer(const TextureView& texture, unsigned int arrayID, int layer);
+
+    // whether the driver samples texture's format as it is; GL thread only
+    static bool canSample(const TextureView& texture);
+
+    // an empty single level texture for rectangles in texture's format
+    // (which must be samplable), clamped and bilinear; GL thread only,
+    // returns 0 on failure
+    static unsigned int createRegionTexture(const TextureView& texture, int width, int height);
+
+    // copy a rectangle, given in texels, of pixels or blocks in texture's
+    // format into such a texture
+    static void uploadRegion(const TextureView& texture, unsigned int regionID, int x, int y,
+                             int width, int height, const unsigned char* data, size_t size);
+};
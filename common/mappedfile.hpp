@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&& other);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // map / unmap the file
+    bool open(const char* path);
+    void close();
+
+    // mapped bytes
+    const char* data() const { return mapData; }
+    size_t size() const { return mapSize; }
+    bool isOpen() const { return opened; }
+
+private:
+    const char* mapData;
+    size_t mapSize;
+    bool opened;
+
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#endif
+};
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "materiallibrary.hpp"
+#include "hotreloader.hpp"
+#include "resourcemanager.hpp"
+#include "mipgenerator.hpp"
+#include "blockcompressor.hpp"
+
+namespace
+{
+    const char* mapNames[MaterialMapCount] = { "colour", "normal", "specular" };
+
+    // White, straight up and not shiny
+    ImageData flatMap(int map)
+    {
+        static const unsigned char texels[MaterialMapCount][3] = { { 255, 255, 255 }, { 128, 128, 0 }, { 0, 0, 0 } };
+        static const int channels[MaterialMapCount] = { 3, 2, 1 };
+
+        ImageData image;
+        image.width = 1;
+        image.height = 1;
+        image.channels = channels[map];
+        image.pixels.assign(texels[map], texels[map] + channels[map]);
+        return image;
+    }
+
+    // Uncompressed view of levels built in memory
+    TextureView viewOf(const std::vector<ImageData>& levels)
+    {
+        TextureView texture;
+        texture.width = levels[0].width;
+        texture.height = levels[0].height;
+        texture.channels = levels[0].channels;
+        texture.levelCount = std::min(static_cast<int>(levels.size()), TextureView::maxLevels);
+        for (int i = 0; i < texture.levelCount; i++)
+        {
+            texture.levels[i].width = levels[i].width;
+            texture.levels[i].height = levels[i].height;
+            texture.levels[i].data = levels[i].pixels.data();
+            texture.levels[i].size = levels[i].bytes();
+        }
+        return texture;
+    }
+
+    // The same from block compressed levels
+    TextureView viewOf(const std::vector<CompressedImage>& levels)
+    {
+        TextureView texture;
+        texture.width = levels[0].width;
+        texture.height = levels[0].height;
+        texture.format = levels[0].format;
+        texture.channels = BlockCompressor::channelCount(texture.format);
+        texture.levelCount = std::min(static_cast<int>(levels.size()), TextureView::maxLevels);
+        for (int i = 0; i < texture.levelCount; i++)
+        {
+            texture.levels[i].width = levels[i].width;
+            texture.levels[i].height = levels[i].height;
+            texture.levels[i].data = levels[i].blocks.data();
+            texture.levels[i].size = levels[i].blocks.size();
+        }
+        return texture;
+    }
+
+    // Start the chain at the level whose larger side is size, false if it
+    // has none; chains no larger than size are kept whole
+    bool startAt(TextureView& texture, int size)
+    {
+        int first = 0;
+        while (first < texture.levelCount && std::max(texture.levels[first].width, texture.levels[first].height) > size)
+            first++;
+        if (first == 0)
+            return true;
+        if (first == texture.levelCount ||
+            std::max(texture.levels[first].width, texture.levels[first].height) != size)
+            return false;
+
+        texture.levelCount -= first;
+        for (int i = 0; i < texture.levelCount; i++)
+            texture.levels[i] = texture.levels[first + i];
+        texture.width = texture.levels[0].width;
+        texture.height = texture.levels[0].height;
+        return true;
+    }
+
+    bool sameShape(const TextureView& a, const TextureView& b)
+    {
+        return a.width == b.width && a.height == b.height && a.channels == b.channels &&
+               a.levelCount == b.levelCount && a.format == b.format;
+    }
+}
+
+MaterialHandle::MaterialHandle(MaterialLibrary& library, const std::string paths[MaterialMapCount])
+    : AssetHandle(paths[MaterialColour].c_str()), library(library)
+{
+    for (int i = 0; i < MaterialMapCount; i++)
+        this->paths[i] = paths[i];
+}
+
+std::vector<std::string> MaterialHandle::sources() const
+{
+    return std::vector<std::string>(paths, paths + MaterialMapCount);
+}
+
+bool MaterialHandle::load()
+{
+    int size = library.mapSize;
+    for (int i = 0; i < MaterialMapCount; i++)
+    {
+        files[i].close();
+        levels[i].clear();
+        blocks[i].clear();
+        maps[i] = TextureView();
+
+        // A cached chain that passes through the map size is used from there
+        ImageData image;
+        bool decoded = TextureCache::fetch(paths[i].c_str(), files[i], maps[i], image);
+        if (decoded && maps[i].levelCount > 0 && startAt(maps[i], size))
+            continue;
+
+        BlockFormat cachedFormat = maps[i].format;
+        if (decoded && maps[i].levelCount > 0)
+        {
+            files[i].close();
+            maps[i] = TextureView();
+            decoded = Image::decode(paths[i].c_str(), image);
+        }
+        if (!decoded)
+        {
+            printf("Using a flat %s map in place of %s\n", mapNames[i], paths[i].c_str());
+            levels[i].push_back(flatMap(i));
+            maps[i] = viewOf(levels[i]);
+            continue;
+        }
+
+        // Resize and mipmap here, when the cache is too big or couldn't be
+        // written, then compress as the cache would so the page still fits
+        MipOptions options;
+        options.content = MipGenerator::contentFor(paths[i].c_str());
+        options.threads = 1;
+        int larger = std::max(image.width, image.height);
+        if (larger > size)
+        {
+            ImageData resized;
+            MipGenerator::resize(image, std::max(1, image.width * size / larger),
+                                 std::max(1, image.height * size / larger), resized, options.content);
+            image = std::move(resized);
+        }
+        MipGenerator::build(image, levels[i], options);
+        if (cachedFormat == BlockNone)
+        {
+            maps[i] = viewOf(levels[i]);
+            continue;
+        }
+
+        BlockFormat format = BlockCompressor::formatFor(image, options.content);
+        blocks[i].resize(levels[i].size());
+        for (size_t j = 0; j < levels[i].size(); j++)
+            BlockCompressor::encode(levels[i][j], format, BlockFast, blocks[i][j], 1);
+        levels[i].clear();
+        maps[i] = viewOf(blocks[i]);
+    }
+    return true;
+}
+
+bool MaterialHandle::upload()
+{
+    bool placed = library.place(maps, page, layer);
+    if (placed)
+    {
+        layerBytes = 0;
+        for (int i = 0; i < MaterialMapCount; i++)
+            layerBytes += maps[i].bytes();
+    }
+    else
+    {
+        printf("Could not make room for material %s\n", path().c_str());
+    }
+
+    for (int i = 0; i < MaterialMapCount; i++)
+    {
+        maps[i] = TextureView();
+        files[i].close();
+        levels[i].clear();
+        blocks[i].clear();
+    }
+    return placed;
+}
+
+size_t MaterialHandle::uploadBytes() const
+{
+    size_t bytes = 0;
+    for (int i = 0; i < MaterialMapCount; i++)
+        bytes += maps[i].bytes();
+    return bytes;
+}
+
+void MaterialHandle::release()
+{
+    library.freeLayer(page, layer);
+    page = -1;
+    layer = -1;
+    layerBytes = 0;
+}
+
+MaterialLibrary::MaterialLibrary(AssetLoader& loader, HotReloader* reloader, int layersPerPage, int mapSize)
+    : loader(loader), reloader(reloader), layersPerPage(std::max(layersPerPage, 1)), mapSize(std::max(mapSize, 1))
+{
+}
+
+std::shared_ptr<MaterialHandle> MaterialLibrary::material(const char* colourPath, const char* normalPath,
+                                                          const char* specularPath)
+{
+    std::string paths[MaterialMapCount] = { colourPath, normalPath, specularPath };
+    std::string key;
+    for (int i = 0; i < MaterialMapCount; i++)
+        key += ResourceManager::canonicalPath(paths[i].c_str()) + "|";
+    std::unordered_map<std::string, std::shared_ptr<MaterialHandle>>::iterator entry = materials.find(key);
+    if (entry != materials.end())
+        return entry->second;
+
+    std::shared_ptr<MaterialHandle> handle = std::make_shared<MaterialHandle>(*this, paths);
+    loader.load(handle);
+    if (reloader)
+        reloader->track(handle);
+    materials[key] = handle;
+    return handle;
+}
+
+size_t MaterialLibrary::gpuBytes() const
+{
+    size_t bytes = 0;
+    for (const Page& page : pages)
+        bytes += page.bytes;
+    return bytes;
+}
+
+void MaterialLibrary::release()
+{
+    for (Page& page : pages)
+        glDeleteTextures(MaterialMapCount, page.arrays);
+    pages.clear();
+    boundPage = -1;
+}
+
+bool MaterialLibrary::place(const TextureView maps[MaterialMapCount], int& page, int& layer)
+{
+    // A reload that keeps the shapes overwrites its own layer
+    if (page >= 0)
+    {
+        bool fits = true;
+        for (int i = 0; i < MaterialMapCount; i++)
+            fits = fits && sameShape(pages[page].shapes[i], maps[i]);
+        if (!fits)
+        {
+            freeLayer(page, layer);
+            page = -1;
+            layer = -1;
+        }
+    }
+
+    // Otherwise the first free layer of a page with the same shapes
+    for (int p = 0; page < 0 && p < static_cast<int>(pages.size()); p++)
+    {
+        bool fits = true;
+        for (int i = 0; i < MaterialMapCount; i++)
+            fits = fits && sameShape(pages[p].shapes[i], maps[i]);
+        std::vector<bool>::iterator unused = std::find(pages[p].used.begin(), pages[p].used.end(), false);
+        if (fits && unused != pages[p].used.end())
+        {
+            page = p;
+            layer = static_cast<int>(unused - pages[p].used.begin());
+        }
+    }
+
+    // Or a new page, with room for every material still waiting rather
+    // than empty layers allocated up front
+    if (page < 0)
+    {
+        int layers = 0;
+        for (const std::pair<const std::string, std::shared_ptr<MaterialHandle>>& material : materials)
+        {
+            if (material.second->page < 0 && !material.second->hasFailed())
+                layers++;
+        }
+        layers = std::min(std::max(layers, 1), layersPerPage);
+
+        Page added;
+        for (int i = 0; i < MaterialMapCount; i++)
+        {
+            added.arrays[i] = Image::createArray(maps[i], layers);
+            if (added.arrays[i] == 0)
+            {
+                glDeleteTextures(MaterialMapCount, added.arrays);
+                boundPage = -1;
+                return false;
+            }
+
+            // Keep the shape without pointing into the maps
+            added.shapes[i] = maps[i];
+            for (int j = 0; j < maps[i].levelCount; j++)
+                added.shapes[i].levels[j].data = nullptr;
+            added.bytes += maps[i].bytes() * layers;
+        }
+        added.used.assign(layers, false);
+        pages.push_back(added);
+        page = static_cast<int>(pages.size()) - 1;
+        layer = 0;
+    }
+
+    pages[page].used[layer] = true;
+    for (int i = 0; i < MaterialMapCount; i++)
+        Image::uploadLayer(maps[i], pages[page].arrays[i], layer);
+
+    // Uploading rebinds arrays on the active unit
+    boundPage = -1;
+    return true;
+}
+
+void MaterialLibrary::freeLayer(int page, int layer)
+{
+    if (page >= 0 && page < static_cast<int>(pages.size()) && layer >= 0)
+        pages[page].used[layer] = false;
+}
+
+void MaterialBatch::add(const MaterialHandle& material, const glm::mat4& model)
+{
+    if (!material.isReady() || material.page < 0)
+        return;
+    Instance instance;
+    instance.model = model;
+    instance.layer = static_cast<float>(material.layer);
+    instance.page = material.page;
+    instances.push_back(instance);
+}
+
+size_t MaterialBatch::draw(MaterialLibrary& library, GLsizei indexCount, GLenum indexType)
+{
+    if (instances.empty())
+        return 0;
+
+    // Group by page, the order within a page doesn't matter
+    std::sort(instances.begin(), instances.end(),
+              [](const Instance& a, const Instance& b) { return a.page < b.page; });
+
+    // Orphan last frame's data rather than wait for the GPU to finish with it
+    if (buffer == 0)
+        glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(Instance), instances.data());
+
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        glEnableVertexAttribArray(instanceModelAttribute + i);
+        glVertexAttribDivisor(instanceModelAttribute + i, 1);
+    }
+    glEnableVertexAttribArray(materialLayerAttribute);
+    glVertexAttribDivisor(materialLayerAttribute, 1);
+
+    // One draw per page; without base instance support each run gets its
+    // own attribute offsets instead
+    size_t draws = 0;
+    for (size_t first = 0; first < instances.size();)
+    {
+        size_t last = first;
+        while (last < instances.size() && instances[last].page == instances[first].page)
+            last++;
+
+        size_t offset = first * sizeof(Instance);
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            glVertexAttribPointer(instanceModelAttribute + i, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                  (void*)(offset + i * sizeof(glm::vec4)));
+        }
+        glVertexAttribPointer(materialLayerAttribute, 1, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                              (void*)(offset + sizeof(glm::mat4)));
+
+        library.bind(instances[first].page);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, indexType, 0, static_cast<GLsizei>(last - first));
+        draws++;
+        first = last;
+    }
+    return draws;
+}
+
+void MaterialBatch::release()
+{
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
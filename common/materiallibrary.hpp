@@ -0,0 +1,190 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stddef.h>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "assetloader.hpp"
+
+class HotReloader;
+class MaterialLibrary;
+
+enum MaterialMap
+{
+    MaterialColour,     // sampled as textureMap on unit 0
+    MaterialNormal,     // normalMap on unit 1
+    MaterialSpecular,   // specularMap on unit 2
+    MaterialMapCount
+};
+
+// Vertex attributes the material shaders read: a per-instance model matrix
+// (four columns from instanceModelAttribute) and the material's array layer
+static const unsigned int instanceModelAttribute = 5;
+static const unsigned int materialLayerAttribute = 9;
+
+// A colour, normal and specular map living in one layer of a library page.
+// Maps that fail to load are replaced by a flat 1x1 default.
+class MaterialHandle : public AssetHandle
+{
+public:
+    // -1 until ready; a reload that changes a map's shape can move it
+    int page = -1;
+    int layer = -1;
+
+    MaterialHandle(MaterialLibrary& library, const std::string paths[MaterialMapCount]);
+
+    std::vector<std::string> sources() const override;
+
+    // GL thread: bind the page and set the layer for a plain, non-instanced
+    // draw; skipped while the page is already bound
+    void bind() const;
+
+    size_t gpuBytes() const override { return layerBytes; }
+    void release() override;
+
+protected:
+    bool load() override;
+    bool upload() override;
+    size_t uploadBytes() const override;
+
+private:
+    MaterialLibrary& library;
+    std::string paths[MaterialMapCount];
+    size_t layerBytes = 0;
+
+    // each map is a mapped .cgtex, or levels built here when there is none
+    // or it had to be resized
+    MappedFile files[MaterialMapCount];
+    std::vector<ImageData> levels[MaterialMapCount];
+    std::vector<CompressedImage> blocks[MaterialMapCount];
+    TextureView maps[MaterialMapCount];
+};
+
+// Packs material maps into GL_TEXTURE_2D_ARRAY layers. Materials whose maps
+// have the same sizes and formats share a page (one array per map), so
+// drawing any of them needs only the page bound and a layer index per
+// object; switching material within a page changes no GL state at all.
+// Maps larger than mapSize are brought down to it on the workers, so
+// materials from differently sized images still share.
+class MaterialLibrary
+{
+public:
+    // a new page has a layer for each material still waiting for one, up to
+    // layersPerPage, so materials requested together fill a single page;
+    // more pages are added as they fill
+    explicit MaterialLibrary(AssetLoader& loader, HotReloader* reloader = nullptr, int layersPerPage = 8,
+                             int mapSize = 1024);
+
+    MaterialLibrary(const MaterialLibrary&) = delete;
+    MaterialLibrary& operator=(const MaterialLibrary&) = delete;
+
+    // start loading a material, or return the one already made from the
+    // maps, however their paths are spelled
+    std::shared_ptr<MaterialHandle> material(const char* colourPath, const char* normalPath,
+                                             const char* specularPath);
+
+    // GL thread: bind a page's arrays to units 0 to 2, nothing if it is bound
+    void bind(int page);
+
+    size_t pageCount() const { return pages.size(); }
+    size_t materialCount() const { return materials.size(); }
+
+    // GL memory of every page
+    size_t gpuBytes() const;
+
+    // GL thread: delete every page
+    void release();
+
+private:
+    friend class MaterialHandle;
+
+    struct Page
+    {
+        TextureView shapes[MaterialMapCount];   // sizes and formats, no data
+        unsigned int arrays[MaterialMapCount] = {};
+        std::vector<bool> used;
+        size_t bytes = 0;
+    };
+
+    AssetLoader& loader;
+    HotReloader* reloader;
+    int layersPerPage;
+    int mapSize;
+    std::vector<Page> pages;
+    int boundPage = -1;
+    std::unordered_map<std::string, std::shared_ptr<MaterialHandle>> materials;
+
+    // GL thread: copy maps into a free layer of a page shaped like them,
+    // making the page if there is none; keeps page and layer if they fit
+    bool place(const TextureView maps[MaterialMapCount], int& page, int& layer);
+    void freeLayer(int page, int layer);
+};
+
+// Inline so models can draw with a material without linking the loader
+
+inline void MaterialLibrary::bind(int page)
+{
+    if (page == boundPage || page < 0 || page >= static_cast<int>(pages.size()))
+        return;
+    for (int i = 0; i < MaterialMapCount; i++)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, pages[page].arrays[i]);
+    }
+    boundPage = page;
+}
+
+inline void MaterialHandle::bind() const
+{
+    if (page < 0)
+        return;
+    library.bind(page);
+
+    // Attributes without an array read these values, so a single draw sees
+    // an identity instance transform and this material's layer
+    glVertexAttrib4f(instanceModelAttribute + 0, 1.0f, 0.0f, 0.0f, 0.0f);
+    glVertexAttrib4f(instanceModelAttribute + 1, 0.0f, 1.0f, 0.0f, 0.0f);
+    glVertexAttrib4f(instanceModelAttribute + 2, 0.0f, 0.0f, 1.0f, 0.0f);
+    glVertexAttrib4f(instanceModelAttribute + 3, 0.0f, 0.0f, 0.0f, 1.0f);
+    glVertexAttrib1f(materialLayerAttribute, static_cast<float>(layer));
+}
+
+// Model matrices and layers of the objects sharing one mesh, drawn with one
+// instanced call per material page
+class MaterialBatch
+{
+public:
+    MaterialBatch() {}
+
+    MaterialBatch(const MaterialBatch&) = delete;
+    MaterialBatch& operator=(const MaterialBatch&) = delete;
+
+    void clear() { instances.clear(); }
+
+    // queue an object, skipped while its material isn't ready
+    void add(const MaterialHandle& material, const glm::mat4& model);
+
+    // GL thread: draw the queued objects with the VAO the caller has bound,
+    // whose instance attributes are pointed at the batch's buffer from then
+    // on. Returns the number of draw calls.
+    size_t draw(MaterialLibrary& library, GLsizei indexCount, GLenum indexType);
+
+    // GL thread: delete the instance buffer
+    void release();
+
+private:
+    struct Instance
+    {
+        glm::mat4 model;
+        float layer;
+        int page;
+    };
+
+    std::vector<Instance> instances;
+    unsigned int buffer = 0;
+};
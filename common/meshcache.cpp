@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "meshcache.hpp"
+#include "mappedfile.hpp"
+#include "hash.hpp"
+#include "cachefile.hpp"
+#include "assetpack.hpp"
+
+namespace
+{
+    enum MeshStream
+    {
+        StreamPositions,
+        StreamUVs,
+        StreamNormals,
+        StreamTangents,
+        StreamIndices,
+        StreamLods,
+        StreamMeshlets,
+        StreamCompact,
+        StreamCount
+    };
+
+    struct MeshCacheStream
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // File header, the streams follow at 16-byte aligned offsets
+    struct MeshCacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        CacheFile::SourceKey source;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t indexSize;
+        uint32_t lodLevels;     // levels asked for, the chain may stop short
+        uint32_t compact;       // 1 for CompactVertex streams, 0 for float streams
+        float boundsMin[3];
+        float boundsMax[3];
+        float positionScale[3];
+        float positionOffset[3];
+        MeshCacheStream streams[StreamCount];
+    };
+
+    const char cacheMagic[4] = { 'C', 'G', 'M', 'S' };
+
+    // Stream sizes must match the counts in the header
+    bool checkStream(const MeshCacheStream& stream, uint64_t expected, uint64_t fileSize, bool optional)
+    {
+        if (stream.offset > fileSize || stream.size > fileSize - stream.offset)
+            return false;
+        if (optional && stream.size == 0)
+            return true;
+        return stream.size == expected;
+    }
+
+    // Every level of detail or meshlet must lie inside the index stream
+    template <typename T>
+    bool checkRanges(const char* data, const MeshCacheStream& stream, uint32_t indexCount)
+    {
+        if (stream.size % sizeof(T) != 0)
+            return false;
+        size_t count = stream.size / sizeof(T);
+        for (size_t i = 0; i < count; i++)
+        {
+            T range;
+            memcpy(&range, data + stream.offset + i * sizeof(T), sizeof(T));
+            if (range.indexOffset > indexCount || range.indexCount > indexCount - range.indexOffset)
+                return false;
+        }
+        return true;
+    }
+
+    // And every level's meshlets inside the meshlet stream
+    bool checkLodMeshlets(const char* data, const MeshCacheStream& stream, size_t meshletCount)
+    {
+        size_t count = stream.size / sizeof(MeshLod);
+        for (size_t i = 0; i < count; i++)
+        {
+            MeshLod lod;
+            memcpy(&lod, data + stream.offset + i * sizeof(MeshLod), sizeof(MeshLod));
+            if (lod.meshletOffset > meshletCount || lod.meshletCount > meshletCount - lod.meshletOffset)
+                return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    const T* streamPointer(const char* data, const MeshCacheStream& stream)
+    {
+        return stream.size ? reinterpret_cast<const T*>(data + stream.offset) : nullptr;
+    }
+}
+
+std::string MeshCache::cachePath(const char* sourcePath)
+{
+    return std::string(sourcePath) + ".cgmesh";
+}
+
+bool MeshCache::write(const char* sourcePath, const MeshView& mesh, uint32_t lodLevels)
+{
+    CacheFile::SourceKey key;
+    if (!CacheFile::sourceKey(sourcePath, key, true))
+        return false;
+
+    uint64_t indexSize = mesh.shortIndices ? sizeof(unsigned short) : sizeof(unsigned int);
+    uint64_t vec3Bytes = mesh.vertexCount * sizeof(glm::vec3);
+
+    // Stream table
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = version;
+    header.source = key;
+    header.vertexCount = static_cast<uint32_t>(mesh.vertexCount);
+    header.indexCount = static_cast<uint32_t>(mesh.indexCount);
+    header.indexSize = static_cast<uint32_t>(indexSize);
+    header.lodLevels = lodLevels;
+    header.compact = mesh.compact ? 1 : 0;
+    for (int i = 0; i < 3; i++)
+    {
+        header.boundsMin[i] = mesh.boundsMin[i];
+        header.boundsMax[i] = mesh.boundsMax[i];
+        header.positionScale[i] = mesh.positionScale[i];
+        header.positionOffset[i] = mesh.positionOffset[i];
+    }
+
+    // A compact mesh stores only its compact vertices
+    bool floats = !mesh.compact;
+    const void* data[StreamCount] = {
+        mesh.positions, mesh.uvs, mesh.normals, mesh.tangents, mesh.indices, mesh.lods, mesh.meshlets,
+        mesh.compact
+    };
+    uint64_t sizes[StreamCount] = {
+        floats ? vec3Bytes : 0,
+        floats ? mesh.vertexCount * sizeof(glm::vec2) : 0,
+        floats ? vec3Bytes : 0,
+        floats && mesh.tangents ? mesh.vertexCount * sizeof(glm::vec4) : 0,
+        mesh.indexCount * indexSize,
+        mesh.lods ? mesh.lodCount * sizeof(MeshLod) : 0,
+        mesh.meshlets ? mesh.meshletCount * sizeof(Meshlet) : 0,
+        mesh.compact ? mesh.vertexCount * sizeof(CompactVertex) : 0
+    };
+
+    uint64_t offset = CacheFile::alignUp(sizeof(MeshCacheHeader));
+    for (int i = 0; i < StreamCount; i++)
+    {
+        header.streams[i].offset = offset;
+        header.streams[i].size = sizes[i];
+        offset = CacheFile::alignUp(offset + sizes[i]);
+    }
+
+    // Write to a temporary file first so readers never see a partial cache
+    std::string path = cachePath(sourcePath);
+    std::string temporaryPath = CacheFile::temporaryPath(path);
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (file == NULL)
+    {
+        printf("Could not write mesh cache %s\n", path.c_str());
+        return false;
+    }
+
+    offset = 0;
+    bool ok = CacheFile::writePadded(file, &header, sizeof(header), offset);
+    for (int i = 0; ok && i < StreamCount; i++)
+        ok = CacheFile::writePadded(file, data[i], sizes[i], offset);
+    ok = fclose(file) == 0 && ok;
+
+    if (!CacheFile::commit(temporaryPath, path, ok))
+    {
+        printf("Could not write mesh cache %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool MeshCache::load(const char* sourcePath, MappedFile& file, MeshView& mesh, uint32_t lodLevels, bool compact)
+{
+    // A mounted pack is the shipped build, its blobs are trusted as is
+    // when they were built with the same options
+    PackBlob blob;
+    const AssetPack* pack = AssetPack::mounted();
+    if (pack && pack->find(sourcePath, blob) && parse(blob.data, blob.size, mesh, lodLevels, compact))
+    {
+        file.close();
+        return true;
+    }
+
+    std::string path = cachePath(sourcePath);
+    if (!file.open(path.c_str()))
+        return false;
+
+    // Header checks
+    MeshCacheHeader header;
+    if (file.size() < sizeof(header))
+    {
+        file.close();
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != version ||
+        header.lodLevels != lodLevels || header.compact != (compact ? 1u : 0u))
+    {
+        file.close();
+        return false;
+    }
+
+    if (!CacheFile::matchesSource(sourcePath, header.source, path, offsetof(MeshCacheHeader, source)))
+    {
+        file.close();
+        return false;
+    }
+
+    if (!parse(file.data(), file.size(), mesh, lodLevels, compact))
+    {
+        printf("Mesh cache %s is corrupt, rebuilding\n", path.c_str());
+        file.close();
+        return false;
+    }
+    return true;
+}
+
+bool MeshCache::parse(const char* data, size_t size, MeshView& mesh, uint32_t lodLevels, bool compact)
+{
+    MeshCacheHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != version ||
+        header.lodLevels != lodLevels || header.compact != (compact ? 1u : 0u))
+        return false;
+
+    // Either the float streams or the compact vertices, never both
+    uint64_t vertices = compact ? 0 : header.vertexCount;
+    uint64_t vec3Bytes = vertices * sizeof(glm::vec3);
+    const MeshCacheStream* streams = header.streams;
+    if ((header.indexSize != sizeof(unsigned short) && header.indexSize != sizeof(unsigned int)) ||
+        !checkStream(streams[StreamPositions], vec3Bytes, size, false) ||
+        !checkStream(streams[StreamUVs], vertices * sizeof(glm::vec2), size, false) ||
+        !checkStream(streams[StreamNormals], vec3Bytes, size, false) ||
+        !checkStream(streams[StreamTangents], vertices * sizeof(glm::vec4), size, true) ||
+        !checkStream(streams[StreamCompact], compact ? uint64_t(header.vertexCount) * sizeof(CompactVertex) : 0,
+                     size, false) ||
+        !checkStream(streams[StreamIndices], uint64_t(header.indexCount) * header.indexSize, size, false) ||
+        !checkStream(streams[StreamLods], streams[StreamLods].size, size, true) ||
+        !checkStream(streams[StreamMeshlets], streams[StreamMeshlets].size, size, true) ||
+        !checkRanges<MeshLod>(data, streams[StreamLods], header.indexCount) ||
+        !checkRanges<Meshlet>(data, streams[StreamMeshlets], header.indexCount) ||
+        !checkLodMeshlets(data, streams[StreamLods], streams[StreamMeshlets].size / sizeof(Meshlet)))
+        return false;
+
+    // Point straight into the data
+    mesh.positions = streamPointer<glm::vec3>(data, streams[StreamPositions]);
+    mesh.uvs = streamPointer<glm::vec2>(data, streams[StreamUVs]);
+    mesh.normals = streamPointer<glm::vec3>(data, streams[StreamNormals]);
+    mesh.tangents = streamPointer<glm::vec4>(data, streams[StreamTangents]);
+    mesh.indices = streams[StreamIndices].size ? data + streams[StreamIndices].offset : nullptr;
+    mesh.lods = streamPointer<MeshLod>(data, streams[StreamLods]);
+    mesh.meshlets = streamPointer<Meshlet>(data, streams[StreamMeshlets]);
+    mesh.compact = streamPointer<CompactVertex>(data, streams[StreamCompact]);
+    mesh.vertexCount = header.vertexCount;
+    mesh.indexCount = header.indexCount;
+    mesh.lodCount = streams[StreamLods].size / sizeof(MeshLod);
+    mesh.meshletCount = streams[StreamMeshlets].size / sizeof(Meshlet);
+    mesh.shortIndices = header.indexSize == sizeof(unsigned short);
+    mesh.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    mesh.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    mesh.positionScale = glm::vec3(header.positionScale[0], header.positionScale[1], header.positionScale[2]);
+    mesh.positionOffset = glm::vec3(header.positionOffset[0], header.positionOffset[1], header.positionOffset[2]);
+    return true;
+}
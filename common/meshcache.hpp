@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <glm/glm.hpp>
+
+#include "meshsimplifier.hpp"
+#include "meshlets.hpp"
+#include "vertexquantiser.hpp"
+
+class MappedFile;
+
+// Streams Model uploads, pointing either into vectors or a mapped cache.
+// A compact mesh has only the compact vertices, the others have only the
+// float streams.
+struct MeshView
+{
+    const glm::vec3* positions = nullptr;
+    const glm::vec2* uvs = nullptr;
+    const glm::vec3* normals = nullptr;
+    const glm::vec4* tangents = nullptr;     // bitangent sign in w, may be null
+    const CompactVertex* compact = nullptr;  // positions decode as positionOffset + positionScale * stored
+    const void* indices = nullptr;           // 16-bit when shortIndices is set
+    const MeshLod* lods = nullptr;           // ranges of indices and meshlets, may be null
+    const Meshlet* meshlets = nullptr;       // clusters of every level in turn, may be null
+    size_t vertexCount = 0;
+    size_t indexCount = 0;                   // every level of detail together
+    size_t lodCount = 0;
+    size_t meshletCount = 0;
+    bool shortIndices = false;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+};
+
+// Versioned binary .cgmesh files stored next to the source .obj
+class MeshCache
+{
+public:
+    static const uint32_t version = 8;
+
+    // path of the cache for an .obj file
+    static std::string cachePath(const char* sourcePath);
+
+    // write the final streams, replacing any older cache atomically;
+    // lodLevels is the ModelOptions::lodLevels the chain was built with,
+    // and mesh is compact exactly when ModelOptions::compactVertices was set
+    static bool write(const char* sourcePath, const MeshView& mesh, uint32_t lodLevels);
+
+    // point mesh into the mounted pack's copy, otherwise map the cache;
+    // fails if missing, stale or built for another lodLevels or layout
+    static bool load(const char* sourcePath, MappedFile& file, MeshView& mesh, uint32_t lodLevels, bool compact);
+
+    // point mesh into a whole cache file already in memory, checking it
+    // was built with lodLevels and the compact layout or not
+    static bool parse(const char* data, size_t size, MeshView& mesh, uint32_t lodLevels, bool compact);
+};
@@ -0,0 +1,93 @@
+#include "meshindexer.hpp"
+#include "objparser.hpp"
+
+namespace
+{
+    const unsigned int emptySlot = 0xFFFFFFFFu;
+
+    inline unsigned int hashCorner(unsigned int v, unsigned int vt, unsigned int vn)
+    {
+        // Multiplicative mix of the three attribute indices
+        unsigned int h = v * 0x9E3779B1u;
+        h ^= vt * 0x85EBCA77u + (h << 6) + (h >> 2);
+        h ^= vn * 0xC2B2AE3Du + (h << 6) + (h >> 2);
+        return h ^ (h >> 15);
+    }
+}
+
+IndexStats MeshIndexer::build(const ObjData& obj,
+                              std::vector<glm::vec3>& outVertices,
+                              std::vector<glm::vec2>& outUVs,
+                              std::vector<glm::vec3>& outNormals,
+                              std::vector<unsigned int>& outIndices,
+                              size_t vertexStride)
+{
+    size_t corners = obj.vertexIndices.size();
+
+    // Power of two table at most half full, each slot holds an output vertex
+    size_t tableSize = 16;
+    while (tableSize < corners * 2)
+        tableSize *= 2;
+    size_t mask = tableSize - 1;
+    std::vector<unsigned int> table(tableSize, emptySlot);
+
+    // Remember which corner first produced each vertex to compare keys
+    std::vector<unsigned int> firstCorner;
+    firstCorner.reserve(corners);
+
+    outIndices.resize(corners);
+    for (size_t i = 0; i < corners; i++)
+    {
+        unsigned int v = obj.vertexIndices[i];
+        unsigned int vt = obj.uvIndices[i];
+        unsigned int vn = obj.normalIndices[i];
+
+        // Linear probing until the triple or an empty slot is found
+        size_t slot = hashCorner(v, vt, vn) & mask;
+        while (true)
+        {
+            unsigned int vertex = table[slot];
+            if (vertex == emptySlot)
+            {
+                vertex = static_cast<unsigned int>(firstCorner.size());
+                firstCorner.push_back(static_cast<unsigned int>(i));
+                table[slot] = vertex;
+                outIndices[i] = vertex;
+                break;
+            }
+
+            unsigned int j = firstCorner[vertex];
+            if (obj.vertexIndices[j] == v && obj.uvIndices[j] == vt && obj.normalIndices[j] == vn)
+            {
+                outIndices[i] = vertex;
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    // Gather the attributes of every distinct vertex
+    size_t vertexCount = firstCorner.size();
+    outVertices.resize(vertexCount);
+    outUVs.resize(vertexCount);
+    outNormals.resize(vertexCount);
+    for (size_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        unsigned int j = firstCorner[vertex];
+        unsigned int uvIndex = obj.uvIndices[j];
+        unsigned int normalIndex = obj.normalIndices[j];
+
+        // Corners without a uv or normal get zeros
+        outVertices[vertex] = obj.positions[obj.vertexIndices[j]];
+        outUVs[vertex] = uvIndex != ObjData::missing ? obj.uvs[uvIndex] : glm::vec2(0.0f);
+        outNormals[vertex] = normalIndex != ObjData::missing ? obj.normals[normalIndex] : glm::vec3(0.0f);
+    }
+
+    IndexStats stats;
+    stats.corners = corners;
+    stats.uniqueVertices = vertexCount;
+    stats.bytesBefore = corners * vertexStride;
+    stats.bytesAfter = vertexCount * vertexStride +
+                       corners * (fitsShortIndices(vertexCount) ? sizeof(unsigned short) : sizeof(unsigned int));
+    return stats;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+#include <glm/glm.hpp>
+
+struct ObjData;
+
+// Outcome of welding an .obj file into an indexed mesh
+struct IndexStats
+{
+    size_t corners = 0;          // triangle corners in the file
+    size_t uniqueVertices = 0;   // distinct (v, vt, vn) triples
+    size_t bytesBefore = 0;      // vertex memory with one vertex per corner
+    size_t bytesAfter = 0;       // vertex + index memory once indexed
+
+    float uniqueRatio() const { return corners ? static_cast<float>(uniqueVertices) / corners : 1.0f; }
+};
+
+class MeshIndexer
+{
+public:
+    // Welds identical (v, vt, vn) corners through an open-addressing hash
+    // table and writes one vertex per distinct triple plus an index buffer.
+    // vertexStride is the uploaded size of one vertex, used for the stats.
+    static IndexStats build(const ObjData& obj,
+                            std::vector<glm::vec3>& outVertices,
+                            std::vector<glm::vec2>& outUVs,
+                            std::vector<glm::vec3>& outNormals,
+                            std::vector<unsigned int>& outIndices,
+                            size_t vertexStride);
+
+    // 16-bit indices are enough below this many vertices
+    static bool fitsShortIndices(size_t vertexCount) { return vertexCount < 65536; }
+};
@@ -0,0 +1,164 @@
+#include <math.h>
+#include <algorithm>
+
+#include "meshlets.hpp"
+
+namespace
+{
+    // Bounds and normal cone of one finished meshlet
+    Meshlet finishMeshlet(const std::vector<unsigned int>& indices, size_t begin, size_t end,
+                          const glm::vec3* positions, uint32_t vertexCount)
+    {
+        Meshlet meshlet;
+        meshlet.indexOffset = static_cast<uint32_t>(begin);
+        meshlet.indexCount = static_cast<uint32_t>(end - begin);
+        meshlet.vertexCount = vertexCount;
+        meshlet.padding = 0;
+
+        // Sphere around the box centre
+        glm::vec3 low = positions[indices[begin]];
+        glm::vec3 high = low;
+        for (size_t i = begin; i < end; i++)
+        {
+            low = glm::min(low, positions[indices[i]]);
+            high = glm::max(high, positions[indices[i]]);
+        }
+        meshlet.centre = (low + high) * 0.5f;
+        float radiusSquared = 0.0f;
+        for (size_t i = begin; i < end; i++)
+        {
+            glm::vec3 d = positions[indices[i]] - meshlet.centre;
+            radiusSquared = std::max(radiusSquared, glm::dot(d, d));
+        }
+        meshlet.radius = sqrtf(radiusSquared);
+
+        // Cone around the mean face normal
+        std::vector<glm::vec3> faceNormals;
+        faceNormals.reserve((end - begin) / 3);
+        glm::vec3 sum(0.0f);
+        for (size_t i = begin; i < end; i += 3)
+        {
+            const glm::vec3& p0 = positions[indices[i]];
+            glm::vec3 normal = glm::cross(positions[indices[i + 1]] - p0, positions[indices[i + 2]] - p0);
+            float length = glm::length(normal);
+            if (length == 0.0f)
+                continue;
+            faceNormals.push_back(normal / length);
+            sum += faceNormals.back();
+        }
+
+        float sumLength = glm::length(sum);
+        meshlet.coneAxis = sumLength > 0.0f ? sum / sumLength : glm::vec3(0.0f, 0.0f, 1.0f);
+        meshlet.coneCutoff = 1.0f;
+        if (sumLength > 0.0f)
+        {
+            float minDot = 1.0f;
+            for (const glm::vec3& normal : faceNormals)
+                minDot = std::min(minDot, glm::dot(normal, meshlet.coneAxis));
+
+            // Normals spread over a half space or more can always face the eye
+            if (minDot > 0.0f)
+                meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+        }
+        return meshlet;
+    }
+}
+
+Frustum Frustum::fromMatrix(const glm::mat4& matrix)
+{
+    // Gribb-Hartmann, rows of the matrix combined per clip plane
+    glm::vec4 row0(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]);
+    glm::vec4 row1(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]);
+    glm::vec4 row2(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2]);
+    glm::vec4 row3(matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0;
+    frustum.planes[1] = row3 - row0;
+    frustum.planes[2] = row3 + row1;
+    frustum.planes[3] = row3 - row1;
+    frustum.planes[4] = row3 + row2;
+    frustum.planes[5] = row3 - row2;
+    for (glm::vec4& plane : frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+    return frustum;
+}
+
+void MeshletBuilder::build(const std::vector<unsigned int>& indices, size_t indexOffset, size_t indexCount,
+                           const glm::vec3* positions, size_t vertexCount, std::vector<Meshlet>& outMeshlets)
+{
+    outMeshlets.clear();
+    if (indexCount < 3)
+        return;
+
+    // Stamp of the meshlet that last used each vertex
+    std::vector<uint32_t> stamp(vertexCount, 0);
+    uint32_t current = 1;
+    uint32_t uniqueVertices = 0;
+    size_t begin = indexOffset;
+    size_t end = indexOffset + indexCount;
+
+    for (size_t i = begin; i < end; i += 3)
+    {
+        unsigned int newVertices = 0;
+        for (int k = 0; k < 3; k++)
+            newVertices += stamp[indices[i + k]] != current;
+
+        // Start a new meshlet when this triangle would overflow the limits
+        if (uniqueVertices + newVertices > maxVertices || (i - begin) / 3 >= maxTriangles)
+        {
+            outMeshlets.push_back(finishMeshlet(indices, begin, i, positions, uniqueVertices));
+            begin = i;
+            current++;
+            uniqueVertices = 0;
+        }
+
+        for (int k = 0; k < 3; k++)
+        {
+            if (stamp[indices[i + k]] != current)
+            {
+                stamp[indices[i + k]] = current;
+                uniqueVertices++;
+            }
+        }
+    }
+    outMeshlets.push_back(finishMeshlet(indices, begin, end, positions, uniqueVertices));
+}
+
+bool MeshletBuilder::isVisible(const Meshlet& meshlet, const Frustum& frustum, const glm::vec3& eye)
+{
+    // Outside any plane
+    for (const glm::vec4& plane : frustum.planes)
+        if (glm::dot(glm::vec3(plane), meshlet.centre) + plane.w < -meshlet.radius)
+            return false;
+
+    // Every triangle faces away from the eye
+    glm::vec3 toCentre = meshlet.centre - eye;
+    return glm::dot(toCentre, meshlet.coneAxis) < meshlet.coneCutoff * glm::length(toCentre) + meshlet.radius;
+}
+
+size_t MeshletBuilder::cull(const Meshlet* meshlets, size_t meshletCount, const Frustum& frustum,
+                            const glm::vec3& eye, std::vector<uint32_t>& outOffsets,
+                            std::vector<uint32_t>& outCounts)
+{
+    outOffsets.clear();
+    outCounts.clear();
+    size_t visible = 0;
+    for (size_t i = 0; i < meshletCount; i++)
+    {
+        const Meshlet& meshlet = meshlets[i];
+        if (!isVisible(meshlet, frustum, eye))
+            continue;
+        visible++;
+
+        // Extend the previous range when the meshlets are neighbours
+        if (!outCounts.empty() && outOffsets.back() + outCounts.back() == meshlet.indexOffset)
+            outCounts.back() += meshlet.indexCount;
+        else
+        {
+            outOffsets.push_back(meshlet.indexOffset);
+            outCounts.push_back(meshlet.indexCount);
+        }
+    }
+    return visible;
+}
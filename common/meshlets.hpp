@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+// A small cluster of triangles, a contiguous range of the index buffer
+struct Meshlet
+{
+    glm::vec3 centre;       // object space bounding sphere
+    float radius;
+    glm::vec3 coneAxis;     // average facing of the triangles
+    float coneCutoff;       // sine of the cone half angle, 1 when the cone is too wide to cull
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    uint32_t vertexCount;   // unique vertices referenced
+    uint32_t padding;
+};
+
+// Six planes (left, right, bottom, top, near, far) facing into the frustum
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    // planes of a clip space matrix, in the space that matrix transforms from
+    static Frustum fromMatrix(const glm::mat4& matrix);
+};
+
+class MeshletBuilder
+{
+public:
+    static const unsigned int maxVertices = 64;
+    static const unsigned int maxTriangles = 124;
+
+    // split indices[indexOffset, indexOffset + indexCount) into meshlets in the
+    // existing triangle order, so each meshlet stays a drawable index range
+    static void build(const std::vector<unsigned int>& indices, size_t indexOffset, size_t indexCount,
+                      const glm::vec3* positions, size_t vertexCount, std::vector<Meshlet>& outMeshlets);
+
+    // true when the meshlet may be visible; frustum and eye are in object space
+    static bool isVisible(const Meshlet& meshlet, const Frustum& frustum, const glm::vec3& eye);
+
+    // index ranges of the visible meshlets, neighbours merged into one range;
+    // returns the number of meshlets that survived
+    static size_t cull(const Meshlet* meshlets, size_t meshletCount, const Frustum& frustum,
+                       const glm::vec3& eye, std::vector<uint32_t>& outOffsets,
+                       std::vector<uint32_t>& outCounts);
+};
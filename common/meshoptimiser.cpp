@@ -0,0 +1,528 @@
+#include <math.h>
+#include <algorithm>
+
+#include "meshoptimiser.hpp"
+
+namespace
+{
+    // Forsyth scoring parameters
+    const int forsythCacheSize = 32;
+    const float cacheDecayPower = 1.5f;
+    const float lastTriangleScore = 0.75f;
+    const float valenceBoostScale = 2.0f;
+    const float valenceBoostPower = 0.5f;
+    const int maxValence = 64;
+
+    struct ForsythTables
+    {
+        float cache[forsythCacheSize];
+        float valence[maxValence];
+
+        ForsythTables()
+        {
+            for (int i = 0; i < forsythCacheSize; i++)
+            {
+                // The three most recent vertices get a fixed score so the
+                // next triangle doesn't simply reuse the last edge
+                if (i < 3)
+                    cache[i] = lastTriangleScore;
+                else
+                    cache[i] = powf(1.0f - float(i - 3) / float(forsythCacheSize - 3), cacheDecayPower);
+            }
+            for (int i = 0; i < maxValence; i++)
+                valence[i] = i ? valenceBoostScale * powf(float(i), -valenceBoostPower) : 0.0f;
+        }
+    };
+
+    const ForsythTables& forsythTables()
+    {
+        static ForsythTables tables;
+        return tables;
+    }
+
+    float vertexScore(int cachePosition, unsigned int remaining)
+    {
+        // Vertices with no triangles left to draw don't matter
+        if (remaining == 0)
+            return -1.0f;
+
+        const ForsythTables& tables = forsythTables();
+        float score = cachePosition >= 0 ? tables.cache[cachePosition] : 0.0f;
+        return score + tables.valence[std::min<unsigned int>(remaining, maxValence - 1)];
+    }
+
+    float triangleScore(const std::vector<unsigned int>& indices, const std::vector<float>& vertexScores, size_t t)
+    {
+        return vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+    }
+
+    // Triangles using each vertex, as offsets into one flat list
+    struct Adjacency
+    {
+        std::vector<unsigned int> counts;
+        std::vector<unsigned int> offsets;
+        std::vector<unsigned int> triangles;
+
+        Adjacency(const std::vector<unsigned int>& indices, size_t vertexCount)
+            : counts(vertexCount, 0), offsets(vertexCount, 0), triangles(indices.size())
+        {
+            for (unsigned int index : indices)
+                counts[index]++;
+
+            unsigned int offset = 0;
+            for (size_t i = 0; i < vertexCount; i++)
+            {
+                offsets[i] = offset;
+                offset += counts[i];
+            }
+
+            std::vector<unsigned int> filled(vertexCount, 0);
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                unsigned int vertex = indices[i];
+                triangles[offsets[vertex] + filled[vertex]++] = static_cast<unsigned int>(i / 3);
+            }
+        }
+    };
+
+    // FIFO cache simulation using timestamps, returns the misses of one triangle
+    unsigned int updateCache(unsigned int a, unsigned int b, unsigned int c, unsigned int cacheSize,
+                             std::vector<unsigned int>& timestamps, unsigned int& timestamp)
+    {
+        unsigned int misses = 0;
+        const unsigned int vertices[3] = { a, b, c };
+        for (unsigned int vertex : vertices)
+        {
+            if (timestamp - timestamps[vertex] > cacheSize)
+            {
+                timestamps[vertex] = timestamp++;
+                misses++;
+            }
+        }
+        return misses;
+    }
+
+    // Start a fresh cluster every time a triangle misses on all three vertices
+    std::vector<unsigned int> hardBoundaries(const std::vector<unsigned int>& indices, size_t vertexCount,
+                                             unsigned int cacheSize)
+    {
+        std::vector<unsigned int> timestamps(vertexCount, 0);
+        unsigned int timestamp = cacheSize + 1;
+        std::vector<unsigned int> boundaries;
+
+        size_t triangleCount = indices.size() / 3;
+        for (size_t i = 0; i < triangleCount; i++)
+        {
+            unsigned int misses = updateCache(indices[i * 3], indices[i * 3 + 1], indices[i * 3 + 2],
+                                              cacheSize, timestamps, timestamp);
+            if (i == 0 || misses == 3)
+                boundaries.push_back(static_cast<unsigned int>(i));
+        }
+        return boundaries;
+    }
+
+    // Split hard clusters wherever the running ACMR stays within threshold of the cluster's
+    std::vector<unsigned int> softBoundaries(const std::vector<unsigned int>& indices, size_t vertexCount,
+                                             const std::vector<unsigned int>& hard, unsigned int cacheSize,
+                                             float threshold)
+    {
+        std::vector<unsigned int> timestamps(vertexCount, 0);
+        unsigned int timestamp = 0;
+        std::vector<unsigned int> boundaries;
+
+        size_t triangleCount = indices.size() / 3;
+        for (size_t cluster = 0; cluster < hard.size(); cluster++)
+        {
+            size_t start = hard[cluster];
+            size_t end = cluster + 1 < hard.size() ? hard[cluster + 1] : triangleCount;
+
+            // Cluster ACMR with a cold cache
+            timestamp += cacheSize + 1;
+            unsigned int clusterMisses = 0;
+            for (size_t i = start; i < end; i++)
+                clusterMisses += updateCache(indices[i * 3], indices[i * 3 + 1], indices[i * 3 + 2],
+                                             cacheSize, timestamps, timestamp);
+            float clusterThreshold = threshold * float(clusterMisses) / float(end - start);
+
+            boundaries.push_back(static_cast<unsigned int>(start));
+
+            timestamp += cacheSize + 1;
+            unsigned int runningMisses = 0;
+            unsigned int runningTriangles = 0;
+            for (size_t i = start; i < end; i++)
+            {
+                runningMisses += updateCache(indices[i * 3], indices[i * 3 + 1], indices[i * 3 + 2],
+                                             cacheSize, timestamps, timestamp);
+                runningTriangles++;
+
+                if (float(runningMisses) / float(runningTriangles) <= clusterThreshold)
+                {
+                    // Target reached, the next triangle starts a new cluster with a flushed cache
+                    boundaries.push_back(static_cast<unsigned int>(i + 1));
+                    timestamp += cacheSize + 1;
+                    runningMisses = 0;
+                    runningTriangles = 0;
+                }
+            }
+
+            // A split on the last triangle leaves an empty cluster behind
+            if (runningTriangles == 0)
+                boundaries.pop_back();
+        }
+        return boundaries;
+    }
+
+    // Software rasteriser used by the overdraw analyser
+    const int overdrawResolution = 256;
+
+    struct OverdrawCounts
+    {
+        double covered = 0.0;
+        double shaded = 0.0;
+    };
+
+    void rasterise(const std::vector<glm::vec3>& triangles, OverdrawCounts& counts)
+    {
+        std::vector<float> depth(overdrawResolution * overdrawResolution);
+        std::fill(depth.begin(), depth.end(), 2.0f);
+        std::vector<unsigned char> touched(depth.size(), 0);
+
+        for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+        {
+            // Scale to pixels, depth stays in [0, 1]
+            const float resolution = static_cast<float>(overdrawResolution);
+            const glm::vec3 toPixels(resolution, resolution, 1.0f);
+            glm::vec3 a = triangles[t] * toPixels;
+            glm::vec3 b = triangles[t + 1] * toPixels;
+            glm::vec3 c = triangles[t + 2] * toPixels;
+
+            // Only front faces are shaded
+            float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+            if (area >= 0.0f)
+                continue;
+
+            int minX = std::max(0, int(floorf(std::min(a.x, std::min(b.x, c.x)))));
+            int maxX = std::min(overdrawResolution - 1, int(ceilf(std::max(a.x, std::max(b.x, c.x)))));
+            int minY = std::max(0, int(floorf(std::min(a.y, std::min(b.y, c.y)))));
+            int maxY = std::min(overdrawResolution - 1, int(ceilf(std::max(a.y, std::max(b.y, c.y)))));
+
+            for (int y = minY; y <= maxY; y++)
+            {
+                for (int x = minX; x <= maxX; x++)
+                {
+                    // Edge functions at the pixel centre
+                    float px = x + 0.5f;
+                    float py = y + 0.5f;
+                    float w0 = (c.x - b.x) * (py - b.y) - (c.y - b.y) * (px - b.x);
+                    float w1 = (a.x - c.x) * (py - c.y) - (a.y - c.y) * (px - c.x);
+                    float w2 = (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+                    if (w0 > 0.0f || w1 > 0.0f || w2 > 0.0f)
+                        continue;
+
+                    float z = (w0 * a.z + w1 * b.z + w2 * c.z) / area;
+                    size_t pixel = size_t(y) * overdrawResolution + x;
+                    if (!touched[pixel])
+                    {
+                        touched[pixel] = 1;
+                        counts.covered += 1.0;
+                    }
+                    if (z < depth[pixel])
+                    {
+                        depth[pixel] = z;
+                        counts.shaded += 1.0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void MeshOptimiser::optimiseVertexCache(std::vector<unsigned int>& indices, size_t vertexCount)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    Adjacency adjacency(indices, vertexCount);
+    std::vector<unsigned int> remaining = adjacency.counts;
+
+    // Initial scores
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
+        vertexScores[i] = vertexScore(-1, remaining[i]);
+
+    // Untouched triangles keep their starting score, so the best of them
+    // is always the next one in this order that hasn't been emitted
+    std::vector<float> triangleScores(triangleCount);
+    std::vector<unsigned int> order(triangleCount);
+    for (size_t i = 0; i < triangleCount; i++)
+    {
+        triangleScores[i] = triangleScore(indices, vertexScores, i);
+        order[i] = static_cast<unsigned int>(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&triangleScores](unsigned int a, unsigned int b) {
+        return triangleScores[a] > triangleScores[b];
+    });
+
+    std::vector<char> emitted(triangleCount, 0);
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+
+    std::vector<unsigned int> cache;
+    std::vector<unsigned int> newCache;
+    cache.reserve(forsythCacheSize + 3);
+    newCache.reserve(forsythCacheSize + 3);
+
+    // Vertices that left the cache with triangles still to draw
+    std::vector<unsigned int> deadEnds;
+
+    size_t cursor = 0;
+    size_t best = order[0];
+    while (result.size() < indices.size())
+    {
+        // Emit the chosen triangle
+        emitted[best] = 1;
+        const unsigned int* triangle = &indices[best * 3];
+        result.insert(result.end(), triangle, triangle + 3);
+
+        // Drop it from its vertices' remaining triangles
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int vertex = triangle[k];
+            unsigned int* list = &adjacency.triangles[adjacency.offsets[vertex]];
+            unsigned int count = remaining[vertex];
+            for (unsigned int j = 0; j < count; j++)
+            {
+                if (list[j] == best)
+                {
+                    std::swap(list[j], list[count - 1]);
+                    break;
+                }
+            }
+            remaining[vertex]--;
+        }
+
+        // The triangle's vertices move to the front of the LRU cache
+        newCache.assign(triangle, triangle + 3);
+        for (unsigned int vertex : cache)
+            if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2])
+                newCache.push_back(vertex);
+        for (size_t i = forsythCacheSize; i < newCache.size(); i++)
+        {
+            cachePosition[newCache[i]] = -1;
+            vertexScores[newCache[i]] = vertexScore(-1, remaining[newCache[i]]);
+            if (remaining[newCache[i]] > 0)
+                deadEnds.push_back(newCache[i]);
+        }
+        if (newCache.size() > size_t(forsythCacheSize))
+            newCache.resize(forsythCacheSize);
+        cache.swap(newCache);
+
+        for (size_t i = 0; i < cache.size(); i++)
+        {
+            cachePosition[cache[i]] = int(i);
+            vertexScores[cache[i]] = vertexScore(int(i), remaining[cache[i]]);
+        }
+
+        // Rescore triangles around the cache and pick the best one
+        float bestScore = -1.0f;
+        bool found = false;
+        for (unsigned int vertex : cache)
+        {
+            const unsigned int* list = &adjacency.triangles[adjacency.offsets[vertex]];
+            for (unsigned int j = 0; j < remaining[vertex]; j++)
+            {
+                unsigned int t = list[j];
+                float score = triangleScore(indices, vertexScores, t);
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    best = t;
+                    found = true;
+                }
+            }
+        }
+
+        // Nothing left around the cache: the best triangle of the most
+        // recently evicted vertex that still has some, else the best
+        // triangle nothing has touched yet
+        while (!found && !deadEnds.empty())
+        {
+            unsigned int vertex = deadEnds.back();
+            deadEnds.pop_back();
+            const unsigned int* list = &adjacency.triangles[adjacency.offsets[vertex]];
+            for (unsigned int j = 0; j < remaining[vertex]; j++)
+            {
+                float score = triangleScore(indices, vertexScores, list[j]);
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    best = list[j];
+                    found = true;
+                }
+            }
+        }
+        if (!found)
+        {
+            while (cursor < triangleCount && emitted[order[cursor]])
+                cursor++;
+            if (cursor == triangleCount)
+                break;
+            best = order[cursor];
+        }
+    }
+
+    indices.swap(result);
+}
+
+void MeshOptimiser::optimiseOverdraw(std::vector<unsigned int>& indices,
+                                     const std::vector<glm::vec3>& positions,
+                                     float threshold)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    std::vector<unsigned int> hard = hardBoundaries(indices, positions.size(), analysisCacheSize);
+    std::vector<unsigned int> clusters = softBoundaries(indices, positions.size(), hard, analysisCacheSize, threshold);
+
+    // Area weighted centroid of the whole mesh
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const glm::vec3& a = positions[indices[t * 3]];
+        const glm::vec3& b = positions[indices[t * 3 + 1]];
+        const glm::vec3& c = positions[indices[t * 3 + 2]];
+        float area = glm::length(glm::cross(b - a, c - a));
+        meshCentroid += (a + b + c) * (area / 3.0f);
+        meshArea += area;
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    // Clusters facing away from the centre are likely to occlude the rest
+    std::vector<float> sortKeys(clusters.size());
+    for (size_t cluster = 0; cluster < clusters.size(); cluster++)
+    {
+        size_t start = clusters[cluster];
+        size_t end = cluster + 1 < clusters.size() ? clusters[cluster + 1] : triangleCount;
+
+        glm::vec3 centroid(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = start; t < end; t++)
+        {
+            const glm::vec3& a = positions[indices[t * 3]];
+            const glm::vec3& b = positions[indices[t * 3 + 1]];
+            const glm::vec3& c = positions[indices[t * 3 + 2]];
+            glm::vec3 n = glm::cross(b - a, c - a);
+            float triangleArea = glm::length(n);
+            centroid += (a + b + c) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        if (area > 0.0f)
+            centroid /= area;
+        float normalLength = glm::length(normal);
+        if (normalLength > 0.0f)
+            normal /= normalLength;
+
+        sortKeys[cluster] = glm::dot(centroid - meshCentroid, normal);
+    }
+
+    std::vector<unsigned int> order(clusters.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = static_cast<unsigned int>(i);
+    std::stable_sort(order.begin(), order.end(),
+                     [&sortKeys](unsigned int a, unsigned int b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    for (unsigned int cluster : order)
+    {
+        size_t start = clusters[cluster];
+        size_t end = cluster + 1 < clusters.size() ? clusters[cluster + 1] : triangleCount;
+        result.insert(result.end(), indices.begin() + start * 3, indices.begin() + end * 3);
+    }
+    indices.swap(result);
+}
+
+std::vector<unsigned int> MeshOptimiser::optimiseVertexFetch(std::vector<unsigned int>& indices,
+                                                             size_t vertexCount, size_t& newVertexCount)
+{
+    std::vector<unsigned int> remap(vertexCount, 0xFFFFFFFFu);
+    unsigned int next = 0;
+    for (unsigned int& index : indices)
+    {
+        if (remap[index] == 0xFFFFFFFFu)
+            remap[index] = next++;
+        index = remap[index];
+    }
+    newVertexCount = next;
+    return remap;
+}
+
+MeshAnalysis MeshOptimiser::analyse(const std::vector<unsigned int>& indices,
+                                    const std::vector<glm::vec3>& positions)
+{
+    MeshAnalysis analysis;
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0 || positions.empty())
+        return analysis;
+
+    // Vertex cache
+    std::vector<unsigned int> timestamps(positions.size(), 0);
+    std::vector<char> used(positions.size(), 0);
+    unsigned int timestamp = analysisCacheSize + 1;
+    size_t misses = 0;
+    size_t usedVertices = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+        misses += updateCache(indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2],
+                              analysisCacheSize, timestamps, timestamp);
+    for (unsigned int index : indices)
+    {
+        if (!used[index])
+        {
+            used[index] = 1;
+            usedVertices++;
+        }
+    }
+    analysis.acmr = float(misses) / float(triangleCount);
+    analysis.atvr = float(misses) / float(usedVertices);
+
+    // Overdraw, with the mesh scaled uniformly into the unit cube
+    glm::vec3 minimum = positions[indices[0]];
+    glm::vec3 maximum = minimum;
+    for (unsigned int index : indices)
+    {
+        minimum = glm::min(minimum, positions[index]);
+        maximum = glm::max(maximum, positions[index]);
+    }
+    glm::vec3 extent = maximum - minimum;
+    float scale = std::max(extent.x, std::max(extent.y, extent.z));
+    scale = scale > 0.0f ? 1.0f / scale : 0.0f;
+
+    OverdrawCounts counts;
+    std::vector<glm::vec3> projected(indices.size());
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int side = 0; side < 2; side++)
+        {
+            // Look down the axis from either side; mirroring u on the far
+            // side keeps front faces front facing
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                glm::vec3 p = (positions[indices[i]] - minimum) * scale;
+                float u = p[(axis + 1) % 3];
+                float v = p[(axis + 2) % 3];
+                float d = p[axis];
+                projected[i] = side == 0 ? glm::vec3(u, v, d) : glm::vec3(1.0f - u, v, 1.0f - d);
+            }
+            rasterise(projected, counts);
+        }
+    }
+    analysis.overdraw = counts.covered > 0.0 ? float(counts.shaded / counts.covered) : 1.0f;
+    return analysis;
+}
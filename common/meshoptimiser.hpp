@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+#include <glm/glm.hpp>
+
+// GPU efficiency figures for an indexed triangle list
+struct MeshAnalysis
+{
+    float acmr = 0.0f;       // vertex shader runs per triangle
+    float atvr = 0.0f;       // vertex shader runs per referenced vertex (1.0 is ideal)
+    float overdraw = 0.0f;   // shaded fragments per covered pixel (1.0 is ideal)
+};
+
+class MeshOptimiser
+{
+public:
+    // FIFO size the analyser simulates, close to current post-transform caches
+    static const unsigned int analysisCacheSize = 16;
+
+    // reorder triangles for post-transform cache hits (Forsyth's linear-speed algorithm)
+    static void optimiseVertexCache(std::vector<unsigned int>& indices, size_t vertexCount);
+
+    // split the cache-ordered triangles into clusters and draw outward facing
+    // clusters first, accepting up to threshold times more cache misses
+    static void optimiseOverdraw(std::vector<unsigned int>& indices,
+                                 const std::vector<glm::vec3>& positions,
+                                 float threshold = 1.05f);
+
+    // renumber vertices in first-use order; returns the old -> new remap table
+    // (unused vertices map to 0xFFFFFFFF) and rewrites indices to match
+    static std::vector<unsigned int> optimiseVertexFetch(std::vector<unsigned int>& indices,
+                                                         size_t vertexCount, size_t& newVertexCount);
+
+    // apply a remap table from optimiseVertexFetch to one vertex stream
+    template <typename T>
+    static void remapStream(std::vector<T>& stream, const std::vector<unsigned int>& remap, size_t newVertexCount)
+    {
+        if (stream.empty())
+            return;
+        std::vector<T> result(newVertexCount);
+        for (size_t i = 0; i < remap.size(); i++)
+            if (remap[i] != 0xFFFFFFFFu)
+                result[remap[i]] = stream[i];
+        stream.swap(result);
+    }
+
+    // ACMR and ATVR from a FIFO cache simulation, overdraw from a software
+    // rasteriser viewing the mesh along all six axis directions
+    static MeshAnalysis analyse(const std::vector<unsigned int>& indices,
+                                const std::vector<glm::vec3>& positions);
+};
@@ -0,0 +1,389 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+
+#include "meshsimplifier.hpp"
+#include "meshoptimiser.hpp"
+
+namespace
+{
+    // Symmetric 4x4 quadric stored as A (3x3), b and c plus the summed weight
+    struct Quadric
+    {
+        float a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+        float b0 = 0, b1 = 0, b2 = 0;
+        float c = 0;
+        float weight = 0;
+
+        void addPlane(const glm::vec3& n, float d, float w)
+        {
+            a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z;
+            a11 += w * n.y * n.y; a12 += w * n.y * n.z; a22 += w * n.z * n.z;
+            b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+            c += w * d * d;
+            weight += w;
+        }
+
+        void add(const Quadric& q)
+        {
+            a00 += q.a00; a01 += q.a01; a02 += q.a02;
+            a11 += q.a11; a12 += q.a12; a22 += q.a22;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2;
+            c += q.c;
+            weight += q.weight;
+        }
+
+        // Squared distance to the planes, averaged by weight
+        float evaluate(const glm::vec3& p) const
+        {
+            float r = p.x * (a00 * p.x + a01 * p.y + a02 * p.z) +
+                      p.y * (a01 * p.x + a11 * p.y + a12 * p.z) +
+                      p.z * (a02 * p.x + a12 * p.y + a22 * p.z) +
+                      2.0f * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+            return weight > 0.0f ? fabsf(r) / weight : 0.0f;
+        }
+    };
+
+    struct Collapse
+    {
+        unsigned int from;
+        unsigned int to;
+        float cost;
+    };
+
+    uint64_t edgeKey(unsigned int a, unsigned int b)
+    {
+        if (a > b)
+            std::swap(a, b);
+        return (uint64_t(a) << 32) | b;
+    }
+
+    // Lowest numbered vertex at each distinct position
+    std::vector<unsigned int> positionRemap(const glm::vec3* positions, size_t vertexCount)
+    {
+        struct PositionHash
+        {
+            size_t operator()(const glm::vec3& p) const
+            {
+                uint32_t bits[3];
+                memcpy(bits, &p[0], sizeof(bits));
+                return size_t(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+            }
+        };
+
+        std::unordered_map<glm::vec3, unsigned int, PositionHash> first;
+        first.reserve(vertexCount);
+        std::vector<unsigned int> remap(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++)
+            remap[i] = first.emplace(positions[i], static_cast<unsigned int>(i)).first->second;
+        return remap;
+    }
+
+    // Would moving vertex from onto to flip any of its other triangles?
+    // Triangles touching to's position in any of its wedges disappear.
+    bool flipsTriangle(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& adjacency,
+                       const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& canonical,
+                       const glm::vec3* positions, unsigned int from, unsigned int to)
+    {
+        unsigned int target = canonical[to];
+        for (unsigned int j = offsets[from]; j < offsets[from + 1]; j++)
+        {
+            const unsigned int* triangle = &indices[adjacency[j] * 3];
+            if (canonical[triangle[0]] == target || canonical[triangle[1]] == target ||
+                canonical[triangle[2]] == target)
+                continue;
+
+            // Rotate so the moving vertex comes first
+            int k = triangle[0] == from ? 0 : (triangle[1] == from ? 1 : 2);
+            const glm::vec3& p1 = positions[triangle[(k + 1) % 3]];
+            const glm::vec3& p2 = positions[triangle[(k + 2) % 3]];
+            glm::vec3 before = glm::cross(p1 - positions[from], p2 - positions[from]);
+            glm::vec3 after = glm::cross(p1 - positions[to], p2 - positions[to]);
+            if (glm::dot(before, after) <= 0.0f)
+                return true;
+        }
+        return false;
+    }
+
+    // Wedges at one position whose normal and uv agree are duplicates
+    // rather than a seam; each gets the lowest numbered wedge it matches
+    std::vector<unsigned int> attributeClasses(const std::vector<unsigned int>& canonical,
+                                               const std::vector<unsigned int>& nextWedge,
+                                               const glm::vec3* normals, const glm::vec2* uvs)
+    {
+        const float normalTolerance = 0.9999f;      // cosine, about 0.8 degrees
+        const float uvTolerance = 1e-5f;
+        size_t vertexCount = canonical.size();
+        std::vector<unsigned int> classes(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            classes[i] = static_cast<unsigned int>(i);
+            if (!normals || !uvs)
+                continue;
+            for (unsigned int j = canonical[i]; j < i; j = nextWedge[j])
+            {
+                if (classes[j] == j && glm::dot(normals[i], normals[j]) >= normalTolerance &&
+                    glm::all(glm::lessThanEqual(glm::abs(uvs[i] - uvs[j]), glm::vec2(uvTolerance))))
+                {
+                    classes[i] = j;
+                    break;
+                }
+            }
+        }
+        return classes;
+    }
+
+    // The wedge at position target that from shares a triangle with, so
+    // the attributes it takes on are ones its side of any seam already
+    // blends towards. none if there is no such wedge, ambiguous if from
+    // reaches wedges on both sides of a seam there.
+    const unsigned int none = 0xFFFFFFFFu;
+    const unsigned int ambiguous = 0xFFFFFFFEu;
+
+    unsigned int partnerWedge(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& adjacency,
+                              const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& canonical,
+                              const std::vector<unsigned int>& classes, unsigned int from, unsigned int target)
+    {
+        unsigned int partner = none;
+        for (unsigned int j = offsets[from]; j < offsets[from + 1]; j++)
+        {
+            const unsigned int* triangle = &indices[adjacency[j] * 3];
+            for (int k = 0; k < 3; k++)
+            {
+                if (canonical[triangle[k]] != target)
+                    continue;
+                if (partner == none)
+                    partner = triangle[k];
+                else if (classes[partner] != classes[triangle[k]])
+                    return ambiguous;
+            }
+        }
+        return partner;
+    }
+}
+
+std::vector<unsigned int> MeshSimplifier::simplify(const std::vector<unsigned int>& indices,
+                                                   const glm::vec3* positions, const glm::vec3* normals,
+                                                   const glm::vec2* uvs, size_t vertexCount,
+                                                   size_t targetIndexCount, float& error)
+{
+    std::vector<unsigned int> result = indices;
+    error = 0.0f;
+    if (result.size() <= targetIndexCount)
+        return result;
+
+    // Vertices sharing a position are wedges of one corner. Collapses work
+    // on corners and move every wedge along: each goes to the wedge at the
+    // target it shares a triangle with, or that a duplicate of it (same
+    // normal and uv) does. A corner where seams meet has a wedge with no
+    // such partner, or one on both sides of a seam, and stays put.
+    std::vector<unsigned int> canonical = positionRemap(positions, vertexCount);
+    std::vector<unsigned int> nextWedge(vertexCount, none);
+    for (size_t i = vertexCount; i-- > 0;)
+    {
+        if (canonical[i] != i)
+        {
+            nextWedge[i] = nextWedge[canonical[i]];
+            nextWedge[canonical[i]] = static_cast<unsigned int>(i);
+        }
+    }
+    std::vector<unsigned int> classes = attributeClasses(canonical, nextWedge, normals, uvs);
+
+    // Corners on open borders are kept in place
+    std::vector<char> locked(vertexCount, 0);
+    std::unordered_map<uint64_t, unsigned int> edgeUses;
+    edgeUses.reserve(result.size());
+    for (size_t i = 0; i < result.size(); i += 3)
+        for (int k = 0; k < 3; k++)
+            edgeUses[edgeKey(canonical[result[i + k]], canonical[result[i + (k + 1) % 3]])]++;
+    for (size_t i = 0; i < result.size(); i += 3)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int a = canonical[result[i + k]];
+            unsigned int b = canonical[result[i + (k + 1) % 3]];
+            if (edgeUses[edgeKey(a, b)] == 1)
+                locked[a] = locked[b] = 1;
+        }
+    }
+
+    // Area weighted plane quadrics, one per corner
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < result.size(); i += 3)
+    {
+        const glm::vec3& p0 = positions[result[i]];
+        const glm::vec3& p1 = positions[result[i + 1]];
+        const glm::vec3& p2 = positions[result[i + 2]];
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float area = glm::length(normal);
+        if (area == 0.0f)
+            continue;
+        normal /= area;
+        float d = -glm::dot(normal, p0);
+        for (int k = 0; k < 3; k++)
+            quadrics[canonical[result[i + k]]].addPlane(normal, d, area);
+    }
+
+    std::vector<Collapse> collapses;
+    std::vector<unsigned int> remap(vertexCount);
+    std::vector<char> touched(vertexCount);
+    std::vector<unsigned int> offsets(vertexCount + 1);
+    std::vector<unsigned int> adjacency;
+    std::vector<unsigned int> classPartners(vertexCount, none);
+
+    // Each pass collapses a batch of independent edges in cost order
+    while (result.size() > targetIndexCount)
+    {
+        // Triangles around each vertex
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (unsigned int index : result)
+            offsets[index + 1]++;
+        for (size_t i = 0; i < vertexCount; i++)
+            offsets[i + 1] += offsets[i];
+        adjacency.resize(result.size());
+        std::vector<unsigned int> filled(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < result.size(); i++)
+            adjacency[filled[result[i]]++] = static_cast<unsigned int>(i / 3);
+
+        // Candidate collapses in both directions along every edge, between
+        // corners rather than wedges
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = canonical[result[i + k]];
+                unsigned int b = canonical[result[i + (k + 1) % 3]];
+                if (a == b)
+                    continue;
+                Quadric q = quadrics[a];
+                q.add(quadrics[b]);
+                if (!locked[a])
+                    collapses.push_back({ a, b, q.evaluate(positions[b]) });
+                if (!locked[b])
+                    collapses.push_back({ b, a, q.evaluate(positions[a]) });
+            }
+        }
+        if (collapses.empty())
+            break;
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+        // A collapse removes about two triangles
+        size_t wanted = (result.size() - targetIndexCount) / 6 + 1;
+        size_t done = 0;
+        for (size_t i = 0; i < vertexCount; i++)
+            remap[i] = static_cast<unsigned int>(i);
+        std::fill(touched.begin(), touched.end(), 0);
+
+        for (const Collapse& collapse : collapses)
+        {
+            if (done >= wanted)
+                break;
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            // One partner per attribute class of the corner's wedges
+            bool allowed = true;
+            for (unsigned int wedge = collapse.from; wedge != none; wedge = nextWedge[wedge])
+                classPartners[classes[wedge]] = none;
+            for (unsigned int wedge = collapse.from; allowed && wedge != none; wedge = nextWedge[wedge])
+            {
+                unsigned int partner = partnerWedge(result, adjacency, offsets, canonical, classes,
+                                                    wedge, collapse.to);
+                unsigned int& chosen = classPartners[classes[wedge]];
+                if (partner == ambiguous || (partner != none && chosen != none && classes[chosen] != classes[partner]))
+                    allowed = false;
+                else if (partner != none && chosen == none)
+                    chosen = partner;
+            }
+
+            // Every wedge still in use must have one and not flip a triangle
+            for (unsigned int wedge = collapse.from; allowed && wedge != none; wedge = nextWedge[wedge])
+            {
+                unsigned int partner = classPartners[classes[wedge]];
+                if (offsets[wedge] != offsets[wedge + 1])
+                    allowed = partner != none &&
+                              !flipsTriangle(result, adjacency, offsets, canonical, positions, wedge, partner);
+            }
+            if (!allowed)
+                continue;
+
+            // The flip test assumed the rest of each triangle stays put, so
+            // nothing around the corner moves again this pass
+            for (unsigned int wedge = collapse.from; wedge != none; wedge = nextWedge[wedge])
+            {
+                if (classPartners[classes[wedge]] != none)
+                    remap[wedge] = classPartners[classes[wedge]];
+                for (unsigned int j = offsets[wedge]; j < offsets[wedge + 1]; j++)
+                {
+                    const unsigned int* triangle = &result[adjacency[j] * 3];
+                    for (int k = 0; k < 3; k++)
+                        touched[canonical[triangle[k]]] = 1;
+                }
+            }
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            touched[collapse.from] = touched[collapse.to] = 1;
+            error = std::max(error, sqrtf(collapse.cost));
+            done++;
+        }
+        if (done == 0)
+            break;
+
+        // Apply and drop the triangles that became degenerate, which may
+        // now use two wedges of one corner
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            unsigned int a = remap[result[i]];
+            unsigned int b = remap[result[i + 1]];
+            unsigned int c = remap[result[i + 2]];
+            if (canonical[a] == canonical[b] || canonical[b] == canonical[c] || canonical[a] == canonical[c])
+                continue;
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+        }
+        result.resize(write);
+    }
+
+    return result;
+}
+
+void MeshSimplifier::buildLodChain(const std::vector<unsigned int>& indices,
+                                   const glm::vec3* positions, const glm::vec3* normals,
+                                   const glm::vec2* uvs, size_t vertexCount, int maxLevels,
+                                   std::vector<unsigned int>& outIndices, std::vector<MeshLod>& outLods)
+{
+    outIndices = indices;
+    outLods.clear();
+    outLods.push_back({ 0, static_cast<uint32_t>(indices.size()), 0.0f, 0, 0 });
+
+    std::vector<unsigned int> previous = indices;
+    float previousError = 0.0f;
+    for (int level = 1; level < maxLevels; level++)
+    {
+        size_t target = (previous.size() / 2) / 3 * 3;
+        float error;
+        std::vector<unsigned int> lod = simplify(previous, positions, normals, uvs, vertexCount, target, error);
+
+        // Stop once a level no longer removes at least a tenth of the triangles
+        if (lod.empty() || lod.size() > previous.size() * 9 / 10)
+            break;
+
+        // Errors add up since every level starts from the one before
+        MeshOptimiser::optimiseVertexCache(lod, vertexCount);
+        previousError += error;
+        outLods.push_back({ static_cast<uint32_t>(outIndices.size()), static_cast<uint32_t>(lod.size()), previousError, 0, 0 });
+        outIndices.insert(outIndices.end(), lod.begin(), lod.end());
+        previous.swap(lod);
+    }
+}
+
+float MeshSimplifier::projectedError(float objectError, float objectScale, float distance,
+                                     float fovY, float screenHeight)
+{
+    float pixelsPerUnit = screenHeight / (2.0f * tanf(fovY * 0.5f) * std::max(distance, 1e-4f));
+    return objectError * objectScale * pixelsPerUnit;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+// One level of detail, a range of the shared index buffer and of the
+// meshlets splitting it
+struct MeshLod
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error;            // object space distance the level may deviate by
+    uint32_t meshletOffset;
+    uint32_t meshletCount;  // 0 when the level has no meshlets
+};
+
+class MeshSimplifier
+{
+public:
+    // Quadric error edge collapse (Garland-Heckbert) towards targetIndexCount.
+    // Vertices collapse onto existing vertices so every level shares the
+    // vertex buffer. Vertices at one position move together, each wedge of
+    // a uv/normal seam onto the wedge on its own side, so seams slide along
+    // themselves; corners where seams meet and open borders stay put.
+    // Wedges whose normal and uv agree are not a seam. normals and uvs may
+    // be null, making every wedge distinct. error receives the largest
+    // collapse error in object space units.
+    static std::vector<unsigned int> simplify(const std::vector<unsigned int>& indices,
+                                              const glm::vec3* positions, const glm::vec3* normals,
+                                              const glm::vec2* uvs, size_t vertexCount,
+                                              size_t targetIndexCount, float& error);
+
+    // Level 0 is indices itself, each further level halves the previous one
+    // until maxLevels or the simplifier stops making progress. All levels
+    // are appended to outIndices and described by outLods.
+    static void buildLodChain(const std::vector<unsigned int>& indices,
+                              const glm::vec3* positions, const glm::vec3* normals,
+                              const glm::vec2* uvs, size_t vertexCount, int maxLevels,
+                              std::vector<unsigned int>& outIndices, std::vector<MeshLod>& outLods);
+
+    // Error of a level in pixels when its object is distance units away
+    static float projectedError(float objectError, float objectScale, float distance,
+                                float fovY, float screenHeight);
+};
@@ -0,0 +1,458 @@
+#include <math.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+
+#include "mipgenerator.hpp"
+#include "threadpool.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define MIP_SSE 1
+#endif
+
+namespace
+{
+    // Output texels per level before the rows are split across threads
+    const size_t parallelThreshold = 65536;
+
+    // Largest kernel, Lanczos-3 and Kaiser span 12 source texels at 2:1
+    const int maxTaps = 12;
+
+    // A level in float, linear light for colour and [-1, 1] for normals
+    struct FloatImage
+    {
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        std::vector<float> texels;
+    };
+
+    // 2:1 kernel; output texel x reads source texels 2x + first .. 2x + first + taps - 1
+    struct Kernel
+    {
+        int taps = 0;
+        int first = 0;
+        float weights[maxTaps];
+    };
+
+    float sinc(float x)
+    {
+        if (fabsf(x) < 1e-6f)
+            return 1.0f;
+        float px = 3.14159265358979f * x;
+        return sinf(px) / px;
+    }
+
+    // Zeroth order modified Bessel function of the first kind
+    float besselI0(float x)
+    {
+        float sum = 1.0f;
+        float term = 1.0f;
+        for (int k = 1; k < 20; k++)
+        {
+            term *= (x * 0.5f / k) * (x * 0.5f / k);
+            sum += term;
+        }
+        return sum;
+    }
+
+    Kernel makeKernel(MipFilter filter)
+    {
+        Kernel kernel;
+        if (filter == MipBox)
+        {
+            kernel.taps = 2;
+            kernel.first = 0;
+            kernel.weights[0] = kernel.weights[1] = 0.5f;
+            return kernel;
+        }
+
+        // Windowed sinc of radius 3 output texels, cut off at the output Nyquist
+        const float radius = 3.0f;
+        const float alpha = 4.0f;
+        kernel.taps = maxTaps;
+        kernel.first = 1 - maxTaps / 2;
+        float sum = 0.0f;
+        for (int t = 0; t < kernel.taps; t++)
+        {
+            // Distance from the output centre in output texels
+            float x = (kernel.first + t + 0.5f - 1.0f) * 0.5f;
+            float window;
+            if (filter == MipLanczos)
+                window = sinc(x / radius);
+            else
+            {
+                float r = x / radius;
+                window = besselI0(alpha * sqrtf(std::max(0.0f, 1.0f - r * r))) / besselI0(alpha);
+            }
+            kernel.weights[t] = sinc(x) * window;
+            sum += kernel.weights[t];
+        }
+        for (int t = 0; t < kernel.taps; t++)
+            kernel.weights[t] /= sum;
+        return kernel;
+    }
+
+    int wrap(int i, int size)
+    {
+        i %= size;
+        return i < 0 ? i + size : i;
+    }
+
+    // Linear light -> sRGB byte through a fine table, built once
+    const unsigned char* srgbEncodeTable()
+    {
+        static const std::vector<unsigned char> table = []() {
+            std::vector<unsigned char> values(65536);
+            for (size_t i = 0; i < values.size(); i++)
+            {
+                float linear = (i + 0.5f) / values.size();
+                float encoded = linear <= 0.0031308f ? linear * 12.92f : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+                values[i] = static_cast<unsigned char>(std::min(255.0f, encoded * 255.0f + 0.5f));
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    const float* srgbDecodeTable()
+    {
+        static const std::vector<float> table = []() {
+            std::vector<float> values(256);
+            for (int i = 0; i < 256; i++)
+            {
+                float encoded = i / 255.0f;
+                values[i] = encoded <= 0.04045f ? encoded / 12.92f : powf((encoded + 0.055f) / 1.055f, 2.4f);
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    enum ChannelEncoding
+    {
+        EncodingSrgb,
+        EncodingSigned,     // [-1, 1] stored as [0, 255]
+        EncodingUnorm
+    };
+
+    // How each channel is stored; alpha (last of 2 or 4) is always linear
+    void channelEncodings(MipContent content, int channels, ChannelEncoding* encodings)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            bool alpha = (channels == 2 || channels == 4) && c == channels - 1;
+            if (content == MipColour && !alpha)
+                encodings[c] = EncodingSrgb;
+            else if (content == MipNormal && c < 3)
+                encodings[c] = EncodingSigned;
+            else
+                encodings[c] = EncodingUnorm;
+        }
+    }
+
+    void toFloat(const ImageData& image, MipContent content, FloatImage& out)
+    {
+        out.width = image.width;
+        out.height = image.height;
+        out.channels = image.channels;
+        out.texels.resize(image.pixels.size());
+
+        // Per channel lookup tables, so the loop is a single load per value
+        ChannelEncoding encodings[4];
+        channelEncodings(content, image.channels, encodings);
+        const float* srgb = srgbDecodeTable();
+        float tables[4][256];
+        for (int c = 0; c < image.channels; c++)
+        {
+            for (int v = 0; v < 256; v++)
+            {
+                if (encodings[c] == EncodingSrgb)
+                    tables[c][v] = srgb[v];
+                else if (encodings[c] == EncodingSigned)
+                    tables[c][v] = v / 127.5f - 1.0f;
+                else
+                    tables[c][v] = v / 255.0f;
+            }
+        }
+
+        size_t texels = size_t(image.width) * image.height;
+        int channels = image.channels;
+        const unsigned char* in = image.pixels.data();
+        float* texel = out.texels.data();
+        for (size_t i = 0; i < texels; i++, in += channels, texel += channels)
+        {
+            for (int c = 0; c < channels; c++)
+                texel[c] = tables[c][in[c]];
+        }
+    }
+
+    void toBytes(const FloatImage& image, MipContent content, ImageData& out)
+    {
+        out.width = image.width;
+        out.height = image.height;
+        out.channels = image.channels;
+        out.pixels.resize(image.texels.size());
+
+        ChannelEncoding encodings[4];
+        channelEncodings(content, image.channels, encodings);
+        const unsigned char* srgb = srgbEncodeTable();
+
+        size_t texels = size_t(image.width) * image.height;
+        int channels = image.channels;
+        const float* texel = image.texels.data();
+        unsigned char* pixel = out.pixels.data();
+        for (size_t i = 0; i < texels; i++, texel += channels, pixel += channels)
+        {
+            for (int c = 0; c < channels; c++)
+            {
+                float value = texel[c];
+                if (encodings[c] == EncodingSrgb)
+                    pixel[c] = srgb[std::min(65535, static_cast<int>(value * 65536.0f))];
+                else if (encodings[c] == EncodingSigned)
+                    pixel[c] = static_cast<unsigned char>((value + 1.0f) * 127.5f + 0.5f);
+                else
+                    pixel[c] = static_cast<unsigned char>(value * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    // out[i] = sum over taps of weight * rows[tap][i], the same order on every path
+    void verticalTaps(const float* const* rows, const float* weights, int taps, size_t count, float* out)
+    {
+        size_t i = 0;
+#ifdef __AVX__
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 sum = _mm256_mul_ps(_mm256_set1_ps(weights[0]), _mm256_loadu_ps(rows[0] + i));
+            for (int t = 1; t < taps; t++)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[t]), _mm256_loadu_ps(rows[t] + i)));
+            _mm256_storeu_ps(out + i, sum);
+        }
+#endif
+#ifdef MIP_SSE
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 sum = _mm_mul_ps(_mm_set1_ps(weights[0]), _mm_loadu_ps(rows[0] + i));
+            for (int t = 1; t < taps; t++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(rows[t] + i)));
+            _mm_storeu_ps(out + i, sum);
+        }
+#endif
+        for (; i < count; i++)
+        {
+            float sum = weights[0] * rows[0][i];
+            for (int t = 1; t < taps; t++)
+                sum += weights[t] * rows[t][i];
+            out[i] = sum;
+        }
+    }
+
+    // One output row from the vertically filtered source row
+    void horizontalTaps(const float* row, const int* columns, const Kernel& kernel, int width, int channels, float* out)
+    {
+        int x = 0;
+#ifdef MIP_SSE
+        // Four channels fill a register, one texel per load
+        if (channels == 4)
+        {
+            for (; x < width; x++)
+            {
+                const int* taps = &columns[x * kernel.taps];
+                __m128 sum = _mm_mul_ps(_mm_set1_ps(kernel.weights[0]), _mm_loadu_ps(row + taps[0]));
+                for (int t = 1; t < kernel.taps; t++)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(kernel.weights[t]), _mm_loadu_ps(row + taps[t])));
+                _mm_storeu_ps(out + x * 4, sum);
+            }
+        }
+#endif
+        for (; x < width; x++)
+        {
+            const int* taps = &columns[x * kernel.taps];
+            for (int c = 0; c < channels; c++)
+            {
+                float sum = kernel.weights[0] * row[taps[0] + c];
+                for (int t = 1; t < kernel.taps; t++)
+                    sum += kernel.weights[t] * row[taps[t] + c];
+                out[x * channels + c] = sum;
+            }
+        }
+    }
+
+    // Keep filtered values in range, and normals unit length
+    void finishRow(float* texels, int width, int channels, MipContent content)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            float* texel = texels + size_t(x) * channels;
+            int c = 0;
+            if (content == MipNormal && channels >= 3)
+            {
+                float length = sqrtf(texel[0] * texel[0] + texel[1] * texel[1] + texel[2] * texel[2]);
+                float scale = length > 1e-6f ? 1.0f / length : 0.0f;
+                texel[0] *= scale;
+                texel[1] *= scale;
+                texel[2] = length > 1e-6f ? texel[2] * scale : 1.0f;
+                c = 3;
+            }
+            for (; c < channels; c++)
+                texel[c] = std::min(1.0f, std::max(0.0f, texel[c]));
+        }
+    }
+
+    void downsample(const FloatImage& source, FloatImage& target, const Kernel& kernel,
+                    MipContent content, unsigned int threads)
+    {
+        target.width = std::max(1, source.width / 2);
+        target.height = std::max(1, source.height / 2);
+        target.channels = source.channels;
+        target.texels.resize(size_t(target.width) * target.height * target.channels);
+
+        // Source column offsets for every output texel and tap
+        int channels = source.channels;
+        std::vector<int> columns(size_t(target.width) * kernel.taps);
+        for (int x = 0; x < target.width; x++)
+            for (int t = 0; t < kernel.taps; t++)
+                columns[x * kernel.taps + t] = wrap(2 * x + kernel.first + t, source.width) * channels;
+
+        size_t rowFloats = size_t(source.width) * channels;
+        unsigned int rowThreads = target.texels.size() / channels < parallelThreshold ? 1 : threads;
+        parallelFor(target.height, rowThreads, [&](size_t begin, size_t end) {
+            std::vector<float> filtered(rowFloats);
+            const float* rows[maxTaps];
+            for (size_t y = begin; y < end; y++)
+            {
+                for (int t = 0; t < kernel.taps; t++)
+                    rows[t] = &source.texels[wrap(2 * int(y) + kernel.first + t, source.height) * rowFloats];
+                verticalTaps(rows, kernel.weights, kernel.taps, rowFloats, filtered.data());
+
+                float* out = &target.texels[y * target.width * channels];
+                horizontalTaps(filtered.data(), columns.data(), kernel, target.width, channels, out);
+                finishRow(out, target.width, channels, content);
+            }
+        });
+    }
+
+    // Tent filtered resampling along one axis, as wide as the scale when
+    // shrinking so every source texel counts, bilinear when growing
+    void resampleAxis(const FloatImage& source, FloatImage& target, int size, bool horizontal)
+    {
+        int sourceSize = horizontal ? source.width : source.height;
+        target.width = horizontal ? size : source.width;
+        target.height = horizontal ? source.height : size;
+        target.channels = source.channels;
+        target.texels.assign(size_t(target.width) * target.height * target.channels, 0.0f);
+
+        float scale = float(sourceSize) / size;
+        float support = std::max(1.0f, scale);
+        int channels = source.channels;
+        int lines = horizontal ? source.height : source.width;
+        std::vector<float> weights;
+        for (int o = 0; o < size; o++)
+        {
+            float centre = (o + 0.5f) * scale - 0.5f;
+            int first = static_cast<int>(floorf(centre - support)) + 1;
+            int last = static_cast<int>(floorf(centre + support));
+            weights.clear();
+            float sum = 0.0f;
+            for (int i = first; i <= last; i++)
+            {
+                weights.push_back(std::max(0.0f, 1.0f - fabsf(i - centre) / support));
+                sum += weights.back();
+            }
+
+            for (int line = 0; line < lines; line++)
+            {
+                float* out = horizontal ? &target.texels[(size_t(line) * size + o) * channels] :
+                                          &target.texels[(size_t(o) * target.width + line) * channels];
+                for (int i = first; i <= last; i++)
+                {
+                    int at = wrap(i, sourceSize);
+                    const float* in = horizontal ? &source.texels[(size_t(line) * source.width + at) * channels] :
+                                                   &source.texels[(size_t(at) * source.width + line) * channels];
+                    float weight = weights[i - first] / sum;
+                    for (int c = 0; c < channels; c++)
+                        out[c] += weight * in[c];
+                }
+            }
+        }
+    }
+}
+
+int MipGenerator::levelCount(int width, int height)
+{
+    int levels = 1;
+    while (width > 1 || height > 1)
+    {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        levels++;
+    }
+    return levels;
+}
+
+void MipGenerator::build(const ImageData& image, std::vector<ImageData>& levels, const MipOptions& options)
+{
+    levels.clear();
+    if (image.width <= 0 || image.height <= 0 || image.channels <= 0)
+        return;
+
+    // Two channel normal maps carry no z to renormalise
+    MipContent content = options.content;
+    if (content == MipNormal && image.channels < 3)
+        content = MipLinear;
+
+    unsigned int threads = options.threads;
+    Kernel kernel = makeKernel(options.filter);
+
+    levels.resize(levelCount(image.width, image.height));
+    levels[0] = image;
+
+    // Each level filters the float copy of the one above, so rounding
+    // doesn't build up down the chain
+    FloatImage current, next;
+    toFloat(image, content, current);
+    for (size_t i = 1; i < levels.size(); i++)
+    {
+        downsample(current, next, kernel, content, threads);
+        toBytes(next, content, levels[i]);
+        std::swap(current, next);
+    }
+}
+
+void MipGenerator::resize(const ImageData& image, int width, int height, ImageData& out, MipContent content)
+{
+    if (content == MipNormal && image.channels < 3)
+        content = MipLinear;
+
+    // In float and linear light like the levels, one axis at a time
+    FloatImage source, across, resized;
+    toFloat(image, content, source);
+    resampleAxis(source, across, width, true);
+    resampleAxis(across, resized, height, false);
+    for (int y = 0; y < height; y++)
+        finishRow(&resized.texels[size_t(y) * width * resized.channels], width, resized.channels, content);
+    toBytes(resized, content, out);
+}
+
+MipContent MipGenerator::contentFor(const char* path)
+{
+    std::string name(path);
+    size_t slash = name.find_last_of("/\\");
+    if (slash != std::string::npos)
+        name.erase(0, slash + 1);
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return static_cast<char>(tolower(c)); });
+
+    if (name.find("normal") != std::string::npos)
+        return MipNormal;
+    const char* data[] = { "spec", "rough", "metal", "height", "_ao", "mask" };
+    for (const char* word : data)
+    {
+        if (name.find(word) != std::string::npos)
+            return MipLinear;
+    }
+    return MipColour;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "image.hpp"
+
+enum MipFilter
+{
+    MipBox,         // 2x2 average, fastest
+    MipKaiser,      // Kaiser windowed sinc, sharp with little ringing
+    MipLanczos      // Lanczos-3, sharpest
+};
+
+enum MipContent
+{
+    MipColour,      // sRGB encoded colour, averaged in linear light; alpha is linear
+    MipLinear,      // data such as specular or height, averaged as stored
+    MipNormal       // tangent space normals, renormalised on every level
+};
+
+struct MipOptions
+{
+    MipFilter filter = MipKaiser;
+    MipContent content = MipColour;
+
+    // threads = 0 uses every core
+    unsigned int threads = 0;
+};
+
+// CPU mip chains, so mipmapping is deterministic and off the GL thread.
+// Levels are filtered in float from the level above (separable 2:1 kernels,
+// repeating at the edges like the sampler), split across threads by rows.
+class MipGenerator
+{
+public:
+    // full chain down to 1x1, level 0 is a copy of image
+    static void build(const ImageData& image, std::vector<ImageData>& levels,
+                      const MipOptions& options = MipOptions());
+
+    // resample image to width x height with a tent filter, treating the
+    // texels as content does
+    static void resize(const ImageData& image, int width, int height, ImageData& out,
+                       MipContent content = MipColour);
+
+    // number of levels in a full chain for the size
+    static int levelCount(int width, int height);
+
+    // guess the content from a file name: "normal" means normals, "spec",
+    // "rough", "metal", "height", "ao" or "mask" mean data, anything else colour
+    static MipContent contentFor(const char* path);
+};
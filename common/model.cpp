@@ -2,72 +2,330 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
+#include <cstddef>
 #include <iostream>
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
 #include "model.hpp"
-#include "stb_image.hpp"
+#include "objparser.hpp"
+#include "meshindexer.hpp"
+#include "meshcache.hpp"
+#include "meshoptimiser.hpp"
+#include "meshsimplifier.hpp"
+#include "meshlets.hpp"
+#include "tangentgenerator.hpp"
+#include "assetloader.hpp"
+#include "materiallibrary.hpp"
+#include "textureresidency.hpp"
 
-Model::Model(const char *path)
+Model::Model(const ModelOptions& options)
+    : options(options)
 {
+}
+
+Model::Model(const char *path, const ModelOptions& options)
+    : options(options)
+{
+    if (!load(path))
+        getchar();
+    upload();
+}
+
+bool Model::load(const char *path)
+{
+    // Warm start, upload straight from the mapped cache without parsing
+    if (MeshCache::load(path, cacheFile, pending, static_cast<uint32_t>(options.lodLevels), options.compactVertices))
+    {
+        printf("Loading cached mesh %s\n", MeshCache::cachePath(path).c_str());
+        boundsMin = pending.boundsMin;
+        boundsMax = pending.boundsMax;
+        lods.assign(pending.lods, pending.lods + pending.lodCount);
+        if (lods.empty())
+            lods.push_back({ 0, static_cast<uint32_t>(pending.indexCount), 0.0f, 0, 0 });
+        meshlets.assign(pending.meshlets, pending.meshlets + pending.meshletCount);
+        positionScale = pending.positionScale;
+        positionOffset = pending.positionOffset;
+        return true;
+    }
+    
     // Load object
-    bool res = loadObj(path, vertices, uvs, normals);
+    bool res = loadObj(path, vertices, uvs, normals, indices);
+    
+    // Tangent frames for normal mapping, the bitangent kept only as the
+    // sign in w the shader rebuilds it from; baked into the cache with the rest
+    if (res)
+    {
+        std::vector<glm::vec3> directions;
+        std::vector<glm::vec3> bitangents;
+        TangentGenerator::generate(indices, vertices, uvs, normals, directions, bitangents);
+        tangents.resize(directions.size());
+        for (size_t i = 0; i < directions.size(); i++)
+            tangents[i] = glm::vec4(directions[i],
+                TangentGenerator::handedness(normals[i], directions[i], bitangents[i]));
+    }
+    
+    // Tune the triangle and vertex order for the GPU
+    if (res)
+        optimiseMesh();
+    
+    // Simplified versions for distant objects
+    buildLods();
+    
+    // Clusters of every level for culling, each level's after the last
+    meshlets.clear();
+    std::vector<Meshlet> levelMeshlets;
+    for (MeshLod& lod : lods)
+    {
+        MeshletBuilder::build(indices, lod.indexOffset, lod.indexCount,
+                              vertices.data(), vertices.size(), levelMeshlets);
+        lod.meshletOffset = static_cast<uint32_t>(meshlets.size());
+        lod.meshletCount = static_cast<uint32_t>(levelMeshlets.size());
+        meshlets.insert(meshlets.end(), levelMeshlets.begin(), levelMeshlets.end());
+    }
+    printf("Meshlets: %zu over %zu levels\n", meshlets.size(), lods.size());
     
+    // Bake the final streams for the next start-up, quantised first for
+    // the compact layout
+    pending = meshView(shortIndices);
+    if (res && options.compactVertices)
+        quantiseStreams();
+    if (res)
+        MeshCache::write(path, pending, static_cast<uint32_t>(options.lodLevels));
+    positionScale = pending.positionScale;
+    positionOffset = pending.positionOffset;
+    return res;
+}
+
+void Model::upload()
+{
     // Setup buffers
-    setupBuffers();
+    uploadedBytes = uploadBytes();
+    setupBuffers(pending);
+    
+    // Staging data is no longer needed once GL has its copy
+    pending = MeshView();
+    cacheFile.close();
+    std::vector<unsigned short>().swap(shortIndices);
+    std::vector<CompactVertex>().swap(compactVertices);
 }
 
-void Model::draw(unsigned int shaderID)
+size_t Model::uploadBytes() const
+{
+    size_t indexBytes = pending.indexCount * (pending.shortIndices ? sizeof(unsigned short) : sizeof(unsigned int));
+    if (pending.compact)
+        return indexBytes + pending.vertexCount * sizeof(CompactVertex);
+    return indexBytes + pending.vertexCount * (2 * sizeof(glm::vec3) + sizeof(glm::vec2)) +
+           (pending.tangents ? pending.vertexCount * sizeof(glm::vec4) : 0);
+}
+
+void Model::bindMaterial(const ShaderProgram& shader)
 {
     // Send material properties to the shader
-    glUniform1f(glGetUniformLocation(shaderID, "ka"), ka);
-    glUniform1f(glGetUniformLocation(shaderID, "kd"), kd);
-    glUniform1f(glGetUniformLocation(shaderID, "ks"), ks);
-    glUniform1f(glGetUniformLocation(shaderID, "Ns"), Ns);
-    
-    // Bind the textures
-    unsigned int diffuseNum = 0;
-    unsigned int normalNum = 0;
-    for (unsigned int i = 0; i < textures.size(); i++)
+    shader.set(UniformKa, ka);
+    shader.set(UniformKd, kd);
+    shader.set(UniformKs, ks);
+    shader.set(UniformNs, Ns);
+    
+    // Bind the textures; an array material only binds when its page changes
+    if (material)
+        material->bind();
+    for (unsigned int i = 0; !material && i < textures.size(); i++)
     {
         // Bind texture
-        std::string name = textures[i].type;
         glActiveTexture(GL_TEXTURE0 + i);
-        glUniform1i(glGetUniformLocation(shaderID, (name + "Map").c_str()), i);
-        glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        if (textures[i].sampler != UniformCount)
+            shader.set(textures[i].sampler, static_cast<int>(i));
+        glBindTexture(GL_TEXTURE_2D, textures[i].handle ? textures[i].handle->id : textures[i].id);
     }
     
+    // Position decode, identity unless the vertices are compact
+    shader.set(UniformPositionScale, positionScale);
+    shader.set(UniformPositionOffset, positionOffset);
+}
+
+void LodStats::add(int lod, size_t drawnTriangles)
+{
+    if (lod < 0)
+        return;
+    if (static_cast<size_t>(lod) >= draws.size())
+    {
+        draws.resize(lod + 1, 0);
+        triangles.resize(lod + 1, 0);
+    }
+    draws[lod]++;
+    triangles[lod] += drawnTriangles;
+}
+
+void LodStats::clear()
+{
+    draws.clear();
+    triangles.clear();
+}
+
+void Model::draw(const ShaderProgram& shader, int lod)
+{
+    lastTriangles = 0;
+    if (VAO == 0)
+        return;
+    bindMaterial(shader);
+    
     // Draw the triangles
+    lod = glm::clamp(lod, 0, static_cast<int>(lods.size()) - 1);
+    lastTriangles = lods[lod].indexCount / 3;
+    size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+    glBindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, lods[lod].indexCount, indexType, (void*)(lods[lod].indexOffset * indexSize));
+    glBindVertexArray(0);
+}
+
+size_t Model::drawCulled(const ShaderProgram& shader, const glm::mat4& model,
+                          const glm::mat4& viewProjection, const glm::vec3& eye, int lod)
+{
+    if (options.residency)
+        options.residency->use(*this, model, eye);
+    lastTriangles = 0;
+    if (VAO == 0)
+        return 0;
+    lod = glm::clamp(lod, 0, static_cast<int>(lods.size()) - 1);
+    const MeshLod& level = lods[lod];
+    if (level.meshletCount == 0)
+    {
+        draw(shader, lod);
+        return 0;
+    }
+    
+    // Cull the level's meshlets in object space
+    Frustum frustum = Frustum::fromMatrix(viewProjection * model);
+    glm::vec3 objectEye = glm::vec3(glm::inverse(model) * glm::vec4(eye, 1.0f));
+    size_t visible = MeshletBuilder::cull(meshlets.data() + level.meshletOffset, level.meshletCount, frustum,
+                                          objectEye, drawOffsets, drawCounts);
+    if (drawCounts.empty())
+        return 0;
+    
+    // One multi-draw over the surviving ranges
+    size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+    drawPointers.resize(drawOffsets.size());
+    drawSizes.resize(drawCounts.size());
+    for (size_t i = 0; i < drawOffsets.size(); i++)
+    {
+        drawPointers[i] = (const void*)(drawOffsets[i] * indexSize);
+        drawSizes[i] = static_cast<GLsizei>(drawCounts[i]);
+        lastTriangles += drawCounts[i] / 3;
+    }
+    
+    bindMaterial(shader);
     glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLES, 0, static_cast<unsigned int>(vertices.size()));
+    glMultiDrawElements(GL_TRIANGLES, drawSizes.data(), indexType, drawPointers.data(),
+                        static_cast<GLsizei>(drawSizes.size()));
     glBindVertexArray(0);
+    return visible;
 }
 
-void Model::setupBuffers()
+int Model::selectLod(const glm::mat4& model, const glm::vec3& eye, float fovY,
+                     float screenHeight, float pixelThreshold) const
+{
+    // Distance from the eye to the nearest point of the bounding sphere
+    glm::vec3 centre = glm::vec3(model * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+    float scale = glm::max(glm::length(glm::vec3(model[0])),
+                  glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    float radius = glm::length(boundsMax - boundsMin) * 0.5f * scale;
+    float distance = glm::distance(eye, centre) - radius;
+    
+    int lod = 0;
+    for (int i = 1; i < static_cast<int>(lods.size()); i++)
+    {
+        if (MeshSimplifier::projectedError(lods[i].error, scale, distance, fovY, screenHeight) > pixelThreshold)
+            break;
+        lod = i;
+    }
+    return lod;
+}
+
+int Model::drawLod(const ShaderProgram& shader, const glm::mat4& model, const glm::mat4& viewProjection,
+                   const glm::vec3& eye, float fovY, float screenHeight, LodStats* stats)
+{
+    int lod = selectLod(model, eye, fovY, screenHeight);
+    drawCulled(shader, model, viewProjection, eye, lod);
+    if (stats)
+        stats->add(lod, lastTriangles);
+    return lod;
+}
+
+MeshView Model::meshView(std::vector<unsigned short>& shortIndices)
+{
+    MeshView mesh;
+    mesh.positions = vertices.data();
+    mesh.uvs = uvs.data();
+    mesh.normals = normals.data();
+    mesh.tangents = tangents.empty() ? nullptr : tangents.data();
+    mesh.vertexCount = vertices.size();
+    mesh.indexCount = indices.size();
+    mesh.lods = lods.data();
+    mesh.lodCount = lods.size();
+    mesh.meshlets = meshlets.empty() ? nullptr : meshlets.data();
+    mesh.meshletCount = meshlets.size();
+    mesh.boundsMin = boundsMin;
+    mesh.boundsMax = boundsMax;
+    
+    // 16-bit indices halve the index buffer on small meshes
+    mesh.shortIndices = MeshIndexer::fitsShortIndices(vertices.size());
+    if (mesh.shortIndices)
+    {
+        shortIndices.assign(indices.begin(), indices.end());
+        mesh.indices = shortIndices.data();
+    }
+    else
+    {
+        mesh.indices = indices.data();
+    }
+    return mesh;
+}
+
+void Model::setupBuffers(const MeshView& mesh)
 {
     // Create and bind the Vertex Array Object (VAO)
     glGenVertexArrays(1, &VAO);
     glBindVertexArray(VAO);
     
+    // Create index buffer
+    glGenBuffers(1, &indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    indexCount = static_cast<unsigned int>(mesh.indexCount);
+    indexType = mesh.shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    size_t indexSize = mesh.shortIndices ? sizeof(unsigned short) : sizeof(unsigned int);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indexCount * indexSize, mesh.indices, GL_STATIC_DRAW);
+    
+    // Vertex streams
+    uvBuffer = normalBuffer = tangentBuffer = 0;
+    if (mesh.compact)
+        setupCompactBuffers(mesh);
+    else
+        setupFloatBuffers(mesh);
+    
+     // Unbind the VAO
+    glBindVertexArray(0);
+}
+
+void Model::setupFloatBuffers(const MeshView& mesh)
+{
+    size_t vec3Bytes = mesh.vertexCount * sizeof(glm::vec3);
+    
     // Create Vertex Buffer Object
-    unsigned int vertexBuffer;
     glGenBuffers(1, &vertexBuffer);
     glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vec3Bytes, mesh.positions, GL_STATIC_DRAW);
     
     // Create uv buffer
-    unsigned int uvBuffer;
     glGenBuffers(1, &uvBuffer);
     glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
-    glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), &uvs[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh.vertexCount * sizeof(glm::vec2), mesh.uvs, GL_STATIC_DRAW);
     
     // Create normal buffer
-    unsigned int normalBuffer;
     glGenBuffers(1, &normalBuffer);
     glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), &normals[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vec3Bytes, mesh.normals, GL_STATIC_DRAW);
     
     // Bind the vertex buffer
     glEnableVertexAttribArray(0);
@@ -75,39 +333,64 @@ void Model::setupBuffers()
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
     
     // Bind the uv buffer
-    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
     glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
     
     // Bind the normal buffer
-    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
     glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
 
-    // Create tangent buffer
-    GLuint tangentBuffer; 
+    // Create tangent buffer, straight from the cache when it is mapped
+    if (!mesh.tangents)
+        return;
     glGenBuffers(1, &tangentBuffer); 
     glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer); 
-    glBufferData(GL_ARRAY_BUFFER, tangents.size() * sizeof(glm::vec3), &tangents[0], GL_STATIC_DRAW); 
-
-    // Create bitangent buffer
-    GLuint bitangentBuffer;
-    glGenBuffers(1, &bitangentBuffer); 
-    glBindBuffer(GL_ARRAY_BUFFER, bitangentBuffer); 
-    glBufferData(GL_ARRAY_BUFFER, bitangents.size() * sizeof(glm::vec3), &bitangents[0], GL_STATIC_DRAW); 
+    glBufferData(GL_ARRAY_BUFFER, mesh.vertexCount * sizeof(glm::vec4), mesh.tangents, GL_STATIC_DRAW); 
 
     // Bind the tangent buffer
-    glEnableVertexAttribArray(3); 
+    glEnableVertexAttribArray(4); 
     glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer); 
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, (void*)0); 
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 0, (void*)0); 
+}
 
-    // Bind the bitangent buffer
-    glEnableVertexAttribArray(4); 
-    glBindBuffer(GL_ARRAY_BUFFER, bitangentBuffer); 
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 0, (void*)0); 
+void Model::quantiseStreams()
+{
+    // Quantise once, at bake time, and report what it cost
+    VertexQuantiser::encode(pending, compactVertices, pending.positionScale, pending.positionOffset);
+    QuantisationError error = VertexQuantiser::measure(pending, compactVertices, pending.positionScale,
+                                                       pending.positionOffset);
+    size_t floatBytes = pending.vertexCount * (2 * sizeof(glm::vec3) + sizeof(glm::vec4) + sizeof(glm::vec2));
+    printf("Compact vertices %.1f KB -> %.1f KB; position error max %g rms %g, "
+           "normal %.3f deg, tangent %.3f deg, uv %g\n",
+           floatBytes / 1024.0, compactVertices.size() * sizeof(CompactVertex) / 1024.0,
+           error.maxPosition, error.rmsPosition, error.maxNormalDegrees, error.maxTangentDegrees, error.maxUV);
     
-     // Unbind the VAO
-    glBindVertexArray(0);
+    // Only the compact vertices are cached and uploaded
+    pending.compact = compactVertices.data();
+    pending.positions = nullptr;
+    pending.uvs = nullptr;
+    pending.normals = nullptr;
+    pending.tangents = nullptr;
+}
+
+void Model::setupCompactBuffers(const MeshView& mesh)
+{
+    // One interleaved buffer, straight from the cache when it is mapped
+    glGenBuffers(1, &vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, mesh.vertexCount * sizeof(CompactVertex), mesh.compact, GL_STATIC_DRAW);
+    
+    GLsizei stride = sizeof(CompactVertex);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(CompactVertex, position));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(CompactVertex, uv));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(CompactVertex, normal));
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(CompactVertex, tangent));
 }
 
 void Model::deleteBuffers()
@@ -115,190 +398,116 @@ void Model::deleteBuffers()
     glDeleteBuffers(1, &vertexBuffer);
     glDeleteBuffers(1, &uvBuffer);
     glDeleteBuffers(1, &normalBuffer);
+    glDeleteBuffers(1, &tangentBuffer);
+    glDeleteBuffers(1, &indexBuffer);
     glDeleteVertexArrays(1, &VAO);
 }
 
 bool Model::loadObj(const char *path,
                     std::vector<glm::vec3> &outVertices,
                     std::vector<glm::vec2> &outUVs,
-                    std::vector<glm::vec3> &outNormals)
+                    std::vector<glm::vec3> &outNormals,
+                    std::vector<unsigned int> &outIndices)
 {
     
     printf("Loading file %s\n", path);
     
-    std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-    std::vector<glm::vec3> tempVertices;
-    std::vector<glm::vec2> tempUVs;
-    std::vector<glm::vec3> tempNormals;
-    
-    FILE *file = fopen(path, "r");
-    if (file==NULL)
-    {
-        printf("Impossible to open the file. Check paths and directories.");
-        getchar();
+    // Parse the mapped file, large files are split across every core
+    ObjData obj;
+    if (!ObjParser::parseFile(path, obj, 0))
         return false;
-    }
     
-    while (true)
+    // Weld corners that share position, uv and normal into one vertex,
+    // each vertex uploads a position, uv, normal and tangent
+    const size_t vertexStride = 2 * sizeof(glm::vec3) + sizeof(glm::vec4) + sizeof(glm::vec2);
+    IndexStats stats = MeshIndexer::build(obj, outVertices, outUVs, outNormals, outIndices, vertexStride);
+    printf("Indexed %zu corners into %zu vertices (%.1f%% unique), %.1f KB saved\n",
+           stats.corners, stats.uniqueVertices, 100.0f * stats.uniqueRatio(),
+           (static_cast<double>(stats.bytesBefore) - static_cast<double>(stats.bytesAfter)) / 1024.0);
+    
+    // Bounding box
+    boundsMin = glm::vec3(0.0f);
+    boundsMax = glm::vec3(0.0f);
+    if (!outVertices.empty())
     {
-        // Read the first word of the line
-        char lineHeader[128];
-        int res = fscanf(file, "%s", lineHeader);
-        if (res == EOF)
-        {
-            // If end of file reached exit the loop
-            break;
-        }
-        
-        if (strcmp(lineHeader, "v") == 0)
-        {
-            // Read vertices
-            glm::vec3 vertex;
-            fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
-            tempVertices.push_back(vertex);
-        }
-        else if (strcmp(lineHeader, "vt") == 0)
+        boundsMin = boundsMax = outVertices[0];
+        for (const glm::vec3& vertex : outVertices)
         {
-            // Read texture co-ordinates
-            glm::vec2 uv;
-            fscanf(file, "%f %f\n", &uv.x, &uv.y);
-            tempUVs.push_back(uv);
-        }
-        else if (strcmp(lineHeader, "vn") == 0)
-        {
-            // Read vertex normals
-            glm::vec3 normal;
-            fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z);
-            tempNormals.push_back(normal);
-        }
-        else if (strcmp(lineHeader, "f") == 0)
-        {
-            // Read vertex indices
-            std::string vertex1, vertex2, vertex3;
-            unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-            int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n",
-                                 &vertexIndex[0], &uvIndex[0], &normalIndex[0],
-                                 &vertexIndex[1], &uvIndex[1], &normalIndex[1],
-                                 &vertexIndex[2], &uvIndex[2], &normalIndex[2]);
-            
-            // Check for error
-            if (matches != 9)
-            {
-                printf("File can't be read by loadObj().\n");
-                fclose(file);
-                return false;
-            }
-            vertexIndices.push_back(vertexIndex[0]);
-            vertexIndices.push_back(vertexIndex[1]);
-            vertexIndices.push_back(vertexIndex[2]);
-            uvIndices    .push_back(uvIndex[0]);
-            uvIndices    .push_back(uvIndex[1]);
-            uvIndices    .push_back(uvIndex[2]);
-            normalIndices.push_back(normalIndex[0]);
-            normalIndices.push_back(normalIndex[1]);
-            normalIndices.push_back(normalIndex[2]);
-        }
-        else
-        {
-            // Remove comment line
-            char commentBuffer[1000];
-            fgets(commentBuffer, 1000, file);
+            boundsMin = glm::min(boundsMin, vertex);
+            boundsMax = glm::max(boundsMax, vertex);
         }
     }
     
-    // For each vertex of the triangle
-    for (unsigned int i = 0; i < vertexIndices.size(); i++)
+    return true;
+}
+
+void Model::optimiseMesh()
+{
+    MeshAnalysis before;
+    if (options.meshStats)
+        before = MeshOptimiser::analyse(indices, vertices);
+    
+    // Triangle order for the post-transform cache, then for overdraw
+    MeshOptimiser::optimiseVertexCache(indices, vertices.size());
+    MeshOptimiser::optimiseOverdraw(indices, vertices);
+    
+    // Vertex order for fetch locality
+    size_t vertexCount;
+    std::vector<unsigned int> remap = MeshOptimiser::optimiseVertexFetch(indices, vertices.size(), vertexCount);
+    MeshOptimiser::remapStream(vertices, remap, vertexCount);
+    MeshOptimiser::remapStream(uvs, remap, vertexCount);
+    MeshOptimiser::remapStream(normals, remap, vertexCount);
+    MeshOptimiser::remapStream(tangents, remap, vertexCount);
+    
+    if (options.meshStats)
     {
-        // Get the indices of its attributes
-        unsigned int vertexIndex = vertexIndices[i];
-        unsigned int uvIndex = uvIndices[i];
-        unsigned int normalIndex = normalIndices[i];
-        
-        // Get the attributes
-        glm::vec3 vertex = tempVertices[vertexIndex - 1];
-        glm::vec2 uv = tempUVs[uvIndex - 1];
-        glm::vec3 normal = tempNormals[normalIndex - 1];
-        
-        // Copy the attributes to the buffers
-        outVertices.push_back(vertex);
-        outUVs.push_back(uv);
-        outNormals.push_back(normal);
+        MeshAnalysis after = MeshOptimiser::analyse(indices, vertices);
+        printf("ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f\n",
+               before.acmr, after.acmr, before.atvr, after.atvr, before.overdraw, after.overdraw);
     }
+}
+
+void Model::buildLods()
+{
+    std::vector<unsigned int> chain;
+    MeshSimplifier::buildLodChain(indices, vertices.data(), normals.empty() ? nullptr : normals.data(),
+                                  uvs.empty() ? nullptr : uvs.data(), vertices.size(), options.lodLevels, chain, lods);
+    indices.swap(chain);
     
-    // Close .obj file
-    fclose(file);
-    
-    return true;
+    for (size_t i = 0; i < lods.size(); i++)
+        printf("LOD %zu: %u triangles, error %g\n", i, lods[i].indexCount / 3, lods[i].error);
 }
 
-void Model::addTexture(const char *path, const std::string type)
+void Model::addTexture(unsigned int id, const std::string type)
 {
     Texture texture;
-    texture.id = loadTexture(path);
+    texture.id = id;
     texture.type = type;
+    texture.sampler = samplerUniform(type);
     textures.push_back(texture);
 }
 
-unsigned int Model::loadTexture(const char *path)
+void Model::addTexture(const std::shared_ptr<TextureHandle>& handle, const std::string type)
 {
-
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, numComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &numComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (numComponents == 1)
-            format = GL_RED;
-        else if (numComponents == 3)
-            format = GL_RGB;
-        else if (numComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture " << path << " failed to load." << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    Texture texture;
+    texture.id = 0;
+    texture.type = type;
+    texture.sampler = samplerUniform(type);
+    texture.handle = handle;
+    textures.push_back(texture);
 }
 
-void Model::calculateTangents() 
+ShaderUniform Model::samplerUniform(const std::string& type)
 {
-    for (unsigned int i = 0; i < vertices.size(); i += 3)
-    {
-        // edge vectors and deltas
-        glm::vec3 E1 = vertices[i + 1] - vertices[i];
-        glm::vec3 E2 = vertices[i + 2] - vertices[i + 1];
-        float deltaU1 = uvs[i + 1].x - uvs[i].x;
-        float deltaV1 = uvs[i + 1].y - uvs[i].y;
-        float deltaU2 = uvs[i + 2].x - uvs[i + 1].x;
-        float deltaV2 = uvs[i + 2].y - uvs[i + 1].y;
-
-        // tangents
-        float denom = 1.0f / (deltaU1 * deltaV2 - deltaU2 * deltaV1);
-        glm::vec3 tangent = (deltaV2 * E1 - deltaV1 * E2) * denom;
-        glm::vec3 bitangent = (deltaU1 * E2 - deltaU2 * E1) * denom;
-
-        // set the same tangents for the triangle
-        tangents.push_back(tangent);
-        tangents.push_back(tangent);
-        tangents.push_back(tangent);
-        bitangents.push_back(bitangent);
-        bitangents.push_back(bitangent);
-        bitangents.push_back(bitangent);
-    }
+    // Resolved once here so binding builds no names
+    if (type == "texture")
+        return UniformTextureMap;
+    if (type == "diffuse")
+        return UniformDiffuseMap;
+    if (type == "normal")
+        return UniformNormalMap;
+    if (type == "specular")
+        return UniformSpecularMap;
+    printf("No %sMap uniform, the texture is bound without one\n", type.c_str());
+    return UniformCount;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <stdio.h>
 #include <string>
@@ -7,61 +8,188 @@
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
+#include "meshcache.hpp"
+#include "mappedfile.hpp"
+#include "vertexquantiser.hpp"
+#include "shaderprogram.hpp"
+
+class TextureResidency;
+
+// Load-time choices for a Model
+struct ModelOptions
+{
+    // interleaved 20-byte vertices (16-bit positions, 10_10_10_2 normals and
+    // tangents, half float uvs) decoded in the vertex shader
+    bool compactVertices = false;
+
+    // levels of detail to generate, 1 keeps only the full mesh
+    int lodLevels = 4;
+
+    // print ACMR, ATVR and overdraw before and after optimising a mesh that
+    // isn't cached; the overdraw figure rasterises it from six directions
+    bool meshStats = false;
+
+    // hears from drawCulled() how close the model's textures are, for
+    // those it manages; must outlive the model
+    TextureResidency* residency = nullptr;
+};
+
+// Draws and triangles each level of detail took, over however many
+// drawLod() calls and frames it was passed to
+struct LodStats
+{
+    std::vector<size_t> draws;
+    std::vector<size_t> triangles;   // sent after meshlet culling
+
+    void add(int lod, size_t drawnTriangles);
+    void clear();
+};
+
+class TextureHandle;
+class MaterialHandle;
+
 struct Texture
 {
     unsigned int id;
     std::string type;
+    ShaderUniform sampler;                   // type + "Map", UniformCount if the engine has no such map
+    std::shared_ptr<TextureHandle> handle;   // shared texture, id read at bind time
 };
 
 class Model
 {
 public:
-    // attributes
+    // attributes (left empty when the mesh comes from its .cgmesh cache)
     std::vector<glm::vec3> vertices;
     std::vector<glm::vec2> uvs;
     std::vector<glm::vec3> normals;
-    std::vector<glm::vec3> tangents;
-    std::vector<glm::vec3> bitangents;
+    std::vector<glm::vec4> tangents;   // bitangent sign in w
+    std::vector<unsigned int> indices;
+    std::vector<MeshLod>   lods;
+    std::vector<Meshlet>   meshlets;
     std::vector<Texture>   textures;
+    std::shared_ptr<MaterialHandle> material;   // texture array layer, used instead of textures when set
     unsigned int textureID;
     float ka, kd, ks, Ns;
 
-    Model(const char* path);
+    // object space bounding box
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+
+    // empty model, filled in later by load() and upload()
+    explicit Model(const ModelOptions& options = ModelOptions());
+
+    // load and upload in one go on the GL thread
+    Model(const char* path, const ModelOptions& options = ModelOptions());
+
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
+    // CPU half of loading: parse or map the cache and stage the GPU streams,
+    // touches no GL state so it can run on a worker thread
+    bool load(const char* path);
+
+    // GL half: create the buffers from the staged streams and free them
+    void upload();
+
+    // bytes upload() will send to the GPU
+    size_t uploadBytes() const;
+
+    // bytes the last upload() sent
+    size_t gpuBytes() const { return uploadedBytes; }
 
     // draw model
-    void draw(unsigned int shaderID);
+    void draw(const ShaderProgram& shader, int lod = 0);
+
+    // draw a level, skipping its meshlets outside the frustum or facing
+    // away from the eye; returns the number of meshlets drawn
+    size_t drawCulled(const ShaderProgram& shader, const glm::mat4& model,
+                      const glm::mat4& viewProjection, const glm::vec3& eye, int lod = 0);
+
+    // coarsest level whose error stays under pixelThreshold on screen
+    int selectLod(const glm::mat4& model, const glm::vec3& eye, float fovY,
+                  float screenHeight, float pixelThreshold = 1.0f) const;
+
+    // draw one object: selectLod() picks the level for this view and
+    // drawCulled() draws it, counted into stats when given; returns the level
+    int drawLod(const ShaderProgram& shader, const glm::mat4& model, const glm::mat4& viewProjection,
+                const glm::vec3& eye, float fovY, float screenHeight, LodStats* stats = nullptr);
+
+    // triangles the last draw sent
+    size_t drawnTriangles() const { return lastTriangles; }
 
-    // textures
-    void addTexture(const char* path, const std::string type);
+    // textures; shared ones come from ResourceManager::texture(), which
+    // loads each file once
+    void addTexture(unsigned int id, const std::string type);
+    void addTexture(const std::shared_ptr<TextureHandle>& handle, const std::string type);
 
     // clean it
     void deleteBuffers();
 
 private:
+    ModelOptions options;
+
+    // compact positions decode as positionOffset + positionScale * stored
+    glm::vec3 positionScale;
+    glm::vec3 positionOffset;
+
     // buffers
-    unsigned int VAO;
-    unsigned int vertexBuffer;
-    unsigned int uvBuffer;
-    unsigned int normalBuffer;
+    unsigned int VAO = 0;
+    unsigned int vertexBuffer = 0;
+    unsigned int uvBuffer = 0;
+    unsigned int normalBuffer = 0;
+    unsigned int indexBuffer = 0;
+
+    // index format picked at upload, 16-bit when the vertices allow it
+    GLenum indexType = GL_UNSIGNED_INT;
+    unsigned int indexCount = 0;
+    size_t uploadedBytes = 0;
+    size_t lastTriangles = 0;
+
+    // streams staged by load() for upload(), pending may point into cacheFile
+    MeshView pending;
+    MappedFile cacheFile;
+    std::vector<unsigned short> shortIndices;
+    std::vector<CompactVertex> compactVertices;
+
+    // visible index ranges, reused every frame
+    std::vector<uint32_t> drawOffsets;
+    std::vector<uint32_t> drawCounts;
+    std::vector<const void*> drawPointers;
+    std::vector<GLsizei> drawSizes;
 
     // load .obj file method
     bool loadObj(const char* path,
         std::vector<glm::vec3>& inVertices,
         std::vector<glm::vec2>& inUVs,
-        std::vector<glm::vec3>& inNormals);
+        std::vector<glm::vec3>& inNormals,
+        std::vector<unsigned int>& inIndices);
+
+    // reorder triangles and vertices for the post-transform cache, overdraw and fetch
+    void optimiseMesh();
+
+    // append simplified levels of detail to indices
+    void buildLods();
+
+    // material uniforms, textures and position decode
+    void bindMaterial(const ShaderProgram& shader);
+
+    // replace the staged float streams with compact vertices
+    void quantiseStreams();
+
+    // streams of the loaded vectors, indices narrowed into shortIndices if they fit
+    MeshView meshView(std::vector<unsigned short>& shortIndices);
 
     // setup buffers
-    void setupBuffers();
+    void setupBuffers(const MeshView& mesh);
+    void setupFloatBuffers(const MeshView& mesh);
+    void setupCompactBuffers(const MeshView& mesh);
 
-    // load texture
-    unsigned int loadTexture(const char* path);
+    // sampler uniform a texture of this type binds to
+    static ShaderUniform samplerUniform(const std::string& type);
 
     // tangent space
-    unsigned int tangentBuffer;  
-    unsigned int bitangentBuffer; 
-
-    // calculate tangent and bitangent vectors
-    void calculateTangents();
+    unsigned int tangentBuffer = 0;  
 
 };
 
@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <string.h>
+#include <charconv>
+#include <algorithm>
+#include <thread>
+#include <functional>
+
+#include "objparser.hpp"
+#include "mappedfile.hpp"
+
+namespace
+{
+    // Record counts gathered before parsing so every vector allocates once
+    struct ObjCounts
+    {
+        size_t positions = 0;
+        size_t uvs = 0;
+        size_t normals = 0;
+        size_t faces = 0;
+    };
+
+    inline bool isBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline const char* skipBlanks(const char* p, const char* end)
+    {
+        while (p < end && isBlank(*p))
+            ++p;
+        return p;
+    }
+
+    inline const char* nextLine(const char* p, const char* end)
+    {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        return eol ? eol + 1 : end;
+    }
+
+    ObjCounts countRecords(const char* p, const char* end)
+    {
+        ObjCounts counts;
+        while (p < end)
+        {
+            p = skipBlanks(p, end);
+            if (end - p >= 2)
+            {
+                if (p[0] == 'v')
+                {
+                    if (isBlank(p[1]))
+                        counts.positions++;
+                    else if (p[1] == 't')
+                        counts.uvs++;
+                    else if (p[1] == 'n')
+                        counts.normals++;
+                }
+                else if (p[0] == 'f' && isBlank(p[1]))
+                {
+                    counts.faces++;
+                }
+            }
+            p = nextLine(p, end);
+        }
+        return counts;
+    }
+
+    inline const char* parseFloat(const char* p, const char* end, float& value)
+    {
+        p = skipBlanks(p, end);
+        if (p < end && *p == '+')
+            ++p;
+        std::from_chars_result result = std::from_chars(p, end, value);
+        return result.ec == std::errc() ? result.ptr : nullptr;
+    }
+
+    // A negative (relative) index left unresolved: the corner it belongs to
+    // and its position counted from the start of the chunk, which is below
+    // zero when it reaches into an earlier chunk
+    struct RelativeIndex
+    {
+        size_t corner;
+        long long offset;
+    };
+
+    // Per-chunk parse output. Relative indices are listed, with a zero in
+    // their place, so they can be resolved and checked once the chunk's
+    // offset into the whole file is known.
+    struct ObjChunk
+    {
+        ObjData data;
+        std::vector<RelativeIndex> relativeVertices;
+        std::vector<RelativeIndex> relativeUVs;
+        std::vector<RelativeIndex> relativeNormals;
+        const char* error = nullptr;
+    };
+
+    // Convert a one-based .obj index to zero-based, or a negative one to
+    // its offset from the start of the chunk; false for zero or for an index
+    // that does not fit the unsigned int index buffers (ObjData::missing is
+    // reserved)
+    inline bool resolveIndex(long long index, size_t count, long long& out, bool& relative)
+    {
+        relative = index < 0;
+        if (index > 0)
+            out = index - 1;
+        else if (index < 0)
+            out = static_cast<long long>(count) + index;
+        else
+            return false;
+        return out < static_cast<long long>(ObjData::missing);
+    }
+
+    // Parse one v, v/vt, v//vn or v/vt/vn face corner
+    const char* parseCorner(const char* p, const char* end, const ObjData& data,
+                            long long corner[3], bool relative[3])
+    {
+        long long index;
+        std::from_chars_result result = std::from_chars(p, end, index);
+        if (result.ec != std::errc() || !resolveIndex(index, data.positions.size(), corner[0], relative[0]))
+            return nullptr;
+        p = result.ptr;
+
+        corner[1] = ObjData::missing;
+        corner[2] = ObjData::missing;
+        relative[1] = false;
+        relative[2] = false;
+        if (p < end && *p == '/')
+        {
+            ++p;
+            if (p < end && *p != '/')
+            {
+                result = std::from_chars(p, end, index);
+                if (result.ec != std::errc() || !resolveIndex(index, data.uvs.size(), corner[1], relative[1]))
+                    return nullptr;
+                p = result.ptr;
+            }
+            if (p < end && *p == '/')
+            {
+                ++p;
+                result = std::from_chars(p, end, index);
+                if (result.ec != std::errc() || !resolveIndex(index, data.normals.size(), corner[2], relative[2]))
+                    return nullptr;
+                p = result.ptr;
+            }
+        }
+        return p;
+    }
+
+    inline unsigned int pushIndex(std::vector<RelativeIndex>& relatives, size_t position,
+                                  long long index, bool relative)
+    {
+        if (!relative)
+            return static_cast<unsigned int>(index);
+        RelativeIndex entry = { position, index };
+        relatives.push_back(entry);
+        return 0;
+    }
+
+    inline void pushCorner(ObjChunk& chunk, const long long corner[3], const bool relative[3])
+    {
+        ObjData& data = chunk.data;
+        size_t position = data.vertexIndices.size();
+        data.vertexIndices.push_back(pushIndex(chunk.relativeVertices, position, corner[0], relative[0]));
+        data.uvIndices.push_back(pushIndex(chunk.relativeUVs, position, corner[1], relative[1]));
+        data.normalIndices.push_back(pushIndex(chunk.relativeNormals, position, corner[2], relative[2]));
+    }
+
+    // Parse a face record, fanning polygons into triangles
+    const char* parseFace(const char* p, const char* end, ObjChunk& chunk)
+    {
+        long long first[3] = {}, previous[3] = {}, corner[3];
+        bool firstRelative[3] = {}, previousRelative[3] = {}, relative[3];
+        int corners = 0;
+
+        while (true)
+        {
+            p = skipBlanks(p, end);
+            if (p == end || *p == '\n' || *p == '#')
+                break;
+
+            p = parseCorner(p, end, chunk.data, corner, relative);
+            if (!p)
+                return nullptr;
+
+            if (corners == 0)
+            {
+                std::copy(corner, corner + 3, first);
+                std::copy(relative, relative + 3, firstRelative);
+            }
+            else if (corners >= 2)
+            {
+                pushCorner(chunk, first, firstRelative);
+                pushCorner(chunk, previous, previousRelative);
+                pushCorner(chunk, corner, relative);
+            }
+            std::copy(corner, corner + 3, previous);
+            std::copy(relative, relative + 3, previousRelative);
+            corners++;
+        }
+
+        if (corners < 3)
+            return nullptr;
+
+        chunk.data.faceCount++;
+        return p;
+    }
+
+    // Parse every record in [begin, end), which must start at a line start
+    void parseRange(const char* begin, const char* end, ObjChunk& chunk)
+    {
+        ObjData& out = chunk.data;
+
+        // Reserve pass
+        ObjCounts counts = countRecords(begin, end);
+        out.positions.reserve(counts.positions);
+        out.uvs.reserve(counts.uvs);
+        out.normals.reserve(counts.normals);
+        out.vertexIndices.reserve(counts.faces * 3);
+        out.uvIndices.reserve(counts.faces * 3);
+        out.normalIndices.reserve(counts.faces * 3);
+
+        // Parse pass, working directly on the buffer
+        const char* p = begin;
+        while (p < end)
+        {
+            p = skipBlanks(p, end);
+            const char* q = p;
+
+            if (end - p >= 2 && p[0] == 'v' && isBlank(p[1]))
+            {
+                // Read vertices
+                glm::vec3 vertex;
+                if ((q = parseFloat(p + 2, end, vertex.x)) &&
+                    (q = parseFloat(q, end, vertex.y)) &&
+                    (q = parseFloat(q, end, vertex.z)))
+                    out.positions.push_back(vertex);
+            }
+            else if (end - p >= 3 && p[0] == 'v' && p[1] == 't' && isBlank(p[2]))
+            {
+                // Read texture co-ordinates
+                glm::vec2 uv;
+                if ((q = parseFloat(p + 3, end, uv.x)) &&
+                    (q = parseFloat(q, end, uv.y)))
+                    out.uvs.push_back(uv);
+            }
+            else if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && isBlank(p[2]))
+            {
+                // Read vertex normals
+                glm::vec3 normal;
+                if ((q = parseFloat(p + 3, end, normal.x)) &&
+                    (q = parseFloat(q, end, normal.y)) &&
+                    (q = parseFloat(q, end, normal.z)))
+                    out.normals.push_back(normal);
+            }
+            else if (end - p >= 2 && p[0] == 'f' && isBlank(p[1]))
+            {
+                // Read vertex indices
+                q = parseFace(p + 2, end, chunk);
+            }
+
+            if (!q)
+            {
+                chunk.error = p;
+                return;
+            }
+
+            // Anything else (comments, groups, materials) is skipped
+            p = nextLine(q, end);
+        }
+    }
+
+    // Where a chunk's records start in the merged output
+    struct ObjOffsets
+    {
+        size_t positions = 0;
+        size_t uvs = 0;
+        size_t normals = 0;
+        size_t indices = 0;
+    };
+
+    // Write relative indices into indices[first...], now that the chunk is
+    // known to start base attributes in; false if one reaches past the
+    // start of the file
+    bool resolveRelative(const std::vector<RelativeIndex>& relatives, size_t base, size_t first,
+                         std::vector<unsigned int>& indices)
+    {
+        for (const RelativeIndex& relative : relatives)
+        {
+            long long index = static_cast<long long>(base) + relative.offset;
+            if (index < 0 || index >= static_cast<long long>(ObjData::missing))
+                return false;
+            indices[first + relative.corner] = static_cast<unsigned int>(index);
+        }
+        return true;
+    }
+
+    bool resolveChunk(const ObjChunk& chunk, const ObjOffsets& base, ObjData& out)
+    {
+        return resolveRelative(chunk.relativeVertices, base.positions, base.indices, out.vertexIndices) &&
+               resolveRelative(chunk.relativeUVs, base.uvs, base.indices, out.uvIndices) &&
+               resolveRelative(chunk.relativeNormals, base.normals, base.indices, out.normalIndices);
+    }
+
+    // Copy a chunk into its slot of the merged output and resolve its
+    // relative indices against the attributes parsed in earlier chunks;
+    // valid is cleared if any reach past the start of the file
+    void mergeChunk(const ObjChunk& chunk, const ObjOffsets& base, ObjData& out, char& valid)
+    {
+        const ObjData& data = chunk.data;
+        std::copy(data.positions.begin(), data.positions.end(), out.positions.begin() + base.positions);
+        std::copy(data.uvs.begin(), data.uvs.end(), out.uvs.begin() + base.uvs);
+        std::copy(data.normals.begin(), data.normals.end(), out.normals.begin() + base.normals);
+
+        size_t first = base.indices;
+        std::copy(data.vertexIndices.begin(), data.vertexIndices.end(), out.vertexIndices.begin() + first);
+        std::copy(data.uvIndices.begin(), data.uvIndices.end(), out.uvIndices.begin() + first);
+        std::copy(data.normalIndices.begin(), data.normalIndices.end(), out.normalIndices.begin() + first);
+        valid = resolveChunk(chunk, base, out);
+    }
+
+    size_t lineNumber(const char* begin, const char* position)
+    {
+        return 1 + std::count(begin, position, '\n');
+    }
+
+    // Check every index refers to an attribute that exists
+    bool validateIndices(const ObjData& out, bool resolved = true)
+    {
+        if (!resolved)
+        {
+            printf("File can't be read by loadObj() (face index out of range).\n");
+            return false;
+        }
+        for (size_t i = 0; i < out.vertexIndices.size(); i++)
+        {
+            if (out.vertexIndices[i] >= out.positions.size() ||
+                (out.uvIndices[i] != ObjData::missing && out.uvIndices[i] >= out.uvs.size()) ||
+                (out.normalIndices[i] != ObjData::missing && out.normalIndices[i] >= out.normals.size()))
+            {
+                printf("File can't be read by loadObj() (face index out of range).\n");
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+void ObjData::clear()
+{
+    positions.clear();
+    uvs.clear();
+    normals.clear();
+    vertexIndices.clear();
+    uvIndices.clear();
+    normalIndices.clear();
+    faceCount = 0;
+}
+
+bool ObjParser::parseFile(const char* path, ObjData& out, unsigned int threads)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        printf("Impossible to open the file %s. Check paths and directories.\n", path);
+        return false;
+    }
+
+    // Small files aren't worth starting threads for
+    if (threads != 1 && file.size() < parallelThreshold)
+        threads = 1;
+
+    if (threads == 1)
+        return parseBuffer(file.data(), file.data() + file.size(), out);
+    return parseBufferParallel(file.data(), file.data() + file.size(), out, threads);
+}
+
+bool ObjParser::parseBuffer(const char* begin, const char* end, ObjData& out)
+{
+    ObjChunk chunk;
+    parseRange(begin, end, chunk);
+    if (chunk.error)
+    {
+        printf("File can't be read by loadObj() (line %zu).\n", lineNumber(begin, chunk.error));
+        return false;
+    }
+
+    // A single chunk starts at zero, where any relative index below it is out of range
+    bool resolved = resolveChunk(chunk, ObjOffsets(), chunk.data);
+    out = std::move(chunk.data);
+    return validateIndices(out, resolved);
+}
+
+bool ObjParser::parseBufferParallel(const char* begin, const char* end, ObjData& out, unsigned int threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Split at line boundaries
+    size_t size = end - begin;
+    std::vector<const char*> bounds(1, begin);
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        const char* split = begin + size * i / threads;
+        if (split > bounds.back())
+        {
+            split = nextLine(split - 1, end);
+            if (split > bounds.back() && split < end)
+                bounds.push_back(split);
+        }
+    }
+    bounds.push_back(end);
+    size_t chunkCount = bounds.size() - 1;
+
+    // Parse each chunk on its own worker, the calling thread takes the first
+    std::vector<ObjChunk> chunks(chunkCount);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunkCount; i++)
+        workers.emplace_back(parseRange, bounds[i], bounds[i + 1], std::ref(chunks[i]));
+    parseRange(bounds[0], bounds[1], chunks[0]);
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        if (chunks[i].error)
+        {
+            printf("File can't be read by loadObj() (line %zu).\n", lineNumber(begin, chunks[i].error));
+            return false;
+        }
+    }
+
+    // Prefix sums give each chunk its offsets into the merged arrays
+    std::vector<ObjOffsets> bases(chunkCount);
+    ObjOffsets totals;
+    size_t faceCount = 0;
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        const ObjData& data = chunks[i].data;
+        bases[i] = totals;
+        totals.positions += data.positions.size();
+        totals.uvs += data.uvs.size();
+        totals.normals += data.normals.size();
+        totals.indices += data.vertexIndices.size();
+        faceCount += data.faceCount;
+    }
+
+    ObjData total;
+    total.positions.resize(totals.positions);
+    total.uvs.resize(totals.uvs);
+    total.normals.resize(totals.normals);
+    total.vertexIndices.resize(totals.indices);
+    total.uvIndices.resize(totals.indices);
+    total.normalIndices.resize(totals.indices);
+    total.faceCount = faceCount;
+
+    // Merge in parallel, every chunk writes a disjoint slice
+    std::vector<char> valid(chunkCount, 1);
+    for (size_t i = 1; i < chunkCount; i++)
+        workers.emplace_back(mergeChunk, std::cref(chunks[i]), std::cref(bases[i]), std::ref(total),
+                             std::ref(valid[i]));
+    mergeChunk(chunks[0], bases[0], total, valid[0]);
+    for (std::thread& worker : workers)
+        worker.join();
+
+    out = std::move(total);
+    return validateIndices(out, std::find(valid.begin(), valid.end(), 0) == valid.end());
+}
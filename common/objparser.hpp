@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+#include <glm/glm.hpp>
+
+// Raw contents of an .obj file. Faces are triangulated and their indices
+// are zero-based; corners without a uv or normal use ObjData::missing.
+struct ObjData
+{
+    static const unsigned int missing = 0xFFFFFFFFu;
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec3> normals;
+    std::vector<unsigned int> vertexIndices;
+    std::vector<unsigned int> uvIndices;
+    std::vector<unsigned int> normalIndices;
+    size_t faceCount = 0;
+
+    void clear();
+};
+
+class ObjParser
+{
+public:
+    // files smaller than this are always parsed on the calling thread
+    static const size_t parallelThreshold = 4 * 1024 * 1024;
+
+    // parse a file through a read-only memory mapping, threads = 0 uses every core
+    static bool parseFile(const char* path, ObjData& out, unsigned int threads = 1);
+
+    // parse an in-memory .obj buffer
+    static bool parseBuffer(const char* begin, const char* end, ObjData& out);
+
+    // parse line-aligned chunks on worker threads; the result matches parseBuffer
+    static bool parseBufferParallel(const char* begin, const char* end, ObjData& out,
+                                    unsigned int threads = 0);
+};
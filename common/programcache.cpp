@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "programcache.hpp"
+#include "mappedfile.hpp"
+#include "cachefile.hpp"
+#include "hash.hpp"
+
+namespace
+{
+    // File header, the binary follows at a 16-byte aligned offset
+    struct ProgramCacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint32_t binaryFormat;
+        uint32_t padding;
+        uint64_t binarySize;
+        double compileMilliseconds;
+    };
+
+    const char cacheMagic[4] = { 'C', 'G', 'P', 'R' };
+
+    uint64_t hashString(const char* text, uint64_t seed)
+    {
+        return hashBytes(text, text ? strlen(text) : 0, seed);
+    }
+}
+
+std::string ProgramCache::cachePath(const char* vertexPath, const char* fragmentPath)
+{
+    return std::string(vertexPath) + "." + std::filesystem::path(fragmentPath).filename().string() + ".cgprog";
+}
+
+bool ProgramCache::supported()
+{
+    if (!GLEW_ARB_get_program_binary && !GLEW_VERSION_4_1)
+        return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+uint64_t ProgramCache::key(const std::string& vertexCode, const std::string& fragmentCode)
+{
+    // Sizes are hashed in too, so moving text between the stages changes it
+    uint64_t hash = hashBytes(vertexCode.data(), vertexCode.size());
+    hash = hashBytes(fragmentCode.data(), fragmentCode.size(), hash);
+    hash = hashString(reinterpret_cast<const char*>(glGetString(GL_VENDOR)), hash);
+    hash = hashString(reinterpret_cast<const char*>(glGetString(GL_RENDERER)), hash);
+    hash = hashString(reinterpret_cast<const char*>(glGetString(GL_VERSION)), hash);
+    return hash;
+}
+
+unsigned int ProgramCache::load(const char* path, uint64_t key, double& compileMilliseconds)
+{
+    MappedFile file;
+    if (!file.open(path))
+        return 0;
+
+    ProgramCacheHeader header;
+    if (file.size() < sizeof(header))
+        return 0;
+    memcpy(&header, file.data(), sizeof(header));
+    uint64_t offset = CacheFile::alignUp(sizeof(header));
+    if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != version ||
+        header.key != key || offset > file.size() || header.binarySize > file.size() - offset)
+        return 0;
+
+    // A driver update that kept the version string can still refuse it
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.binaryFormat, file.data() + offset, static_cast<GLsizei>(header.binarySize));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+    compileMilliseconds = header.compileMilliseconds;
+    return program;
+}
+
+bool ProgramCache::write(const char* path, uint64_t key, unsigned int program, double compileMilliseconds)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+    std::vector<char> binary(length);
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(program, length, &length, &binaryFormat, binary.data());
+
+    ProgramCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = version;
+    header.key = key;
+    header.binaryFormat = binaryFormat;
+    header.binarySize = static_cast<uint64_t>(length);
+    header.compileMilliseconds = compileMilliseconds;
+
+    // Write to a temporary file first so readers never see a partial cache
+    std::string temporaryPath = CacheFile::temporaryPath(path);
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (file == NULL)
+    {
+        printf("Could not write program cache %s\n", path);
+        return false;
+    }
+
+    uint64_t offset = 0;
+    bool ok = CacheFile::writePadded(file, &header, sizeof(header), offset) &&
+              CacheFile::writePadded(file, binary.data(), header.binarySize, offset);
+    ok = fclose(file) == 0 && ok;
+
+    if (!CacheFile::commit(temporaryPath, path, ok))
+    {
+        printf("Could not write program cache %s\n", path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+
+// Linked program binaries (glGetProgramBinary) in .cgprog files next to the
+// vertex shader. A binary is only good for the sources it was built from on
+// the driver that built it, so the file is keyed by a hash of both sources
+// together with GL_VENDOR, GL_RENDERER and GL_VERSION; anything else is
+// stale and the program is compiled again. The time the compile took is
+// kept alongside so a hit can say what it saved.
+class ProgramCache
+{
+public:
+    static const uint32_t version = 1;
+
+    // path of the cache for a vertex/fragment pair
+    static std::string cachePath(const char* vertexPath, const char* fragmentPath);
+
+    // GL thread: whether the driver hands out program binaries at all
+    static bool supported();
+
+    // GL thread: the key of a pair of sources on this driver
+    static uint64_t key(const std::string& vertexCode, const std::string& fragmentCode);
+
+    // GL thread: a linked program from the cache, or 0 if it is missing,
+    // stale or the driver turns it down; compileMilliseconds gets what
+    // compiling it took when it was cached
+    static unsigned int load(const char* path, uint64_t key, double& compileMilliseconds);
+
+    // GL thread: save a linked program, replacing any older cache atomically
+    static bool write(const char* path, uint64_t key, unsigned int program, double compileMilliseconds);
+};
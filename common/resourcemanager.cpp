@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <filesystem>
+#include <system_error>
+
+#include "resourcemanager.hpp"
+#include "hotreloader.hpp"
+#include "materiallibrary.hpp"
+
+namespace
+{
+    const char* typeNames[ResourceTypeCount] = { "textures", "models", "shaders" };
+
+    std::string contentKey(ResourceType type, uint64_t hash, const std::string& variant)
+    {
+        char text[17];
+        snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(hash));
+        return std::string(typeNames[type]) + "#" + text + variant;
+    }
+
+    std::string modelSuffix(const ModelOptions& options)
+    {
+        return "|" + std::to_string(options.compactVertices) + "|" + std::to_string(options.lodLevels);
+    }
+}
+
+std::string ResourceManager::canonicalPath(const char* path)
+{
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+    return error ? std::string(path) : canonical.string();
+}
+
+ResourceManager::ResourceManager(AssetLoader& loader, HotReloader* reloader)
+    : loader(loader), reloader(reloader)
+{
+}
+
+std::shared_ptr<AssetHandle> ResourceManager::find(const std::string& key)
+{
+    settle();
+    std::unordered_map<std::string, Entry>::iterator entry = resources.find(key);
+    return entry != resources.end() ? entry->second.asset : nullptr;
+}
+
+void ResourceManager::add(const std::string& key, ResourceType type, const std::string& variant,
+                          const std::shared_ptr<AssetHandle>& asset)
+{
+    Entry entry;
+    entry.type = type;
+    entry.asset = asset;
+    entry.variant = variant;
+    resources[key] = entry;
+    unsettled.push_back(key);
+    if (reloader)
+        reloader->track(asset);
+}
+
+void ResourceManager::settle()
+{
+    // The hash is only known once a worker has read the files
+    size_t kept = 0;
+    for (size_t i = 0; i < unsettled.size(); i++)
+    {
+        std::string key = unsettled[i];
+        std::unordered_map<std::string, Entry>::iterator entry = resources.find(key);
+        if (entry == resources.end())
+            continue;
+        if (!entry->second.asset->isReady())
+        {
+            unsettled[kept++] = key;
+            continue;
+        }
+        uint64_t hash = entry->second.asset->contentHash();
+        if (hash == 0)
+            continue;
+
+        // Same bytes under another name share the first resource, as long
+        // as that hasn't been edited since
+        std::string content = contentKey(entry->second.type, hash, entry->second.variant);
+        std::unordered_map<std::string, std::string>::iterator first = contents.find(content);
+        if (first != contents.end())
+        {
+            std::unordered_map<std::string, Entry>::iterator original = resources.find(first->second);
+            if (original != resources.end() && original->second.asset != entry->second.asset &&
+                original->second.asset->contentHash() == hash)
+            {
+                alias(key, first->second);
+                continue;
+            }
+        }
+        contents[content] = key;
+    }
+    unsettled.resize(kept);
+}
+
+void ResourceManager::alias(const std::string& key, const std::string& original)
+{
+    Entry& entry = resources[key];
+    std::vector<std::string> paths = entry.asset->sources();
+    duplicates.push_back(entry.asset);
+    entry.asset = resources[original].asset;
+    aliases.insert(key);
+    if (!reloader)
+        return;
+
+    // Once either file is edited they no longer match, and the next
+    // request loads the alias as a resource of its own
+    std::vector<std::string> originalPaths = entry.asset->sources();
+    paths.insert(paths.end(), originalPaths.begin(), originalPaths.end());
+    for (const std::string& path : paths)
+    {
+        reloader->watch(path, [this, key](const std::string&) {
+            if (aliases.erase(key) > 0)
+                resources.erase(key);
+        });
+    }
+}
+
+std::shared_ptr<TextureHandle> ResourceManager::texture(const char* path)
+{
+    std::string key = "texture:" + canonicalPath(path);
+    std::shared_ptr<AssetHandle> existing = find(key);
+    if (existing)
+        return std::static_pointer_cast<TextureHandle>(existing);
+
+    std::shared_ptr<TextureHandle> handle = loader.loadTexture(path);
+    add(key, ResourceTexture, std::string(), handle);
+    return handle;
+}
+
+std::shared_ptr<ModelHandle> ResourceManager::model(const char* path, const ModelOptions& options)
+{
+    std::string key = "model:" + canonicalPath(path) + modelSuffix(options);
+    std::shared_ptr<AssetHandle> existing = find(key);
+    if (existing)
+        return std::static_pointer_cast<ModelHandle>(existing);
+
+    std::shared_ptr<ModelHandle> handle = loader.loadModel(path, options);
+    add(key, ResourceModel, modelSuffix(options), handle);
+    return handle;
+}
+
+std::shared_ptr<ShaderHandle> ResourceManager::shader(const char* vertexPath, const char* fragmentPath)
+{
+    std::string key = "shader:" + canonicalPath(vertexPath) + "|" + canonicalPath(fragmentPath);
+    std::shared_ptr<AssetHandle> existing = find(key);
+    if (existing)
+        return std::static_pointer_cast<ShaderHandle>(existing);
+
+    std::shared_ptr<ShaderHandle> handle = loader.loadShader(vertexPath, fragmentPath);
+    add(key, ResourceShader, std::string(), handle);
+    return handle;
+}
+
+size_t ResourceManager::collect()
+{
+    settle();
+
+    // Handles an alias replaced go as soon as their callers let go
+    size_t freed = 0;
+    for (size_t i = 0; i < duplicates.size(); )
+    {
+        if (duplicates[i].use_count() > 1)
+        {
+            i++;
+            continue;
+        }
+        duplicates[i]->release();
+        duplicates[i] = duplicates.back();
+        duplicates.pop_back();
+        freed++;
+    }
+
+    // References the manager itself holds, one per key naming the resource
+    std::unordered_map<const AssetHandle*, long> ownReferences;
+    for (const std::unordered_map<std::string, Entry>::value_type& entry : resources)
+        ownReferences[entry.second.asset.get()]++;
+
+    // Anything more is a caller, a pending load or a queued upload
+    std::unordered_set<const AssetHandle*> unused;
+    for (const std::unordered_map<std::string, Entry>::value_type& entry : resources)
+    {
+        const AssetHandle* asset = entry.second.asset.get();
+        if (entry.second.asset.use_count() == ownReferences[asset])
+            unused.insert(asset);
+    }
+    if (unused.empty())
+        return freed;
+
+    for (std::unordered_map<std::string, Entry>::iterator entry = resources.begin(); entry != resources.end(); )
+    {
+        if (unused.count(entry->second.asset.get()) == 0)
+        {
+            ++entry;
+            continue;
+        }
+        if (entry->second.asset.use_count() == 1)
+            entry->second.asset->release();
+        aliases.erase(entry->first);
+        entry = resources.erase(entry);
+    }
+    for (std::unordered_map<std::string, std::string>::iterator content = contents.begin(); content != contents.end(); )
+    {
+        if (resources.find(content->second) == resources.end())
+            content = contents.erase(content);
+        else
+            ++content;
+    }
+    return freed + unused.size();
+}
+
+ResourceUsage ResourceManager::usage(ResourceType type) const
+{
+    ResourceUsage total;
+    std::unordered_set<const AssetHandle*> counted;
+    for (const std::unordered_map<std::string, Entry>::value_type& entry : resources)
+    {
+        if (entry.second.type != type || !counted.insert(entry.second.asset.get()).second)
+            continue;
+        total.count++;
+        total.bytes += entry.second.asset->gpuBytes();
+    }
+    return total;
+}
+
+void ResourceManager::report() const
+{
+    for (int type = 0; type < ResourceTypeCount; type++)
+    {
+        ResourceUsage total = usage(static_cast<ResourceType>(type));
+        printf("%-9s %4zu loaded, %8.1f KB\n", typeNames[type], total.count, total.bytes / 1024.0);
+    }
+    if (materials)
+        printf("%-9s %4zu loaded, %8.1f KB in %zu pages\n", "materials", materials->materialCount(),
+               materials->gpuBytes() / 1024.0, materials->pageCount());
+}
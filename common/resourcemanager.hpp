@@ -0,0 +1,94 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "assetloader.hpp"
+
+class HotReloader;
+class MaterialLibrary;
+
+enum ResourceType
+{
+    ResourceTexture,
+    ResourceModel,
+    ResourceShader,
+    ResourceTypeCount
+};
+
+struct ResourceUsage
+{
+    size_t count = 0;
+    size_t bytes = 0;   // GL memory, estimated for textures
+};
+
+// One shared, refcounted handle per resource. Requests are keyed by the
+// canonical path, so a repeated load is a single hash lookup. The loader's
+// workers hash each file as they read it; once a new resource is ready, a
+// name whose contents match an earlier resource becomes an alias of it, so
+// later requests share that one, and an edit to the aliased file ends the
+// sharing. Unreferenced resources stay cached until collect() frees them.
+class ResourceManager
+{
+public:
+    // new resources are also tracked by reloader when one is given
+    explicit ResourceManager(AssetLoader& loader, HotReloader* reloader = nullptr);
+
+    ResourceManager(const ResourceManager&) = delete;
+    ResourceManager& operator=(const ResourceManager&) = delete;
+
+    std::shared_ptr<TextureHandle> texture(const char* path);
+    std::shared_ptr<ModelHandle> model(const char* path, const ModelOptions& options = ModelOptions());
+    std::shared_ptr<ShaderHandle> shader(const char* vertexPath, const char* fragmentPath);
+
+    // GL thread: delete resources only the manager still references,
+    // returns how many were freed
+    size_t collect();
+
+    ResourceUsage usage(ResourceType type) const;
+
+    // report() includes the pages of materials, which dedups on its own
+    void setMaterials(const MaterialLibrary* materials) { this->materials = materials; }
+
+    // print counts and memory per resource type
+    void report() const;
+
+    // absolute path with . and .. resolved, so different spellings match
+    static std::string canonicalPath(const char* path);
+
+private:
+    struct Entry
+    {
+        ResourceType type;
+        std::shared_ptr<AssetHandle> asset;
+        std::string variant;    // options that make the same file a different resource
+    };
+
+    AssetLoader& loader;
+    HotReloader* reloader;
+    const MaterialLibrary* materials = nullptr;
+
+    // request key -> resource, content key -> request key of its first load
+    std::unordered_map<std::string, Entry> resources;
+    std::unordered_map<std::string, std::string> contents;
+
+    // keys not yet ready to be matched by content, and keys sharing another's resource
+    std::vector<std::string> unsettled;
+    std::unordered_set<std::string> aliases;
+
+    // handles replaced by an alias, released once nobody holds them
+    std::vector<std::shared_ptr<AssetHandle>> duplicates;
+
+    std::shared_ptr<AssetHandle> find(const std::string& key);
+    void add(const std::string& key, ResourceType type, const std::string& variant,
+             const std::shared_ptr<AssetHandle>& asset);
+
+    // match newly ready resources against earlier ones by content
+    void settle();
+    void alias(const std::string& key, const std::string& original);
+};
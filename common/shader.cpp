@@ -1,80 +1,69 @@
 #include <stdio.h>
 #include <string>
 #include <vector>
-#include <iostream>
+#include <chrono>
 #include <fstream>
-#include <algorithm>
 #include <sstream>
-using namespace std;
-
-#include <stdlib.h>
-#include <string.h>
 
 #include <GL/glew.h>
 
 #include "shader.hpp"
-
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
-
-    // Create the shaders
-    GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Read the Vertex Shader code from the file
-    std::string VertexShaderCode;
-    std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-    if(VertexShaderStream.is_open()){
-        std::stringstream sstr;
-        sstr << VertexShaderStream.rdbuf();
-        VertexShaderCode = sstr.str();
-        VertexShaderStream.close();
-    }else{
-        printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-        getchar();
-        return 0;
+#include "programcache.hpp"
+
+namespace
+{
+    // Compile one stage, printing the log; returns 0 on failure
+    GLuint compileStage(GLenum type, const std::string &code, const char *name)
+    {
+        printf("Compiling shader : %s\n", name);
+        GLuint ShaderID = glCreateShader(type);
+        char const * SourcePointer = code.c_str();
+        glShaderSource(ShaderID, 1, &SourcePointer , NULL);
+        glCompileShader(ShaderID);
+
+        // Check the shader
+        GLint Result = GL_FALSE;
+        int InfoLogLength;
+        glGetShaderiv(ShaderID, GL_COMPILE_STATUS, &Result);
+        glGetShaderiv(ShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+        if ( InfoLogLength > 0 )
+        {
+            std::vector<char> ShaderErrorMessage(InfoLogLength+1);
+            glGetShaderInfoLog(ShaderID, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+            printf("%s\n", &ShaderErrorMessage[0]);
+        }
+
+        if (Result != GL_TRUE)
+        {
+            glDeleteShader(ShaderID);
+            return 0;
+        }
+        return ShaderID;
     }
+}
 
-    // Read the Fragment Shader code from the file
-    std::string FragmentShaderCode;
-    std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-    if(FragmentShaderStream.is_open()){
-        std::stringstream sstr;
-        sstr << FragmentShaderStream.rdbuf();
-        FragmentShaderCode = sstr.str();
-        FragmentShaderStream.close();
-    }
-
-    GLint Result = GL_FALSE;
-    int InfoLogLength;
-
-    // Compile Vertex Shader
-    printf("Compiling shader : %s\n", vertex_file_path);
-    char const * VertexSourcePointer = VertexShaderCode.c_str();
-    glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-    glCompileShader(VertexShaderID);
-
-    // Check Vertex Shader
-    glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if ( InfoLogLength > 0 ){
-        std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
-        glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-        printf("%s\n", &VertexShaderErrorMessage[0]);
-    }
+bool ReadShaderFile(const char *path, std::string &code)
+{
+    std::ifstream ShaderStream(path, std::ios::in);
+    if (!ShaderStream.is_open())
+        return false;
+    std::stringstream sstr;
+    sstr << ShaderStream.rdbuf();
+    code = sstr.str();
+    return true;
+}
 
-    // Compile Fragment Shader
-    printf("Compiling shader : %s\n", fragment_file_path);
-    char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-    glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-    glCompileShader(FragmentShaderID);
-
-    // Check Fragment Shader
-    glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if ( InfoLogLength > 0 ){
-        std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
-        glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-        printf("%s\n", &FragmentShaderErrorMessage[0]);
+unsigned int CompileShaderProgram(const std::string &vertexCode, const std::string &fragmentCode,
+                                  const char *vertexName, const char *fragmentName)
+{
+    // Compile both stages
+    GLuint VertexShaderID = compileStage(GL_VERTEX_SHADER, vertexCode, vertexName);
+    GLuint FragmentShaderID = compileStage(GL_FRAGMENT_SHADER, fragmentCode, fragmentName);
+    if (VertexShaderID == 0 || FragmentShaderID == 0)
+    {
+        glDeleteShader(VertexShaderID);
+        glDeleteShader(FragmentShaderID);
+        return 0;
     }
 
     // Link the program
@@ -82,12 +71,17 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
     GLuint ProgramID = glCreateProgram();
     glAttachShader(ProgramID, VertexShaderID);
     glAttachShader(ProgramID, FragmentShaderID);
+    if (ProgramCache::supported())
+        glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(ProgramID);
 
     // Check the program
+    GLint Result = GL_FALSE;
+    int InfoLogLength;
     glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
     glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if ( InfoLogLength > 0 ){
+    if ( InfoLogLength > 0 )
+    {
         std::vector<char> ProgramErrorMessage(InfoLogLength+1);
         glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
         printf("%s\n", &ProgramErrorMessage[0]);
@@ -99,6 +93,57 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
     glDeleteShader(VertexShaderID);
     glDeleteShader(FragmentShaderID);
 
+    if (Result != GL_TRUE)
+    {
+        glDeleteProgram(ProgramID);
+        return 0;
+    }
     return ProgramID;
 }
 
+unsigned int LoadShaders(const char *vertex_file_path, const char *fragment_file_path)
+{
+    // Read the shader code from the files
+    std::string VertexShaderCode;
+    if (!ReadShaderFile(vertex_file_path, VertexShaderCode))
+    {
+        printf("Impossible to open %s. Are you in the right directory?\n", 
+               vertex_file_path);
+        getchar();
+        return 0;
+    }
+    std::string FragmentShaderCode;
+    ReadShaderFile(fragment_file_path, FragmentShaderCode);
+
+    return CachedShaderProgram(VertexShaderCode, FragmentShaderCode, vertex_file_path, fragment_file_path);
+}
+
+unsigned int CachedShaderProgram(const std::string &vertexCode, const std::string &fragmentCode,
+                                 const char *vertexPath, const char *fragmentPath)
+{
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    if (!ProgramCache::supported())
+        return CompileShaderProgram(vertexCode, fragmentCode, vertexPath, fragmentPath);
+
+    std::string path = ProgramCache::cachePath(vertexPath, fragmentPath);
+    uint64_t key = ProgramCache::key(vertexCode, fragmentCode);
+    double compileMilliseconds = 0.0;
+    GLuint ProgramID = ProgramCache::load(path.c_str(), key, compileMilliseconds);
+    if (ProgramID != 0)
+    {
+        double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        printf("Loaded program %s / %s from its cache in %.2f ms (compiling took %.2f ms)\n",
+               vertexPath, fragmentPath, milliseconds, compileMilliseconds);
+        return ProgramID;
+    }
+
+    // Missing or stale, compile and cache it for next time
+    ProgramID = CompileShaderProgram(vertexCode, fragmentCode, vertexPath, fragmentPath);
+    if (ProgramID == 0)
+        return 0;
+    compileMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    printf("Compiled program %s / %s in %.2f ms\n", vertexPath, fragmentPath, compileMilliseconds);
+    ProgramCache::write(path.c_str(), key, ProgramID, compileMilliseconds);
+    return ProgramID;
+}
@@ -0,0 +1,112 @@
+#include "shaderprogram.hpp"
+
+namespace
+{
+    // In ShaderUniform order
+    const char* const uniformNames[UniformCount] = {
+        "model", "positionScale", "positionOffset",
+        "ka", "kd", "ks", "Ns",
+        "textureMap", "diffuseMap", "normalMap", "specularMap",
+        "virtualColour", "virtualCache", "virtualPages", "virtualTailMap",
+        "virtualSize", "virtualTail", "virtualCacheSize", "feedbackBias"
+    };
+
+    // In UniformBlock order
+    const char* const blockNames[UniformBlockCount] = { "Camera", "Lights" };
+
+    // Arrays are reported as "name[0]", their location is the first element's
+    std::string baseName(const char* name, GLsizei length)
+    {
+        std::string base(name, length);
+        size_t bracket = base.find('[');
+        if (bracket != std::string::npos)
+            base.resize(bracket);
+        return base;
+    }
+
+    GLint find(const std::vector<ShaderVariable>& variables, const char* name)
+    {
+        for (const ShaderVariable& variable : variables)
+        {
+            if (variable.name == name)
+                return variable.location;
+        }
+        return -1;
+    }
+}
+
+void ShaderProgram::reflect(unsigned int program)
+{
+    this->program = program;
+    for (int i = 0; i < UniformCount; i++)
+        known[i] = -1;
+    activeUniforms.clear();
+    activeAttributes.clear();
+    if (program == 0)
+        return;
+
+    GLint count = 0;
+    GLint longest = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &longest);
+    std::vector<char> name(longest > 0 ? longest : 1);
+    for (GLint i = 0; i < count; i++)
+    {
+        ShaderVariable variable;
+        GLsizei length = 0;
+        glGetActiveUniform(program, i, static_cast<GLsizei>(name.size()), &length, &variable.size,
+                           &variable.type, name.data());
+        variable.name = baseName(name.data(), length);
+
+        // Members of uniform blocks have no location of their own
+        variable.location = glGetUniformLocation(program, name.data());
+        activeUniforms.push_back(variable);
+    }
+
+    count = 0;
+    longest = 0;
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &longest);
+    name.assign(longest > 0 ? longest : 1, '\0');
+    for (GLint i = 0; i < count; i++)
+    {
+        ShaderVariable variable;
+        GLsizei length = 0;
+        glGetActiveAttrib(program, i, static_cast<GLsizei>(name.size()), &length, &variable.size,
+                          &variable.type, name.data());
+        variable.name = baseName(name.data(), length);
+        variable.location = glGetAttribLocation(program, name.data());
+        activeAttributes.push_back(variable);
+    }
+
+    for (int i = 0; i < UniformCount; i++)
+        known[i] = find(activeUniforms, uniformNames[i]);
+
+    // GLSL 330 has no layout(binding), so the blocks are bound here
+    for (int i = 0; i < UniformBlockCount; i++)
+    {
+        GLuint index = glGetUniformBlockIndex(program, blockNames[i]);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, index, i);
+    }
+}
+
+GLint ShaderProgram::location(const char* name) const
+{
+    return find(activeUniforms, name);
+}
+
+GLint ShaderProgram::attribute(const char* name) const
+{
+    return find(activeAttributes, name);
+}
+
+const char* ShaderProgram::name(ShaderUniform uniform)
+{
+    return uniform >= 0 && uniform < UniformCount ? uniformNames[uniform] : "";
+}
+
+const char* ShaderProgram::name(UniformBlock block)
+{
+    return block >= 0 && block < UniformBlockCount ? blockNames[block] : "";
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Uniforms the engine sets, each resolved to a location once per link
+enum ShaderUniform
+{
+    UniformModel,
+    UniformPositionScale,
+    UniformPositionOffset,
+    UniformKa,
+    UniformKd,
+    UniformKs,
+    UniformNs,
+    UniformTextureMap,
+    UniformDiffuseMap,
+    UniformNormalMap,
+    UniformSpecularMap,
+    UniformVirtualColour,
+    UniformVirtualCache,
+    UniformVirtualPages,
+    UniformVirtualTailMap,
+    UniformVirtualSize,
+    UniformVirtualTail,
+    UniformVirtualCacheSize,
+    UniformFeedbackBias,
+    UniformCount
+};
+
+// An active uniform or attribute as the linker reports it
+struct ShaderVariable
+{
+    std::string name;       // arrays without their "[0]"
+    GLenum type;
+    GLint size;
+    GLint location;
+};
+
+// Uniform blocks shared by every program, each on the binding point of
+// its value (see UniformBuffer)
+enum UniformBlock
+{
+    UniformBlockCamera,
+    UniformBlockLights,
+    UniformBlockCount
+};
+
+// A linked program and what it takes, enumerated with glGetActiveUniform
+// and glGetActiveAttrib when it is reflected rather than asked for by name
+// every draw. The setters index a table filled in then, so the per-frame
+// path builds no strings and makes no driver queries; uniforms the program
+// doesn't use (or the compiler stripped) have location -1 and are skipped.
+class ShaderProgram
+{
+public:
+    ShaderProgram()
+    {
+        for (int i = 0; i < UniformCount; i++)
+            known[i] = -1;
+    }
+
+    // GL thread
+    explicit ShaderProgram(unsigned int program) : ShaderProgram() { reflect(program); }
+
+    // GL thread: enumerate program's uniforms and attributes and point its
+    // shared blocks at their binding points, again after every relink since
+    // locations can move
+    void reflect(unsigned int program);
+
+    unsigned int id() const { return program; }
+
+    // location of a known uniform, -1 if the program lacks it
+    GLint location(ShaderUniform uniform) const { return known[uniform]; }
+
+    // location by name from the reflected table, for set-up code
+    GLint location(const char* name) const;
+    GLint attribute(const char* name) const;
+
+    const std::vector<ShaderVariable>& uniforms() const { return activeUniforms; }
+    const std::vector<ShaderVariable>& attributes() const { return activeAttributes; }
+
+    // GL thread, with the program in use
+    void set(ShaderUniform uniform, int value) const
+    {
+        if (known[uniform] >= 0)
+            glUniform1i(known[uniform], value);
+    }
+    void set(ShaderUniform uniform, float value) const
+    {
+        if (known[uniform] >= 0)
+            glUniform1f(known[uniform], value);
+    }
+    void set(ShaderUniform uniform, const glm::vec2& value) const
+    {
+        if (known[uniform] >= 0)
+            glUniform2fv(known[uniform], 1, &value[0]);
+    }
+    void set(ShaderUniform uniform, const glm::vec3& value) const
+    {
+        if (known[uniform] >= 0)
+            glUniform3fv(known[uniform], 1, &value[0]);
+    }
+    void set(ShaderUniform uniform, const glm::mat4& value) const
+    {
+        if (known[uniform] >= 0)
+            glUniformMatrix4fv(known[uniform], 1, GL_FALSE, &value[0][0]);
+    }
+
+    // GLSL name of a known uniform or block
+    static const char* name(ShaderUniform uniform);
+    static const char* name(UniformBlock block);
+
+private:
+    unsigned int program = 0;
+    GLint known[UniformCount];
+    std::vector<ShaderVariable> activeUniforms;
+    std::vector<ShaderVariable> activeAttributes;
+};
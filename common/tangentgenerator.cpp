@@ -0,0 +1,214 @@
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define TANGENT_SSE 1
+#include <emmintrin.h>
+#endif
+
+#include "tangentgenerator.hpp"
+#include "threadpool.hpp"
+
+namespace
+{
+    // Below this many triangles the work is done on the calling thread
+    const size_t parallelThreshold = 16384;
+
+    glm::vec3 anyPerpendicular(const glm::vec3& n)
+    {
+        glm::vec3 axis = fabsf(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        return glm::normalize(glm::cross(n, axis));
+    }
+
+    // Unit face tangent and bitangent from the uv gradients of one triangle
+    void faceFrame(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2,
+                   const glm::vec2& t0, const glm::vec2& t1, const glm::vec2& t2,
+                   glm::vec3& tangent, glm::vec3& bitangent)
+    {
+        glm::vec3 e1 = p1 - p0;
+        glm::vec3 e2 = p2 - p0;
+        glm::vec2 d1 = t1 - t0;
+        glm::vec2 d2 = t2 - t0;
+
+        // Only the sign of the determinant matters once the result is normalised
+        float det = d1.x * d2.y - d2.x * d1.y;
+        float sign = det < 0.0f ? -1.0f : 1.0f;
+        tangent = (e1 * d2.y - e2 * d1.y) * sign;
+        bitangent = (e2 * d1.x - e1 * d2.x) * sign;
+
+        float tangentLength = glm::length(tangent);
+        float bitangentLength = glm::length(bitangent);
+        tangent = tangentLength > 0.0f ? tangent / tangentLength : glm::vec3(0.0f);
+        bitangent = bitangentLength > 0.0f ? bitangent / bitangentLength : glm::vec3(0.0f);
+    }
+
+#ifdef TANGENT_SSE
+    // Four triangles at once, components in separate registers
+    struct Vec3x4
+    {
+        __m128 x, y, z;
+    };
+
+    Vec3x4 sub(const Vec3x4& a, const Vec3x4& b)
+    {
+        return { _mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z) };
+    }
+
+    // a * s - b * t
+    Vec3x4 combine(const Vec3x4& a, __m128 s, const Vec3x4& b, __m128 t)
+    {
+        return { _mm_sub_ps(_mm_mul_ps(a.x, s), _mm_mul_ps(b.x, t)),
+                 _mm_sub_ps(_mm_mul_ps(a.y, s), _mm_mul_ps(b.y, t)),
+                 _mm_sub_ps(_mm_mul_ps(a.z, s), _mm_mul_ps(b.z, t)) };
+    }
+
+    // Normalise, leaving zero vectors at zero
+    Vec3x4 normalise(const Vec3x4& v)
+    {
+        __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v.x, v.x), _mm_mul_ps(v.y, v.y)),
+                                          _mm_mul_ps(v.z, v.z));
+        __m128 nonZero = _mm_cmpgt_ps(lengthSquared, _mm_setzero_ps());
+        __m128 scale = _mm_and_ps(nonZero, _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSquared)));
+        return { _mm_mul_ps(v.x, scale), _mm_mul_ps(v.y, scale), _mm_mul_ps(v.z, scale) };
+    }
+
+    void store(const Vec3x4& v, glm::vec3* out)
+    {
+        alignas(16) float x[4], y[4], z[4];
+        _mm_store_ps(x, v.x);
+        _mm_store_ps(y, v.y);
+        _mm_store_ps(z, v.z);
+        for (int i = 0; i < 4; i++)
+            out[i] = glm::vec3(x[i], y[i], z[i]);
+    }
+
+    void faceFrames4(const unsigned int* indices, const glm::vec3* positions, const glm::vec2* uvs,
+                     glm::vec3* tangents, glm::vec3* bitangents)
+    {
+        // Gather corner k of the four triangles
+        auto position = [&](int k) {
+            const glm::vec3& a = positions[indices[k]];
+            const glm::vec3& b = positions[indices[3 + k]];
+            const glm::vec3& c = positions[indices[6 + k]];
+            const glm::vec3& d = positions[indices[9 + k]];
+            return Vec3x4{ _mm_setr_ps(a.x, b.x, c.x, d.x), _mm_setr_ps(a.y, b.y, c.y, d.y),
+                           _mm_setr_ps(a.z, b.z, c.z, d.z) };
+        };
+        auto uv = [&](int k, int axis) {
+            return _mm_setr_ps(uvs[indices[k]][axis], uvs[indices[3 + k]][axis],
+                               uvs[indices[6 + k]][axis], uvs[indices[9 + k]][axis]);
+        };
+
+        Vec3x4 p0 = position(0);
+        Vec3x4 e1 = sub(position(1), p0);
+        Vec3x4 e2 = sub(position(2), p0);
+        __m128 u0 = uv(0, 0);
+        __m128 v0 = uv(0, 1);
+        __m128 du1 = _mm_sub_ps(uv(1, 0), u0);
+        __m128 dv1 = _mm_sub_ps(uv(1, 1), v0);
+        __m128 du2 = _mm_sub_ps(uv(2, 0), u0);
+        __m128 dv2 = _mm_sub_ps(uv(2, 1), v0);
+
+        // Flip both gradients by the sign of the uv determinant
+        __m128 det = _mm_sub_ps(_mm_mul_ps(du1, dv2), _mm_mul_ps(du2, dv1));
+        __m128 signBit = _mm_and_ps(det, _mm_set1_ps(-0.0f));
+        dv1 = _mm_xor_ps(dv1, signBit);
+        dv2 = _mm_xor_ps(dv2, signBit);
+        du1 = _mm_xor_ps(du1, signBit);
+        du2 = _mm_xor_ps(du2, signBit);
+
+        store(normalise(combine(e1, dv2, e2, dv1)), tangents);
+        store(normalise(combine(e2, du1, e1, du2)), bitangents);
+    }
+#endif
+
+    // Angle of the triangle at corner k
+    float cornerAngle(const glm::vec3* positions, const unsigned int* triangle, int k)
+    {
+        const glm::vec3& p = positions[triangle[k]];
+        glm::vec3 a = positions[triangle[(k + 1) % 3]] - p;
+        glm::vec3 b = positions[triangle[(k + 2) % 3]] - p;
+        float lengths = glm::length(a) * glm::length(b);
+        if (lengths == 0.0f)
+            return 0.0f;
+        return acosf(glm::clamp(glm::dot(a, b) / lengths, -1.0f, 1.0f));
+    }
+}
+
+void TangentGenerator::generate(const std::vector<unsigned int>& indices,
+                                const std::vector<glm::vec3>& positions,
+                                const std::vector<glm::vec2>& uvs,
+                                const std::vector<glm::vec3>& normals,
+                                std::vector<glm::vec3>& outTangents,
+                                std::vector<glm::vec3>& outBitangents,
+                                unsigned int threads)
+{
+    size_t vertexCount = positions.size();
+    size_t triangleCount = indices.size() / 3;
+    outTangents.assign(vertexCount, glm::vec3(0.0f));
+    outBitangents.assign(vertexCount, glm::vec3(0.0f));
+    if (uvs.size() != vertexCount || normals.size() != vertexCount)
+        return;
+
+    // Face frames, every triangle writes only its own slot
+    std::vector<glm::vec3> faceTangents(triangleCount);
+    std::vector<glm::vec3> faceBitangents(triangleCount);
+    parallelFor(triangleCount, triangleCount < parallelThreshold ? 1 : threads, [&](size_t begin, size_t end) {
+        size_t i = begin;
+#ifdef TANGENT_SSE
+        for (; i + 4 <= end; i += 4)
+            faceFrames4(&indices[i * 3], positions.data(), uvs.data(), &faceTangents[i], &faceBitangents[i]);
+#endif
+        for (; i < end; i++)
+        {
+            const unsigned int* triangle = &indices[i * 3];
+            faceFrame(positions[triangle[0]], positions[triangle[1]], positions[triangle[2]],
+                      uvs[triangle[0]], uvs[triangle[1]], uvs[triangle[2]],
+                      faceTangents[i], faceBitangents[i]);
+        }
+    });
+
+    // Triangles around each vertex, so vertices can gather without atomics
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (unsigned int index : indices)
+        offsets[index + 1]++;
+    for (size_t i = 0; i < vertexCount; i++)
+        offsets[i + 1] += offsets[i];
+    std::vector<unsigned int> corners(triangleCount * 3);
+    std::vector<unsigned int> filled(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        corners[filled[indices[i]]++] = static_cast<unsigned int>(i);
+
+    // Angle weighted average per vertex, then orthogonalise
+    parallelFor(vertexCount, vertexCount < parallelThreshold ? 1 : threads, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++)
+        {
+            glm::vec3 tangent(0.0f);
+            glm::vec3 bitangent(0.0f);
+            for (unsigned int j = offsets[v]; j < offsets[v + 1]; j++)
+            {
+                size_t face = corners[j] / 3;
+                float weight = cornerAngle(positions.data(), &indices[face * 3], corners[j] % 3);
+                tangent += faceTangents[face] * weight;
+                bitangent += faceBitangents[face] * weight;
+            }
+
+            glm::vec3 n = normals[v];
+            float normalLength = glm::length(n);
+            n = normalLength > 0.0f ? n / normalLength : glm::vec3(0.0f, 0.0f, 1.0f);
+
+            // Gram-Schmidt, any tangent will do when the uvs are degenerate
+            tangent -= n * glm::dot(n, tangent);
+            float tangentLength = glm::length(tangent);
+            tangent = tangentLength > 1e-6f ? tangent / tangentLength : anyPerpendicular(n);
+
+            outTangents[v] = tangent;
+            outBitangents[v] = glm::cross(n, tangent) * handedness(n, tangent, bitangent);
+        }
+    });
+}
+
+float TangentGenerator::handedness(const glm::vec3& normal, const glm::vec3& tangent, const glm::vec3& bitangent)
+{
+    return glm::dot(glm::cross(normal, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+#include <glm/glm.hpp>
+
+class TangentGenerator
+{
+public:
+    // Per-vertex tangent frames in the spirit of MikkTSpace: face tangents are
+    // averaged over the triangles sharing each indexed vertex, weighted by the
+    // corner angle, then Gram-Schmidt orthogonalised against the vertex normal.
+    // The bitangent is cross(normal, tangent) flipped for mirrored uvs, so
+    // handedness is its sign against that cross product. threads = 0 uses
+    // every core.
+    static void generate(const std::vector<unsigned int>& indices,
+                         const std::vector<glm::vec3>& positions,
+                         const std::vector<glm::vec2>& uvs,
+                         const std::vector<glm::vec3>& normals,
+                         std::vector<glm::vec3>& outTangents,
+                         std::vector<glm::vec3>& outBitangents,
+                         unsigned int threads = 0);
+
+    // +1 or -1, the w component shaders use to rebuild the bitangent
+    static float handedness(const glm::vec3& normal, const glm::vec3& tangent, const glm::vec3& bitangent);
+};
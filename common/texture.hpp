@@ -1,47 +1,16 @@
-#define STB_IMAGE_IMPLEMENTATION
-#include <common/stb_image.hpp>
+#pragma once
 
-unsigned int loadTexture(const char *path)
-{
-    // Create and bind texture
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    
-    // Load texture image from file
-    int width, height, nChannels;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char *data = stbi_load(path, &width, &height, &nChannels, 0);
-    
-    if (data)
-    {
-        // Deal with different number of colour channels
-        GLenum format;
-        if (nChannels == 1)
-            format = GL_RED;
-        else if (nChannels == 3)
-            format = GL_RGB;
-        else if (nChannels == 4)
-            format = GL_RGBA;
-        
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-                     GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        
-        // Set texture wrapping options
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        
-    }
-    else
-    {
-        printf("Texture %s failed to load.\n", path);
-    }
+#include <common/image.hpp>
+#include <common/texturecache.hpp>
+#include <common/mappedfile.hpp>
 
-    // Free the image from the memory
-    stbi_image_free(data);
-    
-    return textureID;
+inline unsigned int loadTexture(const char *path)
+{
+    // Map the cached mip chain, decoding and caching it on the first run
+    MappedFile file;
+    TextureView cooked;
+    ImageData image;
+    if (!TextureCache::fetch(path, file, cooked, image))
+        return 0;
+    return cooked.levelCount > 0 ? Image::upload(cooked) : Image::upload(image);
 }
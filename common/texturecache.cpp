@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "texturecache.hpp"
+#include "mappedfile.hpp"
+#include "cachefile.hpp"
+#include "mipgenerator.hpp"
+#include "assetpack.hpp"
+
+namespace
+{
+    struct TextureCacheLevel
+    {
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // File header, the levels follow at 16-byte aligned offsets
+    struct TextureCacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        CacheFile::SourceKey source;
+        uint32_t width;
+        uint32_t height;
+        uint32_t channels;
+        uint32_t levelCount;
+        uint32_t format;        // BlockFormat
+        uint32_t filter;        // MipFilter
+        uint32_t content;       // MipContent
+        uint32_t quality;       // BlockQuality
+        TextureCacheLevel levels[TextureView::maxLevels];
+    };
+
+    const char cacheMagic[4] = { 'C', 'G', 'T', 'X' };
+}
+
+size_t TextureView::bytes() const
+{
+    size_t total = 0;
+    for (int i = 0; i < levelCount; i++)
+        total += levels[i].size;
+    return total;
+}
+
+std::string TextureCache::cachePath(const char* sourcePath)
+{
+    return std::string(sourcePath) + ".cgtex";
+}
+
+bool TextureCache::write(const char* sourcePath, const std::vector<ImageData>& levels, const MipOptions& options)
+{
+    std::vector<MipView> views(levels.size());
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        views[i].width = levels[i].width;
+        views[i].height = levels[i].height;
+        views[i].data = levels[i].pixels.data();
+        views[i].size = levels[i].bytes();
+    }
+    return writeLevels(sourcePath, levels.empty() ? 0 : levels[0].channels, BlockNone, options, BlockFast, views);
+}
+
+bool TextureCache::write(const char* sourcePath, const std::vector<CompressedImage>& levels,
+                         const MipOptions& options, BlockQuality quality)
+{
+    std::vector<MipView> views(levels.size());
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        views[i].width = levels[i].width;
+        views[i].height = levels[i].height;
+        views[i].data = levels[i].blocks.data();
+        views[i].size = levels[i].blocks.size();
+    }
+    BlockFormat format = levels.empty() ? BlockNone : levels[0].format;
+    return writeLevels(sourcePath, BlockCompressor::channelCount(format), format, options, quality, views);
+}
+
+bool TextureCache::writeLevels(const char* sourcePath, int channels, BlockFormat format, const MipOptions& options,
+                               BlockQuality quality, const std::vector<MipView>& levels)
+{
+    if (levels.empty() || levels.size() > size_t(TextureView::maxLevels))
+        return false;
+
+    CacheFile::SourceKey key;
+    if (!CacheFile::sourceKey(sourcePath, key, true))
+        return false;
+
+    // Level table
+    TextureCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = version;
+    header.source = key;
+    header.width = static_cast<uint32_t>(levels[0].width);
+    header.height = static_cast<uint32_t>(levels[0].height);
+    header.channels = static_cast<uint32_t>(channels);
+    header.levelCount = static_cast<uint32_t>(levels.size());
+    header.format = static_cast<uint32_t>(format);
+    header.filter = static_cast<uint32_t>(options.filter);
+    header.content = static_cast<uint32_t>(options.content);
+    header.quality = static_cast<uint32_t>(quality);
+
+    uint64_t offset = CacheFile::alignUp(sizeof(TextureCacheHeader));
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        header.levels[i].width = static_cast<uint32_t>(levels[i].width);
+        header.levels[i].height = static_cast<uint32_t>(levels[i].height);
+        header.levels[i].offset = offset;
+        header.levels[i].size = levels[i].size;
+        offset = CacheFile::alignUp(offset + levels[i].size);
+    }
+
+    // Write to a temporary file first so readers never see a partial cache
+    std::string path = cachePath(sourcePath);
+    std::string temporaryPath = CacheFile::temporaryPath(path);
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (file == NULL)
+    {
+        printf("Could not write texture cache %s\n", path.c_str());
+        return false;
+    }
+
+    offset = 0;
+    bool ok = CacheFile::writePadded(file, &header, sizeof(header), offset);
+    for (size_t i = 0; ok && i < levels.size(); i++)
+        ok = CacheFile::writePadded(file, levels[i].data, levels[i].size, offset);
+    ok = fclose(file) == 0 && ok;
+
+    if (!CacheFile::commit(temporaryPath, path, ok))
+    {
+        printf("Could not write texture cache %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool TextureCache::load(const char* sourcePath, MappedFile& file, TextureView& texture,
+                        const TextureSettings* settings)
+{
+    // A mounted pack is the shipped build, its blobs are trusted as is
+    PackBlob blob;
+    const AssetPack* pack = AssetPack::mounted();
+    if (pack && pack->find(sourcePath, blob))
+    {
+        file.close();
+        return parse(blob.data, blob.size, texture) && (!settings || builtWith(texture, sourcePath, *settings));
+    }
+
+    std::string path = cachePath(sourcePath);
+    if (!file.open(path.c_str()))
+        return false;
+
+    // Header checks
+    TextureCacheHeader header;
+    if (file.size() < sizeof(header))
+    {
+        file.close();
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != version)
+    {
+        file.close();
+        return false;
+    }
+
+    if (!CacheFile::matchesSource(sourcePath, header.source, path, offsetof(TextureCacheHeader, source)))
+    {
+        file.close();
+        return false;
+    }
+
+    if (!parse(file.data(), file.size(), texture))
+    {
+        printf("Texture cache %s is corrupt, rebuilding\n", path.c_str());
+        file.close();
+        return false;
+    }
+    if (settings && !builtWith(texture, sourcePath, *settings))
+    {
+        file.close();
+        return false;
+    }
+    return true;
+}
+
+bool TextureCache::fetch(const char* sourcePath, MappedFile& file, TextureView& texture, ImageData& image)
+{
+    texture = TextureView();
+    if (load(sourcePath, file, texture))
+        return true;
+    texture = TextureView();
+    if (!Image::decode(sourcePath, image))
+        return false;
+
+    // Bake the mip chain once so later starts map it instead of decoding,
+    // block compressed with the fast encoder. Fetches run on the loader's
+    // workers, which already keep every core busy, so bake on this thread.
+    MipOptions options;
+    options.content = MipGenerator::contentFor(sourcePath);
+    options.threads = 1;
+    std::vector<ImageData> levels;
+    MipGenerator::build(image, levels, options);
+
+    BlockFormat format = BlockCompressor::formatFor(image, options.content);
+    std::vector<CompressedImage> compressed(levels.size());
+    for (size_t i = 0; i < levels.size(); i++)
+        BlockCompressor::encode(levels[i], format, BlockFast, compressed[i], 1);
+    if (write(sourcePath, compressed, options, BlockFast) && load(sourcePath, file, texture))
+    {
+        image = ImageData();
+        return true;
+    }
+    texture = TextureView();
+    return true;
+}
+
+bool TextureCache::parse(const char* data, size_t size, TextureView& texture)
+{
+    TextureCacheHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != version)
+        return false;
+
+    // Every level must lie inside the data and match its size
+    BlockFormat format = static_cast<BlockFormat>(header.format);
+    bool valid = header.levelCount >= 1 && header.levelCount <= uint32_t(TextureView::maxLevels) &&
+                 header.channels >= 1 && header.channels <= 4 && header.format <= BlockBC5 &&
+                 header.filter <= MipLanczos && header.content <= MipNormal && header.quality <= BlockHigh;
+    for (uint32_t i = 0; valid && i < header.levelCount; i++)
+    {
+        const TextureCacheLevel& level = header.levels[i];
+        uint64_t expected = format == BlockNone ? uint64_t(level.width) * level.height * header.channels :
+                            BlockCompressor::compressedSize(format, level.width, level.height);
+        valid = level.offset <= size && level.size <= size - level.offset && level.size == expected;
+    }
+    if (!valid)
+        return false;
+
+    // Point straight into the data
+    texture.width = static_cast<int>(header.width);
+    texture.height = static_cast<int>(header.height);
+    texture.channels = static_cast<int>(header.channels);
+    texture.levelCount = static_cast<int>(header.levelCount);
+    texture.format = format;
+    texture.filter = static_cast<MipFilter>(header.filter);
+    texture.content = static_cast<MipContent>(header.content);
+    texture.quality = static_cast<BlockQuality>(header.quality);
+    for (int i = 0; i < texture.levelCount; i++)
+    {
+        texture.levels[i].width = static_cast<int>(header.levels[i].width);
+        texture.levels[i].height = static_cast<int>(header.levels[i].height);
+        texture.levels[i].data = reinterpret_cast<const unsigned char*>(data + header.levels[i].offset);
+        texture.levels[i].size = header.levels[i].size;
+    }
+    return true;
+}
+
+bool TextureCache::builtWith(const TextureView& texture, const char* sourcePath, const TextureSettings& settings)
+{
+    // The format follows from the content and the pixels, which the source
+    // check has already covered; only compressed levels have a quality
+    bool compressed = texture.format != BlockNone;
+    return texture.filter == settings.filter && texture.content == MipGenerator::contentFor(sourcePath) &&
+           compressed == settings.compress && (!compressed || texture.quality == settings.quality);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.hpp"
+#include "blockcompressor.hpp"
+
+class MappedFile;
+
+// One mip level, pointing into a mapped .cgtex file
+struct MipView
+{
+    int width = 0;
+    int height = 0;
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+};
+
+// Every level of a texture ready to upload
+struct TextureView
+{
+    static const int maxLevels = 16;
+
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int levelCount = 0;
+    BlockFormat format = BlockNone;     // levels hold blocks unless BlockNone
+    MipView levels[maxLevels];
+
+    // how the levels were built
+    MipFilter filter = MipKaiser;
+    MipContent content = MipColour;
+    BlockQuality quality = BlockFast;   // of the encoder, when there are blocks
+
+    size_t bytes() const;
+};
+
+// How to build a texture's levels; the content comes from the file name
+struct TextureSettings
+{
+    MipFilter filter = MipKaiser;
+    BlockQuality quality = BlockHigh;
+    bool compress = true;
+};
+
+// Versioned binary .cgtex files next to the source image holding the
+// decoded, fully mipmapped pixels or BCn blocks, checked against the source
+// like .cgmesh. The header also records the filter, content, format and
+// encoder quality, so a cook can tell a cache the runtime built quickly
+// from one built the way it asks.
+class TextureCache
+{
+public:
+    static const uint32_t version = 4;
+
+    // path of the cache for an image file
+    static std::string cachePath(const char* sourcePath);
+
+    // write levels (level 0 first) built with options, and block compressed
+    // with quality, replacing any older cache atomically
+    static bool write(const char* sourcePath, const std::vector<ImageData>& levels, const MipOptions& options);
+    static bool write(const char* sourcePath, const std::vector<CompressedImage>& levels, const MipOptions& options,
+                      BlockQuality quality);
+
+    // point texture into the mounted pack's copy, otherwise map the cache;
+    // fails if missing or stale. With settings, a cache built any other way
+    // is stale too; without, however it was built is fine.
+    static bool load(const char* sourcePath, MappedFile& file, TextureView& texture,
+                     const TextureSettings* settings = nullptr);
+
+    // load, or on a miss decode the source, mipmap and block compress it
+    // with the fast encoder, write the cache and map that; if the cache
+    // can't be written image keeps the decoded pixels. Fails only when the
+    // source can't be decoded.
+    static bool fetch(const char* sourcePath, MappedFile& file, TextureView& texture, ImageData& image);
+
+    // point texture into a whole cache file already in memory
+    static bool parse(const char* data, size_t size, TextureView& texture);
+
+    // whether texture was built from sourcePath the way settings ask
+    static bool builtWith(const TextureView& texture, const char* sourcePath, const TextureSettings& settings);
+
+private:
+    static bool writeLevels(const char* sourcePath, int channels, BlockFormat format, const MipOptions& options,
+                            BlockQuality quality, const std::vector<MipView>& levels);
+};
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "textureresidency.hpp"
+#include "assetloader.hpp"
+#include "image.hpp"
+
+TextureResidency::TextureResidency(size_t budgetBytes, float fovY, float screenHeight)
+    : budgetBytes(budgetBytes)
+{
+    setView(fovY, screenHeight);
+    counters.budgetBytes = budgetBytes;
+}
+
+void TextureResidency::setView(float fovY, float screenHeight)
+{
+    focalPixels = screenHeight / (2.0f * tanf(fovY * 0.5f));
+}
+
+void TextureResidency::manage(const std::shared_ptr<TextureHandle>& texture)
+{
+    std::unique_ptr<Entry> entry(new Entry());
+    entry->handle = texture;
+    entry->path = texture->path();
+    entries.push_back(std::move(entry));
+}
+
+void TextureResidency::use(unsigned int id, float distance, float worldSize)
+{
+    std::unordered_map<unsigned int, Entry*>::iterator found = byId.find(id);
+    if (found == byId.end() || !found->second->mapped)
+        return;
+    Entry& entry = *found->second;
+
+    // One level per halving of the texels each screen pixel covers
+    int level = 0;
+    float pixels = worldSize * focalPixels / std::max(distance, 1e-3f);
+    float texels = static_cast<float>(std::max(entry.chain.width, entry.chain.height));
+    if (distance > 0.0f && pixels < texels)
+        level = std::min(static_cast<int>(log2f(texels / std::max(pixels, 1.0f))), entry.chain.levelCount - 1);
+
+    if (entry.lastUsed != frame)
+    {
+        entry.lastUsed = frame;
+        entry.nearest = level;
+    }
+    else
+    {
+        entry.nearest = std::min(entry.nearest, level);
+    }
+}
+
+void TextureResidency::use(const Model& model, const glm::mat4& transform, const glm::vec3& eye)
+{
+    // Distance to the bounding sphere, as Model::selectLod measures it
+    glm::vec3 centre = glm::vec3(transform * glm::vec4((model.boundsMin + model.boundsMax) * 0.5f, 1.0f));
+    float scale = glm::max(glm::length(glm::vec3(transform[0])),
+                  glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+    float radius = glm::length(model.boundsMax - model.boundsMin) * 0.5f * scale;
+    float distance = glm::distance(eye, centre) - radius;
+
+    for (const Texture& texture : model.textures)
+        use(texture.handle ? texture.handle->id : texture.id, distance, radius * 2.0f);
+}
+
+void TextureResidency::update(size_t uploadBytes)
+{
+    // Forget textures nobody holds any more; their GL objects are gone
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (entries[i]->handle.expired())
+        {
+            std::unordered_map<unsigned int, Entry*>::iterator stale = byId.find(entries[i]->id);
+            if (stale != byId.end() && stale->second == entries[i].get())
+                byId.erase(stale);
+            continue;
+        }
+        entries[kept++] = std::move(entries[i]);
+    }
+    entries.resize(kept);
+
+    // Pick up textures that finished loading, and reloads, which bring
+    // every level back
+    std::vector<Entry*> active;
+    for (std::unique_ptr<Entry>& owned : entries)
+    {
+        Entry& entry = *owned;
+        std::shared_ptr<TextureHandle> handle = entry.handle.lock();
+        if (!handle->isReady())
+            continue;
+        if (handle->uploads != entry.uploads)
+        {
+            // A reload may have made a new texture object
+            std::unordered_map<unsigned int, Entry*>::iterator stale = byId.find(entry.id);
+            if (entry.id != handle->id && stale != byId.end() && stale->second == &entry)
+                byId.erase(stale);
+            entry.uploads = handle->uploads;
+            entry.id = handle->id;
+            byId[entry.id] = &entry;
+            entry.mapped = false;
+            entry.whole = false;
+            entry.base = 0;
+        }
+        if (entry.whole || (!entry.mapped && !map(entry)))
+            continue;
+        if (entry.lastUsed == frame)
+            entry.wanted = entry.nearest;
+        active.push_back(&entry);
+    }
+
+    // Every texture at its wanted level, if that fits
+    std::vector<int> target(active.size());
+    size_t total = 0;
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        target[i] = std::min(active[i]->wanted, active[i]->chain.levelCount - 1);
+        total += bytesFrom(*active[i], target[i]);
+    }
+    counters.wantedBytes = total;
+
+    // Otherwise take finest levels off the least recently used textures,
+    // the biggest level first among those used as recently
+    while (total > budgetBytes)
+    {
+        int victim = -1;
+        for (size_t i = 0; i < active.size(); i++)
+        {
+            if (target[i] >= active[i]->chain.levelCount - 1)
+                continue;
+            if (victim < 0 || active[i]->lastUsed < active[victim]->lastUsed ||
+                (active[i]->lastUsed == active[victim]->lastUsed &&
+                 active[i]->chain.levels[target[i]].size > active[victim]->chain.levels[target[victim]].size))
+                victim = static_cast<int>(i);
+        }
+        if (victim < 0)
+            break;
+        total -= active[victim]->chain.levels[target[victim]].size;
+        target[victim]++;
+    }
+
+    // Free first so the budget has room for what comes back
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        Entry& entry = *active[i];
+        if (target[i] <= entry.base)
+            continue;
+        int dropped = entry.base;
+        setBase(entry, target[i]);
+        for (int level = dropped; level < target[i]; level++)
+            Image::dropLevel(entry.id, level);
+        counters.evictedLevels += target[i] - dropped;
+    }
+
+    // Then restore, most recently used first and coarse levels before fine
+    std::vector<size_t> order;
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        if (target[i] < active[i]->base)
+            order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return active[a]->lastUsed > active[b]->lastUsed; });
+    size_t uploaded = 0;
+    for (size_t i : order)
+    {
+        Entry& entry = *active[i];
+        while (entry.base > target[i])
+        {
+            const MipView& level = entry.chain.levels[entry.base - 1];
+            if (uploaded > 0 && uploaded + level.size > uploadBytes)
+                break;
+            Image::uploadLevel(entry.chain, entry.id, entry.base - 1);
+            setBase(entry, entry.base - 1);
+            uploaded += level.size;
+            counters.restoredLevels++;
+        }
+    }
+    counters.uploadedBytes += uploaded;
+
+    counters.textures = active.size();
+    counters.budgetBytes = budgetBytes;
+    counters.residentBytes = 0;
+    counters.limited = 0;
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        counters.residentBytes += bytesFrom(*active[i], active[i]->base);
+        if (target[i] > active[i]->wanted)
+            counters.limited++;
+    }
+    frame++;
+}
+
+void TextureResidency::clear()
+{
+    entries.clear();
+    byId.clear();
+    counters = ResidencyStats();
+    counters.budgetBytes = budgetBytes;
+}
+
+bool TextureResidency::map(Entry& entry)
+{
+    // The handle let its mapping go after uploading, the cache maps again
+    if (!TextureCache::load(entry.path.c_str(), entry.file, entry.chain) || entry.chain.levelCount < 2)
+    {
+        printf("Keeping %s whole, it has no cooked mip chain to stream from\n", entry.path.c_str());
+        entry.file.close();
+        entry.chain = TextureView();
+        entry.whole = true;
+        return false;
+    }
+    entry.mapped = true;
+    return true;
+}
+
+size_t TextureResidency::bytesFrom(const Entry& entry, int base)
+{
+    size_t bytes = 0;
+    for (int level = std::max(base, 0); level < entry.chain.levelCount; level++)
+        bytes += entry.chain.levels[level].size;
+    return bytes;
+}
+
+void TextureResidency::setBase(Entry& entry, int base)
+{
+    glBindTexture(GL_TEXTURE_2D, entry.id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+    entry.base = base;
+    std::shared_ptr<TextureHandle> handle = entry.handle.lock();
+    if (handle)
+        handle->textureBytes = bytesFrom(entry, base);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "texturecache.hpp"
+#include "mappedfile.hpp"
+
+class Model;
+class TextureHandle;
+
+// Memory the managed textures hold and what moved since the manager was made
+struct ResidencyStats
+{
+    size_t textures = 0;        // managed textures with a cooked chain
+    size_t budgetBytes = 0;
+    size_t residentBytes = 0;   // levels in GL memory now
+    size_t wantedBytes = 0;     // what every texture at its wanted level would take
+    size_t limited = 0;         // textures held coarser than wanted by the budget
+    size_t evictedLevels = 0;   // levels freed since the manager was made
+    size_t restoredLevels = 0;  // levels brought back
+    size_t uploadedBytes = 0;   // bytes brought back
+};
+
+// Keeps the 2D textures it manages within a GL memory budget. Each frame
+// the objects drawn say how far away they are, which gives the finest mip
+// level each texture is worth on screen. Levels finer than that are freed
+// and GL_TEXTURE_BASE_LEVEL raised past them; when the wanted levels still
+// don't fit, the least recently used textures lose their finest levels
+// first, so a scene bigger than the budget blurs rather than fails. Freed
+// levels come back from the texture's mapped .cgtex a few per frame.
+class TextureResidency
+{
+public:
+    // fovY in radians, screenHeight in pixels
+    explicit TextureResidency(size_t budgetBytes, float fovY = glm::radians(45.0f), float screenHeight = 768.0f);
+
+    TextureResidency(const TextureResidency&) = delete;
+    TextureResidency& operator=(const TextureResidency&) = delete;
+
+    void setBudget(size_t bytes) { budgetBytes = bytes; }
+    void setView(float fovY, float screenHeight);
+
+    // track a texture from the loader, picked up once it is ready and
+    // forgotten once nothing else holds it; textures without a cooked chain
+    // to reload levels from are left whole
+    void manage(const std::shared_ptr<TextureHandle>& texture);
+
+    // an object this frame samples texture over worldSize units of surface
+    // seen from distance away; the nearest use of a texture counts
+    void use(unsigned int id, float distance, float worldSize);
+
+    // the same for every texture of a model drawn with transform, taking
+    // the texture to span the model's bounds once
+    void use(const Model& model, const glm::mat4& transform, const glm::vec3& eye);
+
+    // GL thread, once a frame: settle every texture's levels within the
+    // budget, freeing at once and restoring up to uploadBytes (at least one
+    // level) so streaming back in never stalls a frame
+    void update(size_t uploadBytes = 4 * 1024 * 1024);
+
+    // forget every texture, leaving them with whatever levels they have
+    void clear();
+
+    const ResidencyStats& stats() const { return counters; }
+
+private:
+    struct Entry
+    {
+        std::weak_ptr<TextureHandle> handle;   // weak, so ResourceManager::collect() can free it
+        unsigned int id = 0;
+        std::string path;
+        unsigned int uploads = 0;   // the handle's count when last mapped
+
+        MappedFile file;
+        TextureView chain;
+        bool mapped = false;
+        bool whole = false;     // no chain to reload from, left alone
+
+        int base = 0;           // finest level in GL memory
+        int wanted = 0;         // finest level worth having, from the last frame it was used
+        int nearest = 0;        // finest level asked for this frame
+        uint64_t lastUsed = 0;
+    };
+
+    size_t budgetBytes;
+    float focalPixels;      // screen pixels a unit spans one unit away
+    uint64_t frame = 1;
+    std::vector<std::unique_ptr<Entry>> entries;
+    std::unordered_map<unsigned int, Entry*> byId;
+    ResidencyStats counters;
+
+    // map the chain of a ready texture, false if it has none
+    bool map(Entry& entry);
+
+    // bytes of the levels from base down
+    static size_t bytesFrom(const Entry& entry, int base);
+
+    void setBase(Entry& entry, int base);
+};
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "threadpool.hpp"
+
+namespace
+{
+    // Workers for parallelFor; the caller of each loop is the last core
+    ThreadPool& loopPool()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    // One parallelFor call, outliving it in helpers that start too late
+    struct Loop
+    {
+        std::atomic<unsigned int> next{0};
+        unsigned int finished = 0;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    // Claim ranges until none are left; body is only touched for a claimed
+    // range, which the caller is still waiting on
+    void runRanges(Loop& loop, size_t count, unsigned int ranges, const std::function<void(size_t, size_t)>* body)
+    {
+        unsigned int ran = 0;
+        for (unsigned int i = loop.next.fetch_add(1); i < ranges; i = loop.next.fetch_add(1))
+        {
+            (*body)(count * i / ranges, count * (i + 1) / ranges);
+            ran++;
+        }
+        if (ran == 0)
+            return;
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        loop.finished += ran;
+        if (loop.finished == ranges)
+            loop.done.notify_all();
+    }
+}
+
+ThreadPool::ThreadPool(unsigned int threads)
+    : running(0), stopping(false)
+{
+    if (threads == 0)
+        threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    for (unsigned int i = 0; i < threads; i++)
+        workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    // Finish what is queued, then stop
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+size_t ThreadPool::busy() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return jobs.size() + running;
+}
+
+void ThreadPool::work()
+{
+    for (;;)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+                return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            running++;
+        }
+
+        job();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        running--;
+    }
+}
+
+void parallelFor(size_t count, unsigned int threads, const std::function<void(size_t, size_t)>& body)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned int ranges = static_cast<unsigned int>(std::min<size_t>(threads, count));
+    if (ranges <= 1)
+    {
+        body(0, count);
+        return;
+    }
+
+    // Ranges go to whoever asks first, so a pool busy with other loops only
+    // means the caller does more of the work itself
+    std::shared_ptr<Loop> loop = std::make_shared<Loop>();
+    const std::function<void(size_t, size_t)>* work = &body;
+    for (unsigned int i = 1; i < ranges; i++)
+        loopPool().submit([loop, count, ranges, work]() { runRanges(*loop, count, ranges, work); });
+    runRanges(*loop, count, ranges, work);
+
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->done.wait(lock, [&loop, ranges] { return loop->finished == ranges; });
+}
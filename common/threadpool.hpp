@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running submitted jobs in order of arrival
+class ThreadPool
+{
+public:
+    // threads = 0 uses every core but one, leaving that one to the render thread
+    explicit ThreadPool(unsigned int threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // queue a job, it runs on whichever worker is free first
+    void submit(std::function<void()> job);
+
+    // jobs queued or running
+    size_t busy() const;
+
+    size_t threadCount() const { return workers.size(); }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    size_t running;
+    bool stopping;
+
+    void work();
+};
+
+// Run body(begin, end) over [0, count) split into one contiguous range per
+// thread, on a pool shared by every caller so loops create no threads of
+// their own. The calling thread claims ranges too and returns once all of
+// them are done. threads = 0 uses every core, threads <= 1 runs inline.
+void parallelFor(size_t count, unsigned int threads, const std::function<void(size_t, size_t)>& body);
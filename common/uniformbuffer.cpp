@@ -0,0 +1,43 @@
+#include <stdio.h>
+
+#include <GL/glew.h>
+
+#include "uniformbuffer.hpp"
+
+bool UniformBuffer::create(UniformBlock block, size_t size)
+{
+    release();
+    GLint largest = 0;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &largest);
+    if (size == 0 || size > static_cast<size_t>(largest))
+    {
+        printf("Could not make a %zu byte %s uniform buffer\n", size, ShaderProgram::name(block));
+        return false;
+    }
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, block, buffer);
+    this->size = size;
+    return true;
+}
+
+void UniformBuffer::release()
+{
+    if (buffer != 0)
+        glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    size = 0;
+}
+
+void UniformBuffer::update(const void* data, size_t bytes)
+{
+    if (buffer == 0 || bytes > size)
+        return;
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, bytes, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <glm/glm.hpp>
+
+#include "shaderprogram.hpp"
+
+// The Camera block, std140: two column-major matrices
+struct CameraBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+};
+
+// The Lights block, std140: each vec3 takes 16 bytes, so the float after
+// the first fills its gap and the rest are padded
+struct LightBlock
+{
+    glm::vec3 direction;
+    float shininess;
+    glm::vec3 colour;
+    float padding0;
+    glm::vec3 ambient;
+    float padding1;
+    glm::vec3 specular;
+    float padding2;
+};
+
+static_assert(sizeof(CameraBlock) == 128, "CameraBlock must match the std140 layout");
+static_assert(sizeof(LightBlock) == 64, "LightBlock must match the std140 layout");
+
+// The buffer behind a shared uniform block, bound once to the block's
+// binding point so every program reads it without uniforms of its own;
+// switching programs re-sends nothing. Each update orphans the storage,
+// letting the driver hand out fresh memory rather than wait for draws
+// still reading the previous contents.
+class UniformBuffer
+{
+public:
+    UniformBuffer() {}
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    // GL thread: make a buffer of size bytes and bind it to block's point
+    bool create(UniformBlock block, size_t size);
+
+    // GL thread: free the buffer
+    void release();
+
+    // GL thread: replace the contents, bytes may be shorter than the buffer
+    void update(const void* data, size_t bytes);
+
+    template <typename Block>
+    void update(const Block& block) { update(&block, sizeof(Block)); }
+
+private:
+    unsigned int buffer = 0;
+    size_t size = 0;
+};
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#include <GL/glew.h>
+
+#include "uploadring.hpp"
+#include "image.hpp"
+
+namespace
+{
+    // Offsets suit any texel or block size
+    const size_t alignment = 256;
+
+    size_t alignUp(size_t value)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+UploadRing::UploadRing(size_t capacity)
+    : size(alignUp(capacity)), mapped(false), writers(0)
+{
+}
+
+UploadRing::~UploadRing()
+{
+    // Nothing may write into a mapping the context is about to take away
+    mapped.store(false, std::memory_order_release);
+}
+
+bool UploadRing::create()
+{
+    release();
+    if (!GLEW_ARB_buffer_storage)
+    {
+        printf("No ARB_buffer_storage, textures upload from client memory\n");
+        return false;
+    }
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+    memory = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (memory == nullptr)
+    {
+        printf("Could not map a %.1f MB upload ring\n", size / (1024.0 * 1024.0));
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        return false;
+    }
+
+    // Workers can't ask GL, so which blocks upload as they are is settled here
+    for (int format = BlockNone; format <= BlockBC5; format++)
+    {
+        TextureView shape;
+        shape.format = static_cast<BlockFormat>(format);
+        samplable[format] = Image::canSample(shape);
+    }
+
+    head = 0;
+    blocks.clear();
+    mapped.store(true, std::memory_order_release);
+    return true;
+}
+
+void UploadRing::release()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        mapped.store(false, std::memory_order_release);
+    }
+    while (writers.load(std::memory_order_acquire) > 0)
+        std::this_thread::yield();
+
+    for (Block& block : blocks)
+    {
+        if (block.fence)
+            glDeleteSync(static_cast<GLsync>(block.fence));
+    }
+    blocks.clear();
+    head = 0;
+    if (buffer != 0)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+    }
+    buffer = 0;
+    memory = nullptr;
+}
+
+bool UploadRing::reserve(size_t bytes, UploadSpan& span)
+{
+    bytes = alignUp(bytes);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!mapped.load(std::memory_order_acquire) || bytes == 0 || bytes > size)
+        return false;
+
+    // Free space runs from head up to the oldest reservation, or to the end
+    // and then round to it; a reservation that won't fit before the end
+    // skips what is left there
+    size_t offset = 0;
+    if (!blocks.empty())
+    {
+        size_t tail = blocks.front().offset;
+        if (head > tail && head + bytes <= size)
+            offset = head;
+        else if (head > tail && bytes <= tail)
+            offset = 0;
+        else if (head < tail && head + bytes <= tail)
+            offset = head;
+        else
+            return false;
+    }
+
+    Block block;
+    block.offset = offset;
+    block.size = bytes;
+    block.fence = nullptr;
+    block.submitted = false;
+    blocks.push_back(block);
+    head = offset + bytes;
+
+    span.data = memory + offset;
+    span.offset = offset;
+    span.size = bytes;
+    writers.fetch_add(1, std::memory_order_acquire);
+    return true;
+}
+
+bool UploadRing::stage(const TextureView& source, TextureView& staged, UploadSpan& span)
+{
+    if (!isMapped() || source.levelCount == 0)
+        return false;
+
+    // Levels the driver can't sample go in decoded
+    bool decode = source.format != BlockNone && !samplable[source.format];
+    int channels = decode ? BlockCompressor::channelCount(source.format) : source.channels;
+    size_t levelOffsets[TextureView::maxLevels];
+    size_t levelSizes[TextureView::maxLevels];
+    size_t bytes = 0;
+    for (int i = 0; i < source.levelCount; i++)
+    {
+        const MipView& level = source.levels[i];
+        levelOffsets[i] = bytes;
+        levelSizes[i] = decode ? size_t(level.width) * level.height * channels : level.size;
+        bytes = alignUp(bytes + levelSizes[i]);
+    }
+
+    bool written = write(bytes, span, [&](unsigned char* out) {
+        for (int i = 0; i < source.levelCount; i++)
+        {
+            const MipView& level = source.levels[i];
+            if (decode)
+            {
+                ImageData decoded;
+                BlockCompressor::decode(source.format, level.data, level.width, level.height, decoded);
+                memcpy(out + levelOffsets[i], decoded.pixels.data(), levelSizes[i]);
+            }
+            else
+            {
+                memcpy(out + levelOffsets[i], level.data, levelSizes[i]);
+            }
+        }
+    });
+    if (!written)
+        return false;
+
+    staged = source;
+    if (decode)
+    {
+        staged.format = BlockNone;
+        staged.channels = channels;
+    }
+    for (int i = 0; i < source.levelCount; i++)
+    {
+        staged.levels[i].data = reinterpret_cast<const unsigned char*>(span.offset + levelOffsets[i]);
+        staged.levels[i].size = levelSizes[i];
+    }
+    return true;
+}
+
+void UploadRing::bind() const
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+}
+
+void UploadRing::unbind() const
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void UploadRing::submit(const UploadSpan& span)
+{
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Block& block : blocks)
+    {
+        if (block.offset == span.offset && !block.submitted)
+        {
+            block.fence = fence;
+            block.submitted = true;
+            return;
+        }
+    }
+    glDeleteSync(fence);
+}
+
+void UploadRing::discard(const UploadSpan& span)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Block& block : blocks)
+    {
+        if (block.offset == span.offset && !block.submitted)
+        {
+            block.submitted = true;
+            return;
+        }
+    }
+}
+
+void UploadRing::retire()
+{
+    // In order, a later block can't free before an earlier one
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!blocks.empty() && blocks.front().submitted)
+    {
+        GLsync fence = static_cast<GLsync>(blocks.front().fence);
+        if (fence)
+        {
+            GLenum status = glClientWaitSync(fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            glDeleteSync(fence);
+        }
+        blocks.pop_front();
+    }
+    if (blocks.empty())
+        head = 0;
+}
+
+size_t UploadRing::used() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    for (const Block& block : blocks)
+        bytes += block.size;
+    return bytes;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+
+#include "texturecache.hpp"
+
+// Bytes reserved in an UploadRing; data is where to write them and offset
+// what to pass GL in place of a pointer while the ring is bound
+struct UploadSpan
+{
+    unsigned char* data = nullptr;
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+// A pixel unpack buffer mapped once for good (ARB_buffer_storage) and used
+// as a ring. Worker threads reserve space and write pixels or blocks
+// straight into it; the GL thread then uploads from buffer offsets, so the
+// driver neither copies client memory nor blocks on it. A fence after each
+// upload says when the GPU has read the bytes and the space can be reused.
+// A full ring makes callers fall back to uploading from client memory.
+class UploadRing
+{
+public:
+    explicit UploadRing(size_t capacity = 32 * 1024 * 1024);
+    ~UploadRing();
+
+    UploadRing(const UploadRing&) = delete;
+    UploadRing& operator=(const UploadRing&) = delete;
+
+    // GL thread: make and map the buffer, false when the driver can't
+    bool create();
+
+    // GL thread: wait for writers in progress, then unmap and delete
+    void release();
+
+    bool isMapped() const { return mapped.load(std::memory_order_acquire); }
+
+    // any thread: reserve bytes and let fill(unsigned char*) write them;
+    // false, without calling fill, when the ring is full or not mapped
+    template <typename Fill>
+    bool write(size_t bytes, UploadSpan& span, Fill fill)
+    {
+        if (!reserve(bytes, span))
+            return false;
+        fill(span.data);
+        writers.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    // any thread: copy every level of source into the ring, decoding blocks
+    // the driver can't sample; staged gets the same levels pointing at
+    // buffer offsets, ready for Image::upload with the ring bound
+    bool stage(const TextureView& source, TextureView& staged, UploadSpan& span);
+
+    // GL thread: bind as GL_PIXEL_UNPACK_BUFFER around the uploads
+    void bind() const;
+    void unbind() const;
+
+    // GL thread: the uploads reading span are issued, fence them
+    void submit(const UploadSpan& span);
+
+    // GL thread: span won't be uploaded after all, reuse it once the
+    // reservations before it are done
+    void discard(const UploadSpan& span);
+
+    // GL thread, once a frame: reuse space the GPU has finished reading
+    void retire();
+
+    // bytes reserved and not yet retired
+    size_t used() const;
+    size_t capacity() const { return size; }
+
+private:
+    struct Block
+    {
+        size_t offset;
+        size_t size;
+        void* fence;        // GLsync once submitted, null if discarded
+        bool submitted;
+    };
+
+    size_t size;
+    unsigned int buffer = 0;
+    unsigned char* memory = nullptr;
+    bool samplable[5] = {};     // per BlockFormat, known after create()
+
+    // reservations oldest first, space frees from the front
+    mutable std::mutex mutex;
+    std::deque<Block> blocks;
+    size_t head = 0;
+    std::atomic<bool> mapped;
+    std::atomic<int> writers;
+
+    bool reserve(size_t bytes, UploadSpan& span);
+};
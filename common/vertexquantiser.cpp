@@ -0,0 +1,144 @@
+#include <math.h>
+#include <algorithm>
+
+#include <glm/gtc/packing.hpp>
+
+#include "vertexquantiser.hpp"
+#include "meshcache.hpp"
+
+namespace
+{
+    int32_t quantiseSnorm(float value, int bits)
+    {
+        float maximum = float((1 << (bits - 1)) - 1);
+        return int32_t(roundf(glm::clamp(value, -1.0f, 1.0f) * maximum));
+    }
+
+    float dequantiseSnorm(int32_t value, int bits)
+    {
+        float maximum = float((1 << (bits - 1)) - 1);
+        return std::max(float(value) / maximum, -1.0f);
+    }
+
+    // Sign extend a field of a packed word
+    int32_t field(uint32_t packed, int shift, int bits)
+    {
+        int32_t value = int32_t(packed << (32 - shift - bits));
+        return value >> (32 - bits);
+    }
+
+    float angleDegrees(const glm::vec3& a, const glm::vec3& b)
+    {
+        float lengths = glm::length(a) * glm::length(b);
+        if (lengths == 0.0f)
+            return 0.0f;
+        float cosine = glm::clamp(glm::dot(a, b) / lengths, -1.0f, 1.0f);
+        return glm::degrees(acosf(cosine));
+    }
+
+    glm::vec3 safeNormalize(const glm::vec3& v)
+    {
+        float length = glm::length(v);
+        return length > 0.0f ? v / length : glm::vec3(0.0f);
+    }
+
+    glm::vec3 decodePosition(const CompactVertex& vertex, const glm::vec3& scale, const glm::vec3& offset)
+    {
+        glm::vec3 stored(glm::unpackUnorm1x16(vertex.position[0]),
+                         glm::unpackUnorm1x16(vertex.position[1]),
+                         glm::unpackUnorm1x16(vertex.position[2]));
+        return offset + scale * stored;
+    }
+}
+
+uint32_t VertexQuantiser::packSnorm1010102(const glm::vec4& v)
+{
+    uint32_t x = uint32_t(quantiseSnorm(v.x, 10)) & 0x3FF;
+    uint32_t y = uint32_t(quantiseSnorm(v.y, 10)) & 0x3FF;
+    uint32_t z = uint32_t(quantiseSnorm(v.z, 10)) & 0x3FF;
+    uint32_t w = uint32_t(quantiseSnorm(v.w, 2)) & 0x3;
+    return x | (y << 10) | (z << 20) | (w << 30);
+}
+
+glm::vec4 VertexQuantiser::unpackSnorm1010102(uint32_t packed)
+{
+    return glm::vec4(dequantiseSnorm(field(packed, 0, 10), 10),
+                     dequantiseSnorm(field(packed, 10, 10), 10),
+                     dequantiseSnorm(field(packed, 20, 10), 10),
+                     dequantiseSnorm(field(packed, 30, 2), 2));
+}
+
+void VertexQuantiser::encode(const MeshView& mesh, std::vector<CompactVertex>& out,
+                             glm::vec3& scale, glm::vec3& offset)
+{
+    // Per-mesh box the 16-bit positions are spread over
+    glm::vec3 minimum(0.0f), maximum(0.0f);
+    if (mesh.vertexCount > 0)
+    {
+        minimum = maximum = mesh.positions[0];
+        for (size_t i = 1; i < mesh.vertexCount; i++)
+        {
+            minimum = glm::min(minimum, mesh.positions[i]);
+            maximum = glm::max(maximum, mesh.positions[i]);
+        }
+    }
+    offset = minimum;
+    scale = maximum - minimum;
+    glm::vec3 inverseScale(scale.x > 0.0f ? 1.0f / scale.x : 0.0f,
+                           scale.y > 0.0f ? 1.0f / scale.y : 0.0f,
+                           scale.z > 0.0f ? 1.0f / scale.z : 0.0f);
+
+    out.resize(mesh.vertexCount);
+    for (size_t i = 0; i < mesh.vertexCount; i++)
+    {
+        CompactVertex& vertex = out[i];
+
+        glm::vec3 position = (mesh.positions[i] - offset) * inverseScale;
+        vertex.position[0] = glm::packUnorm1x16(position.x);
+        vertex.position[1] = glm::packUnorm1x16(position.y);
+        vertex.position[2] = glm::packUnorm1x16(position.z);
+        vertex.position[3] = 0;
+
+        vertex.normal = packSnorm1010102(glm::vec4(safeNormalize(mesh.normals[i]), 0.0f));
+
+        // Handedness stays in w so the shader can rebuild the bitangent
+        glm::vec4 tangent = mesh.tangents ? mesh.tangents[i] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        vertex.tangent = packSnorm1010102(glm::vec4(safeNormalize(glm::vec3(tangent)), tangent.w < 0.0f ? -1.0f : 1.0f));
+
+        vertex.uv[0] = glm::packHalf1x16(mesh.uvs[i].x);
+        vertex.uv[1] = glm::packHalf1x16(mesh.uvs[i].y);
+    }
+}
+
+QuantisationError VertexQuantiser::measure(const MeshView& mesh, const std::vector<CompactVertex>& vertices,
+                                           const glm::vec3& scale, const glm::vec3& offset)
+{
+    QuantisationError error;
+    double squaredPosition = 0.0;
+
+    for (size_t i = 0; i < vertices.size() && i < mesh.vertexCount; i++)
+    {
+        const CompactVertex& vertex = vertices[i];
+
+        float position = glm::length(decodePosition(vertex, scale, offset) - mesh.positions[i]);
+        error.maxPosition = std::max(error.maxPosition, position);
+        squaredPosition += double(position) * position;
+
+        glm::vec3 normal(unpackSnorm1010102(vertex.normal));
+        error.maxNormalDegrees = std::max(error.maxNormalDegrees, angleDegrees(normal, mesh.normals[i]));
+
+        if (mesh.tangents)
+        {
+            glm::vec3 tangent(unpackSnorm1010102(vertex.tangent));
+            error.maxTangentDegrees = std::max(error.maxTangentDegrees, angleDegrees(tangent, glm::vec3(mesh.tangents[i])));
+        }
+
+        glm::vec2 uv(glm::unpackHalf1x16(vertex.uv[0]), glm::unpackHalf1x16(vertex.uv[1]));
+        glm::vec2 uvError = glm::abs(uv - mesh.uvs[i]);
+        error.maxUV = std::max(error.maxUV, std::max(uvError.x, uvError.y));
+    }
+
+    if (!vertices.empty())
+        error.rmsPosition = float(sqrt(squaredPosition / double(vertices.size())));
+    return error;
+}
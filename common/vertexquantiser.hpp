@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+struct MeshView;
+
+// Interleaved 20-byte vertex, against 48 bytes for the float streams
+struct CompactVertex
+{
+    uint16_t position[4];   // unsigned normalized, decoded with a per-mesh scale/offset
+    uint32_t normal;        // signed normalized 10_10_10_2
+    uint32_t tangent;       // signed normalized 10_10_10_2, w holds the handedness
+    uint16_t uv[2];         // half floats
+};
+
+// Precision lost by the compact format, measured against the float streams
+struct QuantisationError
+{
+    float maxPosition = 0.0f;        // object space units
+    float rmsPosition = 0.0f;
+    float maxNormalDegrees = 0.0f;
+    float maxTangentDegrees = 0.0f;
+    float maxUV = 0.0f;
+};
+
+class VertexQuantiser
+{
+public:
+    // encode every vertex; positions decode as offset + scale * stored
+    static void encode(const MeshView& mesh, std::vector<CompactVertex>& out,
+                       glm::vec3& scale, glm::vec3& offset);
+
+    // decode the compact vertices again and compare with the source streams
+    static QuantisationError measure(const MeshView& mesh, const std::vector<CompactVertex>& vertices,
+                                     const glm::vec3& scale, const glm::vec3& offset);
+
+    // 10_10_10_2 packing as read by GL_INT_2_10_10_10_REV with normalization
+    static uint32_t packSnorm1010102(const glm::vec4& v);
+    static glm::vec4 unpackSnorm1010102(uint32_t packed);
+};
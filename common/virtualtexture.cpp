@@ -0,0 +1,506 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <thread>
+
+#include <GL/glew.h>
+
+#include "virtualtexture.hpp"
+#include "image.hpp"
+
+namespace
+{
+    // Feedback and page table texels hold tile positions in a byte
+    const int maxTilesPerSide = 256;
+
+    // Tile loads queued at once, the queue has room for all of them
+    const size_t maxLoading = 32;
+
+    uint32_t tileKey(int level, int y, int x)
+    {
+        return uint32_t(level) << 16 | uint32_t(y) << 8 | uint32_t(x);
+    }
+
+    int tileLevel(uint32_t key) { return int(key >> 16); }
+    int tileY(uint32_t key) { return int((key >> 8) & 0xff); }
+    int tileX(uint32_t key) { return int(key & 0xff); }
+
+    bool isPowerOfTwo(int value)
+    {
+        return value > 0 && (value & (value - 1)) == 0;
+    }
+
+    int wrap(int value, int size)
+    {
+        value %= size;
+        return value < 0 ? value + size : value;
+    }
+}
+
+VirtualTexture::VirtualTexture(int cacheSlots, int feedbackScale, unsigned int threads)
+    : cacheSlots(std::max(2, std::min(cacheSlots, maxTilesPerSide - 1))), feedbackScale(std::max(1, feedbackScale)),
+      finished(maxLoading * 2), stopping(false), pool(std::max(1u, threads))
+{
+}
+
+VirtualTexture::~VirtualTexture()
+{
+    // Queued loads return straight away, the pool then joins its workers
+    stopping.store(true, std::memory_order_release);
+}
+
+bool VirtualTexture::open(const char* path)
+{
+    release();
+
+    // Tiles are cut from the cooked chain, which stays mapped rather than read
+    ImageData image;
+    if (!TextureCache::fetch(path, file, texture, image))
+        return false;
+    if (texture.levelCount == 0)
+    {
+        printf("Virtual texture %s needs its .cgtex, which could not be written\n", path);
+        return false;
+    }
+    if (!isPowerOfTwo(texture.width) || !isPowerOfTwo(texture.height) ||
+        texture.width > maxTilesPerSide * tileTexels || texture.height > maxTilesPerSide * tileTexels)
+    {
+        printf("Virtual texture %s is %dx%d, sides must be powers of two up to %d\n", path, texture.width,
+               texture.height, maxTilesPerSide * tileTexels);
+        file.close();
+        texture = TextureView();
+        return false;
+    }
+
+    // The tail is the first level small enough for one tile
+    tailLevel = 0;
+    while (tailLevel < texture.levelCount - 1 &&
+           (texture.levels[tailLevel].width > tileTexels || texture.levels[tailLevel].height > tileTexels))
+        tailLevel++;
+    if (texture.levels[tailLevel].width > tileTexels || texture.levels[tailLevel].height > tileTexels)
+    {
+        printf("Virtual texture %s has no level that fits in a tile\n", path);
+        file.close();
+        texture = TextureView();
+        return false;
+    }
+    sourcePath = path;
+
+    // Blocks the driver can't sample are decoded as tiles are cut
+    tileFormat = TextureView();
+    tileFormat.format = Image::canSample(texture) ? texture.format : BlockNone;
+    tileFormat.channels = texture.format == BlockNone ? texture.channels : BlockCompressor::channelCount(texture.format);
+    cache = Image::createRegionTexture(tileFormat, cacheSlots * slotTexels, cacheSlots * slotTexels);
+    if (cache == 0)
+    {
+        file.close();
+        texture = TextureView();
+        return false;
+    }
+
+    // One page table level per tiled level, nearest so entries never blend
+    glGenTextures(1, &pageTable);
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    pages.resize(tailLevel + 1);
+    for (int level = 0; level <= tailLevel; level++)
+    {
+        int width = std::max(1, texture.levels[level].width / tileTexels);
+        int height = std::max(1, texture.levels[level].height / tileTexels);
+        pages[level].assign(size_t(width) * height * 4, 0);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tailLevel);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    // The tail and the levels below it are small enough to keep whole
+    TextureView tail = texture;
+    tail.width = texture.levels[tailLevel].width;
+    tail.height = texture.levels[tailLevel].height;
+    tail.levelCount = texture.levelCount - tailLevel;
+    for (int level = 0; level < tail.levelCount; level++)
+        tail.levels[level] = texture.levels[tailLevel + level];
+    tailTexture = Image::upload(tail);
+
+    // The tail also goes in slot 0 for good, so pages always find a tile
+    slots.assign(size_t(cacheSlots) * cacheSlots, Slot());
+    Tile tailTile;
+    tailTile.key = tileKey(tailLevel, 0, 0);
+    tailTile.data.resize(tileBytes());
+    cutTile(tailTile.key, tailTile.data.data());
+    uploadTile(0, tailTile);
+    slots[0].key = tailTile.key;
+    slots[0].used = true;
+    residentTiles[tailTile.key] = 0;
+    pagesDirty = true;
+    refreshPages();
+
+    slotBytes = tileBytes();
+    counters = VirtualTextureStats();
+    counters.slots = slots.size();
+    counters.resident = 1;
+    tailBytes = tail.bytes();
+    counters.residentBytes = slotBytes + tailBytes;
+    counters.cacheBytes = slotBytes * slots.size() + tailBytes;
+    counters.sourceBytes = texture.bytes();
+    printf("Virtual texture %s: %dx%d in %d tiled levels, %zu slot cache (%.1f MB, the chain is %.1f MB)\n", path,
+           texture.width, texture.height, tailLevel + 1, slots.size(), counters.cacheBytes / (1024.0 * 1024.0),
+           counters.sourceBytes / (1024.0 * 1024.0));
+    return true;
+}
+
+void VirtualTexture::release()
+{
+    // Let loads in flight finish with the mapping before it goes
+    stopping.store(true, std::memory_order_release);
+    while (pool.busy() > 0)
+        std::this_thread::yield();
+    std::shared_ptr<Tile> tile;
+    while (finished.pop(tile))
+    {
+        if (tile->span.size > 0)
+            uploadRing->discard(tile->span);
+    }
+    stopping.store(false, std::memory_order_release);
+
+    glDeleteTextures(1, &cache);
+    glDeleteTextures(1, &pageTable);
+    glDeleteTextures(1, &tailTexture);
+    glDeleteFramebuffers(1, &feedbackFramebuffer);
+    glDeleteRenderbuffers(1, &feedbackColour);
+    glDeleteRenderbuffers(1, &feedbackDepth);
+    glDeleteBuffers(2, readBuffers);
+    cache = 0;
+    pageTable = 0;
+    tailTexture = 0;
+    feedbackFramebuffer = 0;
+    feedbackColour = 0;
+    feedbackDepth = 0;
+    readBuffers[0] = readBuffers[1] = 0;
+    feedbackWidth = 0;
+    feedbackHeight = 0;
+    readQueued = false;
+
+    slots.clear();
+    residentTiles.clear();
+    loading.clear();
+    pages.clear();
+    file.close();
+    texture = TextureView();
+}
+
+void VirtualTexture::bind(const ShaderProgram& program, int cacheUnit, int pageUnit, int tailUnit) const
+{
+    glActiveTexture(GL_TEXTURE0 + cacheUnit);
+    glBindTexture(GL_TEXTURE_2D, cache);
+    glActiveTexture(GL_TEXTURE0 + pageUnit);
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    glActiveTexture(GL_TEXTURE0 + tailUnit);
+    glBindTexture(GL_TEXTURE_2D, tailTexture);
+
+    float cacheSize = static_cast<float>(cacheSlots * slotTexels);
+    program.set(UniformVirtualCache, cacheUnit);
+    program.set(UniformVirtualPages, pageUnit);
+    program.set(UniformVirtualTailMap, tailUnit);
+    program.set(UniformVirtualSize, glm::vec2(static_cast<float>(texture.width), static_cast<float>(texture.height)));
+    program.set(UniformVirtualTail, static_cast<float>(tailLevel));
+    program.set(UniformVirtualCacheSize, glm::vec2(cacheSize, cacheSize));
+}
+
+void VirtualTexture::beginFeedback(const ShaderProgram& program, int screenWidth, int screenHeight)
+{
+    int width = std::max(1, screenWidth / feedbackScale);
+    int height = std::max(1, screenHeight / feedbackScale);
+    if (width != feedbackWidth || height != feedbackHeight)
+    {
+        if (feedbackFramebuffer == 0)
+        {
+            glGenFramebuffers(1, &feedbackFramebuffer);
+            glGenRenderbuffers(1, &feedbackColour);
+            glGenRenderbuffers(1, &feedbackDepth);
+            glGenBuffers(2, readBuffers);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackColour);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColour);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+        for (int i = 0; i < 2; i++)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readBuffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, size_t(width) * height * 4, NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        feedbackWidth = width;
+        feedbackHeight = height;
+        readQueued = false;
+    }
+
+    glGetIntegerv(GL_VIEWPORT, savedViewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, savedClear);
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+    glViewport(0, 0, feedbackWidth, feedbackHeight);
+
+    // Alpha 0 marks pixels that sample nothing
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Derivatives are feedbackScale times larger at this size
+    glUseProgram(program.id());
+    bind(program);
+    program.set(UniformFeedbackBias, -log2f(static_cast<float>(feedbackScale)));
+}
+
+void VirtualTexture::endFeedback()
+{
+    frame++;
+
+    // Queue this frame's read and take the last one, which has had a frame to land
+    int current = static_cast<int>(frame & 1);
+    size_t bytes = size_t(feedbackWidth) * feedbackHeight * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readBuffers[current]);
+    glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    if (readQueued)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readBuffers[1 - current]);
+        const unsigned char* pixels = static_cast<const unsigned char*>(
+            glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT));
+        if (pixels)
+        {
+            requestTiles(pixels, size_t(feedbackWidth) * feedbackHeight);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+    }
+    readQueued = true;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+    glClearColor(savedClear[0], savedClear[1], savedClear[2], savedClear[3]);
+}
+
+void VirtualTexture::requestTiles(const unsigned char* feedback, size_t pixels)
+{
+    // Each tile once, with its parent, which trilinear filtering blends in
+    std::vector<uint32_t> keys;
+    for (size_t i = 0; i < pixels; i++)
+    {
+        const unsigned char* pixel = feedback + i * 4;
+        int level = pixel[2];
+        if (pixel[3] == 0 || level > tailLevel)
+            continue;
+        int x = std::min<int>(pixel[0], std::max(1, texture.levels[level].width / tileTexels) - 1);
+        int y = std::min<int>(pixel[1], std::max(1, texture.levels[level].height / tileTexels) - 1);
+        keys.push_back(tileKey(level, y, x));
+        if (level < tailLevel)
+            keys.push_back(tileKey(level + 1, y / 2, x / 2));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    counters.requested = keys.size();
+    counters.hits = 0;
+    counters.misses = 0;
+    std::vector<uint32_t> missing;
+    for (uint32_t key : keys)
+    {
+        std::unordered_map<uint32_t, int>::iterator resident = residentTiles.find(key);
+        if (resident != residentTiles.end())
+        {
+            slots[resident->second].lastUsed = frame;
+            counters.hits++;
+            continue;
+        }
+        counters.misses++;
+        if (loading.find(key) == loading.end())
+            missing.push_back(key);
+    }
+    counters.totalHits += counters.hits;
+    counters.totalMisses += counters.misses;
+
+    // Coarse levels first, they cover the most and unblock the fine ones
+    std::stable_sort(missing.begin(), missing.end(),
+                     [](uint32_t a, uint32_t b) { return tileLevel(a) > tileLevel(b); });
+    for (size_t i = 0; i < missing.size() && loading.size() < maxLoading; i++)
+    {
+        uint32_t key = missing[i];
+        loading.insert(key);
+        pool.submit([this, key]() {
+            if (stopping.load(std::memory_order_acquire))
+                return;
+            std::shared_ptr<Tile> tile = std::make_shared<Tile>();
+            tile->key = key;
+
+            // Straight into the ring if there is room, else into memory of its own
+            if (!uploadRing || !uploadRing->write(tileBytes(), tile->span, [&](unsigned char* out) { cutTile(key, out); }))
+            {
+                tile->data.resize(tileBytes());
+                cutTile(key, tile->data.data());
+            }
+            while (!finished.push(tile))
+            {
+                if (stopping.load(std::memory_order_acquire))
+                    return;
+                std::this_thread::yield();
+            }
+        });
+    }
+}
+
+void VirtualTexture::update(size_t maxUploads)
+{
+    std::shared_ptr<Tile> tile;
+    for (size_t uploaded = 0; uploaded < maxUploads && finished.pop(tile); uploaded++)
+    {
+        loading.erase(tile->key);
+
+        // A free slot, or else the least recently seen tile not seen this frame
+        int slot = -1;
+        uint64_t oldest = frame;
+        for (int i = 1; i < static_cast<int>(slots.size()); i++)
+        {
+            if (!slots[i].used)
+            {
+                slot = i;
+                break;
+            }
+            if (slots[i].lastUsed < oldest)
+            {
+                oldest = slots[i].lastUsed;
+                slot = i;
+            }
+        }
+        if (slot < 0)
+        {
+            if (tile->span.size > 0)
+                uploadRing->discard(tile->span);
+            counters.dropped++;
+            continue;
+        }
+        if (slots[slot].used)
+        {
+            residentTiles.erase(slots[slot].key);
+            counters.evictions++;
+        }
+
+        uploadTile(slot, *tile);
+        slots[slot].key = tile->key;
+        slots[slot].lastUsed = frame;
+        slots[slot].used = true;
+        residentTiles[tile->key] = slot;
+        counters.uploads++;
+        pagesDirty = true;
+    }
+
+    if (pagesDirty)
+        refreshPages();
+    counters.resident = residentTiles.size();
+    counters.residentBytes = counters.resident * slotBytes + tailBytes;
+}
+
+size_t VirtualTexture::tileBytes() const
+{
+    return tileFormat.format != BlockNone ? BlockCompressor::compressedSize(tileFormat.format, slotTexels, slotTexels)
+                                          : size_t(slotTexels) * slotTexels * tileFormat.channels;
+}
+
+void VirtualTexture::cutTile(uint32_t key, unsigned char* out) const
+{
+    // Whole blocks for compressed levels, the border is exactly one block
+    const MipView& level = texture.levels[tileLevel(key)];
+    bool blocks = texture.format != BlockNone;
+    int unit = blocks ? 4 : 1;
+    size_t unitBytes = blocks ? BlockCompressor::blockBytes(texture.format) : size_t(texture.channels);
+    int unitsX = (level.width + unit - 1) / unit;
+    int unitsY = (level.height + unit - 1) / unit;
+    int slotUnits = slotTexels / unit;
+    int firstX = (tileX(key) * tileTexels - borderTexels) / unit;
+    int firstY = (tileY(key) * tileTexels - borderTexels) / unit;
+
+    // Blocks to decode are gathered first
+    bool decode = blocks && tileFormat.format == BlockNone;
+    std::vector<unsigned char> gathered(decode ? size_t(slotUnits) * slotUnits * unitBytes : 0);
+    unsigned char* cut = decode ? gathered.data() : out;
+
+    // Rows wrap like the sampler; the level's own rows are contiguous runs
+    for (int y = 0; y < slotUnits; y++)
+    {
+        const unsigned char* row = level.data + size_t(wrap(firstY + y, unitsY)) * unitsX * unitBytes;
+        unsigned char* target = cut + size_t(y) * slotUnits * unitBytes;
+        for (int x = 0; x < slotUnits;)
+        {
+            int source = wrap(firstX + x, unitsX);
+            int run = std::min(slotUnits - x, unitsX - source);
+            memcpy(target + size_t(x) * unitBytes, row + size_t(source) * unitBytes, size_t(run) * unitBytes);
+            x += run;
+        }
+    }
+
+    if (decode)
+    {
+        ImageData decoded;
+        BlockCompressor::decode(texture.format, gathered.data(), slotTexels, slotTexels, decoded);
+        memcpy(out, decoded.pixels.data(), decoded.pixels.size());
+    }
+}
+
+void VirtualTexture::uploadTile(int slot, const Tile& tile)
+{
+    int x = (slot % cacheSlots) * slotTexels;
+    int y = (slot / cacheSlots) * slotTexels;
+    if (tile.span.size > 0)
+    {
+        uploadRing->bind();
+        Image::uploadRegion(tileFormat, cache, x, y, slotTexels, slotTexels,
+                            reinterpret_cast<const unsigned char*>(tile.span.offset), tileBytes());
+        uploadRing->unbind();
+        uploadRing->submit(tile.span);
+    }
+    else
+    {
+        Image::uploadRegion(tileFormat, cache, x, y, slotTexels, slotTexels, tile.data.data(), tile.data.size());
+    }
+}
+
+void VirtualTexture::refreshPages()
+{
+    // Coarse to fine, so a tile that isn't resident copies its parent's entry
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = tailLevel; level >= 0; level--)
+    {
+        int width = std::max(1, texture.levels[level].width / tileTexels);
+        int height = std::max(1, texture.levels[level].height / tileTexels);
+        int parentWidth = level < tailLevel ? std::max(1, texture.levels[level + 1].width / tileTexels) : 1;
+        int parentHeight = level < tailLevel ? std::max(1, texture.levels[level + 1].height / tileTexels) : 1;
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                unsigned char* entry = &pages[level][(size_t(y) * width + x) * 4];
+                std::unordered_map<uint32_t, int>::const_iterator resident = residentTiles.find(tileKey(level, y, x));
+                if (resident != residentTiles.end())
+                {
+                    entry[0] = static_cast<unsigned char>(resident->second % cacheSlots);
+                    entry[1] = static_cast<unsigned char>(resident->second / cacheSlots);
+                    entry[2] = static_cast<unsigned char>(level);
+                    entry[3] = 255;
+                }
+                else if (level < tailLevel)
+                {
+                    int parentX = std::min(x / 2, parentWidth - 1);
+                    int parentY = std::min(y / 2, parentHeight - 1);
+                    memcpy(entry, &pages[level + 1][(size_t(parentY) * parentWidth + parentX) * 4], 4);
+                }
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pages[level].data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    pagesDirty = false;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "texturecache.hpp"
+#include "mappedfile.hpp"
+#include "mpmcqueue.hpp"
+#include "threadpool.hpp"
+#include "uploadring.hpp"
+#include "shaderprogram.hpp"
+
+// Tile counts for the last feedback and totals since open()
+struct VirtualTextureStats
+{
+    size_t requested = 0;       // distinct tiles the last feedback asked for
+    size_t hits = 0;            // of those, already resident
+    size_t misses = 0;          // of those, not yet resident
+    size_t resident = 0;        // tiles in the cache, the mip tail included
+    size_t slots = 0;           // tiles the cache can hold
+    size_t uploads = 0;         // tiles copied into the cache since open()
+    size_t evictions = 0;       // tiles pushed out for newer ones since open()
+    size_t dropped = 0;         // loaded tiles with nowhere to go since open()
+    size_t totalHits = 0;       // hits and misses summed over every feedback
+    size_t totalMisses = 0;
+    size_t residentBytes = 0;   // cache memory holding tiles
+    size_t cacheBytes = 0;      // cache memory in all
+    size_t sourceBytes = 0;     // the whole mip chain, what loading it outright costs
+
+    double hitRate() const
+    {
+        return totalHits + totalMisses == 0 ? 1.0 : double(totalHits) / double(totalHits + totalMisses);
+    }
+};
+
+// Sparse texture for images too big to keep whole. The cooked mip chain is
+// only mapped, and cut into 128 texel tiles that are copied on demand into
+// a fixed cache texture with a 4 texel border for filtering. A page table
+// with one texel per tile says which cache slot holds it, or else where its
+// nearest resident ancestor is, so sampling never misses, only blurs.
+//
+// Which tiles are needed comes from a feedback pass: the geometry is drawn
+// at a fraction of the screen size writing the tile each pixel samples, and
+// read back a frame later without stalling. Misses are copied out of the
+// mapped file on worker threads, coarse levels first, and the least
+// recently seen tiles make room. Levels from the one that fits in a single
+// tile (the tail) down are always resident, as an ordinary mipmapped texture
+// for footprints coarser than any tile. Sizes must be powers of two.
+class VirtualTexture
+{
+public:
+    static const int tileTexels = 128;
+    static const int borderTexels = 4;
+    static const int slotTexels = tileTexels + 2 * borderTexels;
+
+    // cacheSlots tiles on a side; feedbackScale is how much smaller than the
+    // screen the feedback pass is drawn
+    explicit VirtualTexture(int cacheSlots = 8, int feedbackScale = 8, unsigned int threads = 1);
+    ~VirtualTexture();
+
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    // GL thread: map the cooked chain of an image, cooking it first if
+    // needed, and make the cache with the mip tail in it
+    bool open(const char* path);
+
+    // GL thread: free the GL objects and unmap the chain
+    void release();
+
+    bool isOpen() const { return cache != 0; }
+
+    // GL thread: bind the cache and page table and set the virtual* uniforms
+    // of program (the shaders' virtualTexture() and feedback need them)
+    void bind(const ShaderProgram& program, int cacheUnit = 3, int pageUnit = 4, int tailUnit = 5) const;
+
+    // GL thread: draw the feedback pass between these, with a program using
+    // feedbackFragment.glsl; the screen size is the full resolution one
+    void beginFeedback(const ShaderProgram& program, int screenWidth, int screenHeight);
+    void endFeedback();
+
+    // GL thread: copy up to maxUploads loaded tiles into the cache and
+    // refresh the page table if anything moved
+    void update(size_t maxUploads = 16);
+
+    // tiles loaded from now on are cut straight into ring when it has room;
+    // the ring must outlive the texture
+    void setUploadRing(UploadRing* ring) { uploadRing = ring; }
+
+    const VirtualTextureStats& stats() const { return counters; }
+
+private:
+    // A tile is its level and position packed as level << 16 | y << 8 | x;
+    // its texels are in span when the ring had room, else in data
+    struct Tile
+    {
+        uint32_t key;
+        std::vector<unsigned char> data;
+        UploadSpan span;
+    };
+
+    struct Slot
+    {
+        uint32_t key = 0;
+        uint64_t lastUsed = 0;
+        bool used = false;
+    };
+
+    int cacheSlots;
+    int feedbackScale;
+    std::string sourcePath;
+
+    // the mapped chain, and the format tiles are uploaded in (no levels)
+    MappedFile file;
+    TextureView texture;
+    TextureView tileFormat;
+    int tailLevel = 0;
+
+    // GL objects
+    unsigned int cache = 0;
+    unsigned int pageTable = 0;
+    unsigned int tailTexture = 0;
+    unsigned int feedbackFramebuffer = 0;
+    unsigned int feedbackColour = 0;
+    unsigned int feedbackDepth = 0;
+    unsigned int readBuffers[2] = {};
+    int feedbackWidth = 0;
+    int feedbackHeight = 0;
+    int savedViewport[4] = {};
+    float savedClear[4] = {};
+    bool readQueued = false;
+    uint64_t frame = 0;
+
+    // residency, slot 0 holds the tail
+    std::vector<Slot> slots;
+    std::unordered_map<uint32_t, int> residentTiles;
+    std::unordered_set<uint32_t> loading;
+    std::vector<std::vector<unsigned char>> pages;   // page table texels per level
+    bool pagesDirty = false;
+    size_t slotBytes = 0;
+    UploadRing* uploadRing = nullptr;
+    size_t tailBytes = 0;
+    VirtualTextureStats counters;
+
+    // The pool is declared last so its workers stop before the rest goes away
+    MpmcQueue<std::shared_ptr<Tile>> finished;
+    std::atomic<bool> stopping;
+    ThreadPool pool;
+
+    // worker safe: copy one tile and its border out of the mapped chain,
+    // tileBytes() of them in the cache's format
+    void cutTile(uint32_t key, unsigned char* out) const;
+    size_t tileBytes() const;
+
+    void requestTiles(const unsigned char* feedback, size_t pixels);
+    void uploadTile(int slot, const Tile& tile);
+    void refreshPages();
+};
@@ -16,6 +16,14 @@
 #include <common/camera.hpp>
 #include <common/model.hpp>
 #include <common/light.hpp>
+#include <common/assetloader.hpp>
+#include <common/hotreloader.hpp>
+#include <common/resourcemanager.hpp>
+#include <common/assetpack.hpp>
+#include <common/materiallibrary.hpp>
+#include <common/virtualtexture.hpp>
+#include <common/uploadring.hpp>
+#include <common/uniformbuffer.hpp>
 
 // Function prototypes
 void keyboardInput(GLFWwindow *window);
@@ -138,12 +146,59 @@ int main( void )
         glm::vec3 scale;
         float angle;
         std::string name;
+        std::shared_ptr<MaterialHandle> material;
     };
 
+    // A cooked pack (cg_cook --pack) replaces the loose cooked files; the
+    // demo hot reloads, so sources edited since the cook are read loose
+    AssetPack pack;
+    if (pack.open("../assets/assets.cgpak", true))
+    {
+        printf("Mounted ../assets/assets.cgpak, %zu assets\n", pack.entryCount());
+        AssetPack::mount(&pack);
+    }
+
+    // Workers copy texture levels straight into a mapped buffer, so the GL
+    // thread only points uploads at it; declared first so it outlives them
+    UploadRing uploadRing;
+    uploadRing.create();
+
+    // Assets load on worker threads and reload when their files change
+    AssetLoader loader;
+    loader.setUploadRing(&uploadRing);
+    HotReloader reloader(loader);
+    ResourceManager resources(loader, &reloader);
+
+    // Request every material up front so the maps decode side by side on the
+    // workers while the shaders compile; cubes are skipped until theirs is in
+    MaterialLibrary materials(loader, &reloader);
+    resources.setMaterials(&materials);
+    std::shared_ptr<MaterialHandle> cobblestone = materials.material("../assets/cobblestone.png",
+        "../assets/pathstone_normalmap.png", "../assets/pathstone_specularmap.png");
+    std::shared_ptr<MaterialHandle> pathstone = materials.material("../assets/pathstone.png",
+        "../assets/pathstone_normalmap.png", "../assets/pathstone_specularmap.png");
+
+    // A sphere drawn down a row at growing distances, so each copy picks a
+    // coarser level of detail
+    std::shared_ptr<ModelHandle> sphereModel = resources.model("../assets/sphere.obj");
+
     // Load and Use Shaders
-    GLuint shaderProgram = LoadShaders("vertexShader.glsl", "fragmentShader.glsl");
+    std::shared_ptr<ShaderHandle> shader = resources.shader("vertexShader.glsl", "fragmentShader.glsl");
+    std::shared_ptr<ShaderHandle> feedbackShader = resources.shader("vertexShader.glsl", "feedbackFragment.glsl");
+    if (!loader.wait(shader) || !loader.wait(feedbackShader))
+    {
+        fprintf(stderr, "Failed to build the shaders.\n");
+        glfwTerminate();
+        return -1;
+    }
+    GLuint shaderProgram = shader->program;
     glUseProgram(shaderProgram);
 
+    // The ground's colour is streamed a tile at a time as the camera needs it
+    VirtualTexture virtualGround;
+    virtualGround.setUploadRing(&uploadRing);
+    virtualGround.open("../assets/pathstone.png");
+
     // Create VAO
     GLuint VAO; 
     glGenVertexArrays(1, &VAO);
@@ -197,97 +252,50 @@ int main( void )
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-    // Load texture
-    GLuint texture;
-    glGenTextures(1, &texture); 
-    glBindTexture(GL_TEXTURE_2D, texture); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); 
-
-    int width, height, nChannels;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char* data = stbi_load("../assets/cobblestone.png", &width, &height, &nChannels, 0);
-    if (data) {
-        GLenum format = (nChannels == 4) ? GL_RGBA : GL_RGB;
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else {
-        std::cout << "Failed to load texture\n";
-    }
-    stbi_image_free(data);
-
-    // Set texture uniform
-    glUseProgram(shaderProgram); 
-    glUniform1i(glGetUniformLocation(shaderProgram, "textureMap"), 0); 
- 
-    // Load normal map
-    GLuint normalMap; 
-    glGenTextures(1, &normalMap); 
-    glBindTexture(GL_TEXTURE_2D, normalMap); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); 
-
-    int normalWidth, normalHeight, normalChannels; 
-    stbi_set_flip_vertically_on_load(true); 
-    unsigned char* normalData = stbi_load("../assets/pathstone_normalmap.png", &normalWidth, &normalHeight, &normalChannels, 0); 
-    if (normalData) { 
-        GLenum normalFormat = (normalChannels == 4) ? GL_RGBA : GL_RGB; 
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, normalWidth, normalHeight, 0, normalFormat, GL_UNSIGNED_BYTE, normalData); 
-        glGenerateMipmap(GL_TEXTURE_2D); 
-    }
-    else {
-        std::cout << "Failed to load normal map\n"; 
-    }
-    stbi_image_free(normalData); 
-
-    // Load diffuse map 
-    GLuint diffuseMap; 
-    glGenTextures(1, &diffuseMap); 
-    glBindTexture(GL_TEXTURE_2D, diffuseMap); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); 
-
-    int diffuseWidth, diffuseHeight, diffuseChannels; 
-    stbi_set_flip_vertically_on_load(true); 
-    unsigned char* diffuseData = stbi_load("../assets/pathstone_diffusemap.png", &diffuseWidth, &diffuseHeight, &diffuseChannels, 0); 
-    if (diffuseData) { 
-        GLenum diffuseFormat = (diffuseChannels == 4) ? GL_RGBA : GL_RGB; 
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, diffuseWidth, diffuseHeight, 0, diffuseFormat, GL_UNSIGNED_BYTE, diffuseData); 
-        glGenerateMipmap(GL_TEXTURE_2D); 
-    }
-    else { 
-        std::cout << "Failed to load diffuse map\n"; 
-    }
-    stbi_image_free(diffuseData); 
-
-    // Load specular map
-    GLuint specularMap; 
-    glGenTextures(1, &specularMap); 
-    glBindTexture(GL_TEXTURE_2D, specularMap); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT); 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);  
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); 
-
-    int specularWidth, specularHeight, specularChannels; 
-    stbi_set_flip_vertically_on_load(true); 
-    unsigned char* specularData = stbi_load("../assets/pathstone_specularmap.png", &specularWidth, &specularHeight, &specularChannels, 0);
-    if (specularData) { 
-        GLenum specularFormat = (specularChannels == 4) ? GL_RGBA : GL_RGB; 
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, specularWidth, specularHeight, 0, specularFormat, GL_UNSIGNED_BYTE, specularData); 
-        glGenerateMipmap(GL_TEXTURE_2D); 
-    }
-    else { 
-        std::cout << "Failed to load specular map\n"; 
-    }
-    stbi_image_free(specularData); 
+    // Ground plane under the cubes, the texture repeating every 5 units
+    const float groundVertices[] = {
+        -20, -3, -30,   30, -3, -30,   30, -3, 20,   -20, -3, 20,
+    };
+    const float groundUV[] = {
+        0, 0,  10, 0,  10, 10,  0, 10,
+    };
+    const float groundNormals[] = {
+        0,1,0,  0,1,0,  0,1,0,  0,1,0,
+    };
+    const float groundTangents[] = {
+        1,0,0,1,  1,0,0,1,  1,0,0,1,  1,0,0,1,
+    };
+    const unsigned int groundIndices[] = {
+        0, 1, 2,  2, 3, 0,
+    };
+
+    GLuint groundVAO;
+    glGenVertexArrays(1, &groundVAO);
+    glBindVertexArray(groundVAO);
+
+    unsigned int groundBuffers[5];
+    glGenBuffers(5, groundBuffers);
+    glBindBuffer(GL_ARRAY_BUFFER, groundBuffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(groundVertices), groundVertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, groundBuffers[1]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(groundUV), groundUV, GL_STATIC_DRAW);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ARRAY_BUFFER, groundBuffers[2]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(groundNormals), groundNormals, GL_STATIC_DRAW);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(3);
+    glBindBuffer(GL_ARRAY_BUFFER, groundBuffers[3]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(groundTangents), groundTangents, GL_STATIC_DRAW);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(4);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, groundBuffers[4]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(groundIndices), groundIndices, GL_STATIC_DRAW);
+
+    bool reported = false;
+    float lastCollect = 0.0f;
 
     // Camera setup
     Camera camera(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.0f, 0.0f, -2.0f)); 
@@ -313,9 +321,20 @@ int main( void )
 
     std::vector<Object> objects;
     for (int i = 0; i < 10; ++i) {
-        objects.push_back({ positions[i], glm::vec3(1.0f), glm::vec3(0.5f), Maths::radians(20.0f * i), "cube" });
+        objects.push_back({ positions[i], glm::vec3(1.0f), glm::vec3(0.5f), Maths::radians(20.0f * i), "cube",
+                            i % 2 == 0 ? cobblestone : pathstone });
     }
 
+    // Cubes sharing a material page go out in one instanced draw
+    MaterialBatch batch;
+
+    // Spheres to the left of the cubes, running away from the camera
+    std::vector<glm::vec3> spherePositions;
+    for (int i = 0; i < 6; ++i)
+        spherePositions.push_back(glm::vec3(-3.0f, -2.0f, -5.0f - 8.0f * i));
+    LodStats sphereStats;
+    size_t frames = 0;
+
     // light setup
     glm::vec3 lightDirection(0.0f, -1.0f, 0.0f);  
     glm::vec3 lightColour(1.0f, 1.0f, 1.0f);
@@ -323,14 +342,47 @@ int main( void )
     glm::vec3 specularColour(1.0f, 1.0f, 1.0f); 
     float shininess = 32.0f; 
 
-    // Send light data to shaders
-    GLuint programID = shaderProgram;
-
-    glUniform3fv(glGetUniformLocation(programID, "lightDirection"), 1, glm::value_ptr(lightDirection));
-    glUniform3fv(glGetUniformLocation(programID, "lightColour"), 1, glm::value_ptr(lightColour)); 
-    glUniform3fv(glGetUniformLocation(programID, "ambientColour"), 1, glm::value_ptr(ambientColour));  
-    glUniform3fv(glGetUniformLocation(programID, "specularColour"), 1, glm::value_ptr(specularColour));  
-    glUniform1f(glGetUniformLocation(programID, "shininess"), shininess); 
+    // Camera and light state sit in uniform blocks every program shares,
+    // so switching programs sends none of it again
+    UniformBuffer cameraBuffer;
+    cameraBuffer.create(UniformBlockCamera, sizeof(CameraBlock));
+    UniformBuffer lightBuffer;
+    lightBuffer.create(UniformBlockLights, sizeof(LightBlock));
+
+    // The lights don't move, one update does
+    LightBlock lights = {};
+    lights.direction = lightDirection;
+    lights.shininess = shininess;
+    lights.colour = lightColour;
+    lights.ambient = ambientColour;
+    lights.specular = specularColour;
+    lightBuffer.update(lights);
+
+    // Uniforms that only change with the program, set again after a shader reload
+    auto setProgramUniforms = [&](const ShaderProgram& program)
+    {
+        glUseProgram(program.id());
+
+        // The cube's positions are full precision floats
+        program.set(UniformPositionScale, glm::vec3(1.0f));
+        program.set(UniformPositionOffset, glm::vec3(0.0f));
+
+        // Material arrays sit on units 0 to 2
+        program.set(UniformTextureMap, static_cast<int>(MaterialColour));
+        program.set(UniformNormalMap, static_cast<int>(MaterialNormal));
+        program.set(UniformSpecularMap, static_cast<int>(MaterialSpecular));
+
+        // The virtual texture's units, set even while unused since samplers
+        // of different types can't share a unit
+        program.set(UniformVirtualColour, GL_FALSE);
+        program.set(UniformVirtualCache, 3);
+        program.set(UniformVirtualPages, 4);
+        program.set(UniformVirtualTailMap, 5);
+
+        // Each cube's transform comes in with its instance
+        program.set(UniformModel, glm::mat4(1.0f));
+    };
+    setProgramUniforms(shader->uniforms);
 
     // Input mode
     glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE); 
@@ -339,9 +391,7 @@ int main( void )
 
     glFrontFace(GL_CW);
     glEnable(GL_DEPTH_TEST);  
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, normalMap); 
- 
+
 
     // Render loop
     while (!glfwWindowShouldClose(window))
@@ -349,11 +399,36 @@ int main( void )
         // inputs
         keyboardInput(window);
 
+        // Pick up edited files, then upload whatever finished loading within this frame's budget
+        reloader.poll();
+        uploadRing.retire();
+        loader.update();
+        if (!reported && loader.pending() == 0)
+        {
+            resources.report();
+            reported = true;
+        }
+        if (shader->program != shaderProgram)
+        {
+            shaderProgram = shader->program;
+            setProgramUniforms(shader->uniforms);
+        }
+
         // time logic
         float currentFrame = glfwGetTime(); 
         float deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        // Free what nothing holds any more, such as a file that stopped
+        // sharing another's resource when edited; a second apart is plenty
+        if (currentFrame - lastCollect > 1.0f)
+        {
+            size_t freed = resources.collect();
+            if (freed > 0)
+                printf("Freed %zu unused resources\n", freed);
+            lastCollect = currentFrame;
+        }
+
         // Running! (thought this was a better way to handle movement speed)
         if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS)
             running = true;
@@ -417,6 +492,32 @@ int main( void )
         // Update camera matrices
         camera.quaternionCamera();
 
+        // One upload of the matrices for every pass and program this frame
+        CameraBlock cameraBlock;
+        cameraBlock.view = camera.view;
+        cameraBlock.projection = camera.projection;
+        cameraBuffer.update(cameraBlock);
+
+        // Feedback for the ground: which tiles it samples from here, read
+        // back next frame. Cubes don't occlude it, so a few hidden tiles
+        // are fetched too.
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        bool groundReady = virtualGround.isOpen() && pathstone->isReady() && pathstone->page >= 0;
+        if (groundReady)
+        {
+            const ShaderProgram& feedbackProgram = feedbackShader->uniforms;
+            virtualGround.beginFeedback(feedbackProgram, framebufferWidth, framebufferHeight);
+            feedbackProgram.set(UniformModel, glm::mat4(1.0f));
+            feedbackProgram.set(UniformPositionScale, glm::vec3(1.0f));
+            feedbackProgram.set(UniformPositionOffset, glm::vec3(0.0f));
+            pathstone->bind();
+            glBindVertexArray(groundVAO);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            virtualGround.endFeedback();
+        }
+        virtualGround.update();
+
         // clear window
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);  
@@ -424,48 +525,51 @@ int main( void )
         // Use shader + bind
         glUseProgram(shaderProgram); 
 
-        // Set view and projection matrices
-        GLuint viewLoc = glGetUniformLocation(shaderProgram, "view"); 
-        GLuint projLoc = glGetUniformLocation(shaderProgram, "projection"); 
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &camera.view[0][0]); 
-        glUniformMatrix4fv(projLoc, 1, GL_FALSE, &camera.projection[0][0]); 
-
-        // Bind texture
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
-
-        // Bind the diffuse map
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, diffuseMap);
-        glUniform1i(glGetUniformLocation(shaderProgram, "diffuseMap"), 1); 
-
-        // Bind the normal map
-        glActiveTexture(GL_TEXTURE0);  
-        glBindTexture(GL_TEXTURE_2D, normalMap); 
-        glUniform1i(glGetUniformLocation(shaderProgram, "normalMap"), 0); 
-
-        // Bind the specular map
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, specularMap);
-        glUniform1i(glGetUniformLocation(shaderProgram, "specularMap"), 2); 
-
-
-        // Bind VAO
-        glBindVertexArray(VAO); 
-
-        // Draw all objects
+        // Gather all objects, then draw them a material page at a time
+        batch.clear();
         for (Object& obj : objects) 
         {
             glm::mat4 model = glm::mat4(1.0f); 
             model = glm::translate(model, obj.position); 
             model = glm::scale(model, obj.scale); 
             model = glm::rotate(model, obj.angle, obj.rotation); 
+            batch.add(*obj.material, model);
+        } 
 
-            GLuint modelLoc = glGetUniformLocation(shaderProgram, "model"); 
-            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, &model[0][0]); 
+        // Bind VAO
+        glBindVertexArray(VAO); 
+        batch.draw(materials, 36, GL_UNSIGNED_INT);
 
-            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0); 
-        } 
+        // The ground takes its normal and specular maps from the pathstone
+        // material and its colour from the virtual texture
+        if (groundReady)
+        {
+            pathstone->bind();
+            virtualGround.bind(shader->uniforms);
+            shader->uniforms.set(UniformVirtualColour, GL_TRUE);
+            glBindVertexArray(groundVAO);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            shader->uniforms.set(UniformVirtualColour, GL_FALSE);
+        }
+
+        // Each sphere at the level its distance allows, meshlets out of view
+        // or facing away skipped; a reload swaps the model, so it is fetched
+        // and given its material every frame
+        Model* sphere = sphereModel->get();
+        if (sphere && cobblestone->isReady() && cobblestone->page >= 0)
+        {
+            sphere->material = cobblestone;
+            glm::mat4 viewProjection = camera.projection * camera.view;
+            for (const glm::vec3& position : spherePositions)
+            {
+                glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+                shader->uniforms.set(UniformModel, model);
+                sphere->drawLod(shader->uniforms, model, viewProjection, camera.eye, camera.fov,
+                                static_cast<float>(framebufferHeight), &sphereStats);
+            }
+            shader->uniforms.set(UniformModel, glm::mat4(1.0f));
+        }
+        frames++;
 
         // swap buffers + process window events
         glfwSwapBuffers(window);
@@ -473,7 +577,31 @@ int main( void )
         
     }
     
+    if (virtualGround.isOpen())
+    {
+        const VirtualTextureStats& stats = virtualGround.stats();
+        printf("Virtual ground: %.1f%% tile hit rate, %zu uploads, %zu evictions, %.1f MB resident of a %.1f MB chain\n",
+               100.0 * stats.hitRate(), stats.uploads, stats.evictions, stats.residentBytes / (1024.0 * 1024.0),
+               stats.sourceBytes / (1024.0 * 1024.0));
+    }
+
+    // What the level of detail selection saved, per frame
+    for (size_t i = 0; frames > 0 && i < sphereStats.draws.size(); i++)
+    {
+        printf("Sphere LOD %zu: %.2f draws, %.0f triangles a frame\n", i,
+               static_cast<double>(sphereStats.draws[i]) / frames,
+               static_cast<double>(sphereStats.triangles[i]) / frames);
+    }
+
     // Close OpenGL window and terminate GLFW
+    glDeleteBuffers(5, groundBuffers);
+    glDeleteVertexArrays(1, &groundVAO);
+    virtualGround.release();
+    uploadRing.release();
+    cameraBuffer.release();
+    lightBuffer.release();
+    batch.release();
+    materials.release();
     glfwTerminate();
     return 0;
 }
@@ -0,0 +1,26 @@
+#version 330 core
+
+// Virtual texture feedback: writes the tile each pixel samples as its
+// x, y and level, alpha marking the pixel as covered
+
+in vec2 UV;
+
+out vec4 Feedback;
+
+uniform vec2 virtualSize;
+uniform float virtualTail;
+uniform float feedbackBias;     // log2 of how much smaller than the screen this pass is
+
+const float tileTexels = 128.0;
+
+void main() {
+    // same level of detail as virtualTexture() at full resolution
+    vec2 dx = dFdx(UV * virtualSize);
+    vec2 dy = dFdy(UV * virtualSize);
+    float lod = clamp(0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + feedbackBias, 0.0, virtualTail);
+
+    float level = floor(lod);
+    vec2 levelSize = max(virtualSize / exp2(level), vec2(1.0));
+    vec2 tile = floor(fract(UV) * levelSize / tileTexels);
+    Feedback = vec4(tile, level, 255.0) / 255.0;
+}
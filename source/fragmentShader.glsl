@@ -4,35 +4,82 @@ in vec2 UV;
 in vec3 FragPos;
 in vec3 vertexColour;
 in mat3 TBN;
+flat in float Layer;
 
 out vec4 FragColour;
 
-// Texture samplers
-uniform sampler2D textureMap;  
-uniform sampler2D normalMap; 
-uniform sampler2D specularMap;  
-
-// Lighting
-uniform vec3 ambientLightColour;
-uniform vec3 specularLightColour;
-uniform vec3 lightColour;
-uniform vec3 lightDirection;
-uniform float shininess;
+// Material arrays, one layer per material
+uniform sampler2DArray textureMap;
+uniform sampler2DArray normalMap;
+uniform sampler2DArray specularMap;
+
+// Virtual texture (see VirtualTexture), used for colour when virtualColour is set
+uniform bool virtualColour;
+uniform sampler2D virtualCache;
+uniform sampler2D virtualPages;
+uniform sampler2D virtualTailMap;
+uniform vec2 virtualSize;
+uniform float virtualTail;
+uniform vec2 virtualCacheSize;
+
+const float tileTexels = 128.0;
+const float borderTexels = 4.0;
+const float slotTexels = 136.0;
+
+// Lighting, shared by every program (see LightBlock)
+layout(std140) uniform Lights {
+    vec3 lightDirection;
+    float shininess;
+    vec3 lightColour;
+    vec3 ambientLightColour;
+    vec3 specularLightColour;
+};
 
 // Camera
 uniform vec3 viewPos;
 
+// Level of detail of uv over the virtual texture's base level
+float virtualLod(vec2 uv) {
+    vec2 dx = dFdx(uv * virtualSize);
+    vec2 dy = dFdy(uv * virtualSize);
+    return 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+}
+
+// One bilinear tap from the finest resident tile at or above level; the
+// page table entry holds its cache slot and the level it really is
+vec3 virtualTap(vec2 uv, int level) {
+    vec2 wrapped = fract(uv);
+    vec2 levelSize = max(virtualSize / exp2(float(level)), vec2(1.0));
+    vec4 entry = floor(texelFetch(virtualPages, ivec2(wrapped * levelSize / tileTexels), level) * 255.0 + 0.5);
+    vec2 texel = wrapped * max(virtualSize / exp2(entry.b), vec2(1.0));
+    vec2 cacheTexel = entry.rg * slotTexels + borderTexels + mod(texel, tileTexels);
+    return textureLod(virtualCache, cacheTexel / virtualCacheSize, 0.0).rgb;
+}
+
+// Trilinear, blending the two levels around the footprint by hand; past
+// the tail the whole remaining chain is an ordinary mipmapped texture
+vec3 virtualTexture(vec2 uv) {
+    vec2 dx = dFdx(uv);
+    vec2 dy = dFdy(uv);
+    float lod = max(virtualLod(uv), 0.0);
+    if (lod >= virtualTail)
+        return textureGrad(virtualTailMap, uv, dx, dy).rgb;
+    int level = int(lod);
+    return mix(virtualTap(uv, level), virtualTap(uv, min(level + 1, int(virtualTail))), lod - float(level));
+}
+
 void main() {
     // texture
-    vec3 texCol = texture(textureMap, UV).rgb;
+    vec3 texCol = virtualColour ? virtualTexture(UV) : texture(textureMap, vec3(UV, Layer)).rgb;
 
-    // get normal from normal map and transform to world/view space
-    vec3 normalSample = texture(normalMap, UV).rgb;
-    vec3 tangentNormal = normalize(normalSample * 2.0 - 1.0);
+    // get normal from normal map and transform to world/view space,
+    // only x and y are stored (BC5) so z is rebuilt from them
+    vec2 normalXY = texture(normalMap, vec3(UV, Layer)).rg * 2.0 - 1.0;
+    vec3 tangentNormal = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
     vec3 norm = normalize(TBN * tangentNormal);
 
     // specular strength from specular map
-    float specularStrength = texture(specularMap, UV).r;
+    float specularStrength = texture(specularMap, vec3(UV, Layer)).r;
 
     // ambient component
     vec3 ambient = ambientLightColour * texCol;
@@ -4,38 +4,53 @@ layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 colour;     
 layout(location = 2) in vec2 uv;          
 layout(location = 3) in vec3 normal;      
-layout(location = 4) in vec3 tangent;     
+layout(location = 4) in vec4 tangent;     // w is the bitangent sign
+layout(location = 5) in mat4 instanceModel; // per instance, identity for single draws
+layout(location = 9) in float materialLayer;
 
 out vec2 UV;                
 out vec3 vertexColour;      
 out vec3 FragPos;           
 out mat3 TBN;               
+flat out float Layer;
 
 uniform mat4 model;          
-uniform mat4 view;           
-uniform mat4 projection;     
+
+// Shared by every program, written once a frame (see UniformBuffer)
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+};
+
+// Compact meshes store 16-bit positions, full precision meshes pass 1 and 0
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
 
 void main() {
     // model-view matrix
-    mat4 MV = view * model;
+    mat4 MV = view * model * instanceModel;
 
     // calculate the inverse of the 3x3 part of MV (for directions only)
     mat3 invMV = transpose(inverse(mat3(MV)));
 
     // transform tangent and normal into view space
-    vec3 t = normalize(invMV * tangent);
+    vec3 t = normalize(invMV * tangent.xyz);
     vec3 n = normalize(invMV * normal);
 
-    // re-orthogonalize tangent and compute bitangent
+    // re-orthogonalize tangent and compute bitangent, flipped for mirrored uvs
     t = normalize(t - dot(t, n) * n);
-    vec3 b = cross(n, t);
+    vec3 b = cross(n, t) * tangent.w;
 
     // create TBN matrix to convert from view space to tangent space
     TBN = transpose(mat3(t, b, n));
 
+    // decode the object space position
+    vec3 objectPosition = positionOffset + positionScale * position;
+
     // outputs
-    FragPos = vec3(MV * vec4(position, 1.0));
+    FragPos = vec3(MV * vec4(objectPosition, 1.0));
     UV = uv;
+    Layer = materialLayer;
     vertexColour = colour;
 
     // final position for rasterization
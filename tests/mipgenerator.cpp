@@ -0,0 +1,153 @@
+// MipGenerator checks: chains must have the expected level sizes, the box
+// filter must average 2x2 texels (in linear light for colour), normal maps
+// must stay unit length, and splitting rows across threads must not change
+// a single byte.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include <common/mipgenerator.hpp>
+
+static int failures = 0;
+
+static void check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static ImageData makeImage(int width, int height, int channels)
+{
+    ImageData image;
+    image.width = width;
+    image.height = height;
+    image.channels = channels;
+    image.pixels.assign(size_t(width) * height * channels, 0);
+    return image;
+}
+
+static bool near(int value, int expected, int tolerance)
+{
+    return abs(value - expected) <= tolerance;
+}
+
+static void levelSizes()
+{
+    check(MipGenerator::levelCount(1, 1) == 1, "1x1 has one level");
+    check(MipGenerator::levelCount(256, 256) == 9, "256x256 has nine levels");
+    check(MipGenerator::levelCount(7, 3) == 3, "7x3 has three levels");
+
+    std::vector<ImageData> levels;
+    MipGenerator::build(makeImage(7, 3, 4), levels);
+    check(levels.size() == 3, "7x3 chain length");
+    const int sizes[3][2] = { { 7, 3 }, { 3, 1 }, { 1, 1 } };
+    for (size_t i = 0; i < levels.size() && i < 3; i++)
+    {
+        check(levels[i].width == sizes[i][0] && levels[i].height == sizes[i][1], "7x3 level size");
+        check(levels[i].channels == 4 && levels[i].bytes() == size_t(sizes[i][0]) * sizes[i][1] * 4,
+              "7x3 level bytes");
+    }
+}
+
+static void boxValues()
+{
+    MipOptions options;
+    options.filter = MipBox;
+
+    // Data averages as stored
+    ImageData data = makeImage(4, 2, 1);
+    const unsigned char values[8] = { 0, 100, 200, 40, 20, 80, 60, 120 };
+    data.pixels.assign(values, values + 8);
+    options.content = MipLinear;
+    std::vector<ImageData> levels;
+    MipGenerator::build(data, levels, options);
+    check(levels.size() == 3, "4x2 chain length");
+    check(levels[1].width == 2 && levels[1].height == 1, "4x2 second level size");
+    check(near(levels[1].pixels[0], 50, 1) && near(levels[1].pixels[1], 105, 1), "box average of data");
+
+    // Colour averages in linear light, alpha as stored
+    ImageData colour = makeImage(2, 2, 4);
+    for (int i = 0; i < 4; i++)
+    {
+        unsigned char value = i % 2 ? 255 : 0;
+        colour.pixels[i * 4 + 0] = colour.pixels[i * 4 + 1] = colour.pixels[i * 4 + 2] = value;
+        colour.pixels[i * 4 + 3] = value;
+    }
+    options.content = MipColour;
+    MipGenerator::build(colour, levels, options);
+    check(levels.size() == 2, "2x2 chain length");
+    check(near(levels[1].pixels[0], 188, 1), "black and white average to linear grey");
+    check(near(levels[1].pixels[3], 128, 1), "alpha averages as stored");
+}
+
+static void renormalisedNormals()
+{
+    // +x and +z in alternate columns average to a short vector along x + z
+    ImageData normals = makeImage(2, 2, 3);
+    for (int i = 0; i < 4; i++)
+    {
+        unsigned char* texel = &normals.pixels[i * 3];
+        texel[0] = i % 2 ? 128 : 255;
+        texel[1] = 128;
+        texel[2] = i % 2 ? 255 : 128;
+    }
+    MipOptions options;
+    options.filter = MipBox;
+    options.content = MipNormal;
+    std::vector<ImageData> levels;
+    MipGenerator::build(normals, levels, options);
+    check(levels.size() == 2, "normal chain length");
+
+    const unsigned char* texel = levels[1].pixels.data();
+    float x = texel[0] / 127.5f - 1.0f;
+    float y = texel[1] / 127.5f - 1.0f;
+    float z = texel[2] / 127.5f - 1.0f;
+    check(fabsf(sqrtf(x * x + y * y + z * z) - 1.0f) < 0.02f, "averaged normal is unit length");
+    check(fabsf(x - z) < 0.02f && fabsf(y) < 0.02f, "averaged normal points between its sources");
+}
+
+static void threadsAgree()
+{
+    // Large enough that the rows are split, for every filter
+    ImageData image = makeImage(1024, 512, 4);
+    unsigned int seed = 1;
+    for (unsigned char& value : image.pixels)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        value = static_cast<unsigned char>(seed >> 24);
+    }
+
+    const MipFilter filters[3] = { MipBox, MipKaiser, MipLanczos };
+    for (MipFilter filter : filters)
+    {
+        MipOptions options;
+        options.filter = filter;
+        options.threads = 1;
+        std::vector<ImageData> serial, parallel;
+        MipGenerator::build(image, serial, options);
+        options.threads = 8;
+        MipGenerator::build(image, parallel, options);
+
+        bool same = serial.size() == parallel.size();
+        for (size_t i = 0; same && i < serial.size(); i++)
+            same = serial[i].pixels == parallel[i].pixels;
+        check(same, "threaded chain matches the serial one");
+    }
+}
+
+int main()
+{
+    levelSizes();
+    boxValues();
+    renormalisedNormals();
+    threadsAgree();
+
+    if (failures == 0)
+        printf("mipgenerator: all checks passed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+// ObjParser checks: the parallel parser must give exactly what the serial
+// one does, relative indices reaching across chunk boundaries included, and
+// both must turn down indices that reach past the start of the file.
+
+#include <stdio.h>
+#include <string>
+
+#include <common/objparser.hpp>
+
+static int failures = 0;
+
+static void check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static bool same(const ObjData& a, const ObjData& b)
+{
+    return a.positions == b.positions && a.uvs == b.uvs && a.normals == b.normals &&
+           a.vertexIndices == b.vertexIndices && a.uvIndices == b.uvIndices &&
+           a.normalIndices == b.normalIndices && a.faceCount == b.faceCount;
+}
+
+static bool parseSerial(const std::string& text, ObjData& out)
+{
+    return ObjParser::parseBuffer(text.data(), text.data() + text.size(), out);
+}
+
+static bool parseParallel(const std::string& text, ObjData& out, unsigned int threads)
+{
+    return ObjParser::parseBufferParallel(text.data(), text.data() + text.size(), out, threads);
+}
+
+// A strip of quads, each face naming its corners relative to the end of
+// the attributes so far, mixed with absolute ones
+static std::string relativeStrip(int quads)
+{
+    std::string text;
+    char line[128];
+    for (int i = 0; i < quads; i++)
+    {
+        snprintf(line, sizeof(line), "v %d 0 0\nv %d 1 0\nvt %d 0\nvn 0 0 1\n", i, i, i);
+        text += line;
+        if (i == 0)
+            continue;
+        snprintf(line, sizeof(line), "f -3/-2/-1 -1/-1/-1 %d/%d/1 -2/-2/-1\n", 2 * i, i);
+        text += line;
+        text += "f -4//-2 -3//-1 -1//-1\n";
+    }
+    return text;
+}
+
+// Parse text serially and on 1 to 8 threads, expecting the same outcome
+static void compare(const std::string& text, bool expected, const char* what)
+{
+    ObjData serial;
+    bool parsed = parseSerial(text, serial);
+    check(parsed == expected, what);
+    for (unsigned int threads = 1; threads <= 8; threads++)
+    {
+        ObjData parallel;
+        bool parallelParsed = parseParallel(text, parallel, threads);
+        check(parallelParsed == parsed, what);
+        check(!parsed || same(serial, parallel), what);
+    }
+}
+
+int main()
+{
+    compare(relativeStrip(200), true, "relative indices across chunks match the serial parse");
+
+    // Negative uv indices with no vt lines at all must not turn into "no uv"
+    compare("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1/-1 2/-1 3/-1\n", false, "uv index before the first vt");
+    compare("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1//-1 2//-1 3//-1\n", false, "normal index before the first vn");
+
+    // Underflow after a long valid prefix, so it sits in a later chunk
+    std::string late = relativeStrip(200) + "f -1 -2 -1000\n";
+    compare(late, false, "position index reaching past the start of the file");
+
+    // Exactly reaching the first attribute is fine
+    compare("v 0 0 0\nv 1 0 0\nv 0 1 0\nf -3 -2 -1\n", true, "relative index to the first position");
+
+    // Indices past the 32-bit index buffers must not wrap onto small ones
+    compare("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4294967297\n", false, "position index past 2^32");
+    compare("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4294967296\n", false, "position index equal to ObjData::missing");
+
+    if (failures == 0)
+        printf("objparser: all checks passed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+// Offline asset cooker
+//
+// usage: cg_cook <directory> [--threads N] [--force] [--pack] [--stats]
+//                [--filter box|kaiser|lanczos] [--fast] [--uncompressed]
+//
+// Walks the directory for .obj meshes and .png/.jpg/.tga/.bmp images and
+// writes the runtime formats next to each source: .cgmesh (welded, cache
+// and overdraw ordered indices, tangent frames, levels of detail and
+// meshlets) and .cgtex (decoded pixels with the full mip chain). Both
+// store the source size, time and content hash, so an output is skipped
+// while it still matches its source unless --force is given; a .cgtex must
+// also have been built with the requested filter and encoder, so one the
+// runtime cached with the fast encoder is cooked again. Assets are
+// cooked in parallel, one per worker. Mips are filtered with --filter
+// (Kaiser by default), in linear light for colour maps and renormalised for
+// normal maps, going by the file name. Every level is then block compressed
+// (BC1/BC3 colour, BC4 single channel data, BC5 normals) with the quality
+// encoder, or the fast one with --fast, and the PSNR of the base level and
+// the encoder throughput are reported per texture. --stats reports each
+// mesh's vertex cache and overdraw figures before and after optimising.
+// --pack then bundles every cooked file into <directory>/assets.cgpak,
+// which the runtime maps in one go.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <common/model.hpp>
+#include <common/meshcache.hpp>
+#include <common/image.hpp>
+#include <common/mipgenerator.hpp>
+#include <common/texturecache.hpp>
+#include <common/blockcompressor.hpp>
+#include <common/mappedfile.hpp>
+#include <common/cachefile.hpp>
+#include <common/threadpool.hpp>
+#include <common/assetpack.hpp>
+
+enum CookResult
+{
+    CookSkipped,
+    CookBuilt,
+    CookFailed,
+    CookResultCount
+};
+
+static const char* resultNames[CookResultCount] = { "up to date", "cooked", "FAILED" };
+
+static const char* formatNames[] = { "RGBA8", "BC1", "BC3", "BC4", "BC5" };
+
+static bool isMesh(const std::string& extension)
+{
+    return extension == ".obj";
+}
+
+static bool isImage(const std::string& extension)
+{
+    return extension == ".png" || extension == ".jpg" || extension == ".jpeg" ||
+           extension == ".tga" || extension == ".bmp";
+}
+
+static CookResult cookMesh(const std::string& path, bool force, const ModelOptions& options, std::string&)
+{
+    std::error_code error;
+    if (force)
+        std::filesystem::remove(MeshCache::cachePath(path.c_str()), error);
+    else
+    {
+        MappedFile file;
+        MeshView mesh;
+        if (MeshCache::load(path.c_str(), file, mesh, static_cast<uint32_t>(options.lodLevels),
+                            options.compactVertices))
+            return CookSkipped;
+    }
+
+    // The runtime pipeline writes the cache as it goes; nothing is uploaded
+    Model model(options);
+    if (!model.load(path.c_str()))
+        return CookFailed;
+    return std::filesystem::exists(MeshCache::cachePath(path.c_str()), error) ? CookBuilt : CookFailed;
+}
+
+static CookResult cookTexture(const std::string& path, bool force, const TextureSettings& settings,
+                              std::string& detail)
+{
+    if (!force)
+    {
+        MappedFile file;
+        TextureView texture;
+        if (TextureCache::load(path.c_str(), file, texture, &settings))
+            return CookSkipped;
+    }
+
+    ImageData image;
+    if (!Image::decode(path.c_str(), image))
+        return CookFailed;
+
+    // One texture per worker already keeps every core busy
+    MipOptions options;
+    options.filter = settings.filter;
+    options.content = MipGenerator::contentFor(path.c_str());
+    options.threads = 1;
+    std::vector<ImageData> levels;
+    MipGenerator::build(image, levels, options);
+    if (!settings.compress)
+        return TextureCache::write(path.c_str(), levels, options) ? CookBuilt : CookFailed;
+
+    BlockFormat format = BlockCompressor::formatFor(image, options.content);
+    std::vector<CompressedImage> compressed(levels.size());
+    size_t texels = 0;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        BlockCompressor::encode(levels[i], format, settings.quality, compressed[i], 1);
+        texels += size_t(levels[i].width) * levels[i].height;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    // Quality of the base level
+    ImageData decoded;
+    BlockCompressor::decode(format, compressed[0].blocks.data(), image.width, image.height, decoded);
+    double psnr = BlockCompressor::psnr(image, decoded, BlockCompressor::channelCount(format));
+
+    char text[128];
+    snprintf(text, sizeof(text), "%s %dx%d, %.2f dB, %.1f Mtexel/s", formatNames[format], image.width,
+             image.height, psnr, texels / std::max(seconds, 1e-9) / 1e6);
+    detail = text;
+    return TextureCache::write(path.c_str(), compressed, options, settings.quality) ? CookBuilt : CookFailed;
+}
+
+int main(int argc, char** argv)
+{
+    const char* root = NULL;
+    unsigned int threads = 0;
+    bool force = false;
+    bool pack = false;
+    ModelOptions modelOptions;
+    TextureSettings settings;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = static_cast<unsigned int>(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--force") == 0)
+            force = true;
+        else if (strcmp(argv[i], "--pack") == 0)
+            pack = true;
+        else if (strcmp(argv[i], "--stats") == 0)
+            modelOptions.meshStats = true;
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "box") == 0)
+                settings.filter = MipBox;
+            else if (strcmp(argv[i], "lanczos") == 0)
+                settings.filter = MipLanczos;
+            else
+                settings.filter = MipKaiser;
+        }
+        else if (strcmp(argv[i], "--fast") == 0)
+            settings.quality = BlockFast;
+        else if (strcmp(argv[i], "--uncompressed") == 0)
+            settings.compress = false;
+        else
+            root = argv[i];
+    }
+    if (root == NULL)
+    {
+        printf("usage: cg_cook <directory> [--threads N] [--force] [--pack] [--stats]\n"
+               "               [--filter box|kaiser|lanczos] [--fast] [--uncompressed]\n");
+        return 1;
+    }
+
+    // Gather the sources
+    std::vector<std::string> meshes;
+    std::vector<std::string> images;
+    std::error_code error;
+    for (std::filesystem::recursive_directory_iterator it(root, error), end; !error && it != end; it.increment(error))
+    {
+        if (!it->is_regular_file(error))
+            continue;
+        std::string extension = it->path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](unsigned char c) { return static_cast<char>(tolower(c)); });
+        if (isMesh(extension))
+            meshes.push_back(it->path().string());
+        else if (isImage(extension))
+            images.push_back(it->path().string());
+    }
+    if (error)
+    {
+        printf("Could not read %s: %s\n", root, error.message().c_str());
+        return 1;
+    }
+
+    // The tool has no render thread, so every core cooks
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    printf("Cooking %zu meshes and %zu images on %u threads\n", meshes.size(), images.size(), threads);
+
+    std::atomic<size_t> counts[CookResultCount];
+    for (std::atomic<size_t>& count : counts)
+        count.store(0);
+    std::mutex printMutex;
+
+    auto report = [&](const std::string& path, CookResult result, double seconds, const std::string& detail) {
+        counts[result].fetch_add(1);
+        std::lock_guard<std::mutex> lock(printMutex);
+        if (detail.empty())
+            printf("%-10s %s (%.2f s)\n", resultNames[result], path.c_str(), seconds);
+        else
+            printf("%-10s %s (%.2f s) %s\n", resultNames[result], path.c_str(), seconds, detail.c_str());
+    };
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool(threads);
+        for (const std::string& path : meshes)
+        {
+            pool.submit([&, path]() {
+                std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                std::string detail;
+                CookResult result = cookMesh(path, force, modelOptions, detail);
+                report(path, result, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count(), detail);
+            });
+        }
+        for (const std::string& path : images)
+        {
+            pool.submit([&, path]() {
+                std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                std::string detail;
+                CookResult result = cookTexture(path, force, settings, detail);
+                report(path, result, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count(), detail);
+            });
+        }
+        while (pool.busy() > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("\n%zu cooked, %zu up to date, %zu failed in %.2f s\n",
+           counts[CookBuilt].load(), counts[CookSkipped].load(), counts[CookFailed].load(), seconds);
+    if (counts[CookFailed].load() != 0)
+        return 1;
+
+    if (pack)
+    {
+        // Meshes first, then images, each keyed by its source's name
+        std::vector<PackSource> sources;
+        for (size_t i = 0; i < meshes.size() + images.size(); i++)
+        {
+            bool mesh = i < meshes.size();
+            const std::string& path = mesh ? meshes[i] : images[i - meshes.size()];
+            CacheFile::SourceKey key;
+            if (!CacheFile::sourceKey(path.c_str(), key, true))
+                return 1;
+
+            PackSource source;
+            source.name = std::filesystem::path(path).lexically_relative(root).generic_string();
+            source.path = mesh ? MeshCache::cachePath(path.c_str()) : TextureCache::cachePath(path.c_str());
+            source.contentHash = key.hash;
+            sources.push_back(source);
+        }
+
+        std::string packPath = (std::filesystem::path(root) / "assets.cgpak").string();
+        if (!AssetPack::write(packPath.c_str(), sources))
+            return 1;
+        printf("Packed %zu assets into %s (%.1f MB)\n", sources.size(), packPath.c_str(),
+               static_cast<double>(std::filesystem::file_size(packPath, error)) / (1024.0 * 1024.0));
+    }
+    return 0;
+}
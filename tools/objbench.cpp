@@ -0,0 +1,205 @@
+// OBJ loading throughput benchmark
+//
+// usage: cg_objbench [file.obj] [iterations]
+//
+// Without a file a synthetic grid mesh is written to the working directory.
+// Reports MB/s and faces/s for the old fscanf loader and the mapped parser,
+// both on one thread and split across every core.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <common/objparser.hpp>
+#include <common/mappedfile.hpp>
+
+// The fscanf loader Model::loadObj used before the mapped parser
+static bool loadObjScanf(const char* path, ObjData& out)
+{
+    out.clear();
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+
+    while (true)
+    {
+        // Read the first word of the line
+        char lineHeader[128];
+        int res = fscanf(file, "%s", lineHeader);
+        if (res == EOF)
+            break;
+
+        if (strcmp(lineHeader, "v") == 0)
+        {
+            glm::vec3 vertex;
+            fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
+            out.positions.push_back(vertex);
+        }
+        else if (strcmp(lineHeader, "vt") == 0)
+        {
+            glm::vec2 uv;
+            fscanf(file, "%f %f\n", &uv.x, &uv.y);
+            out.uvs.push_back(uv);
+        }
+        else if (strcmp(lineHeader, "vn") == 0)
+        {
+            glm::vec3 normal;
+            fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z);
+            out.normals.push_back(normal);
+        }
+        else if (strcmp(lineHeader, "f") == 0)
+        {
+            unsigned int v[3], vt[3], vn[3];
+            int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n",
+                                 &v[0], &vt[0], &vn[0],
+                                 &v[1], &vt[1], &vn[1],
+                                 &v[2], &vt[2], &vn[2]);
+            if (matches != 9)
+            {
+                fclose(file);
+                return false;
+            }
+            for (int i = 0; i < 3; i++)
+            {
+                out.vertexIndices.push_back(v[i] - 1);
+                out.uvIndices.push_back(vt[i] - 1);
+                out.normalIndices.push_back(vn[i] - 1);
+            }
+            out.faceCount++;
+        }
+        else
+        {
+            char commentBuffer[1000];
+            fgets(commentBuffer, 1000, file);
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+// Write an n x n grid of quads split into triangles
+static bool writeGridObj(const char* path, int n)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+        return false;
+
+    fprintf(file, "# synthetic %dx%d grid\n", n, n);
+    for (int y = 0; y <= n; y++)
+        for (int x = 0; x <= n; x++)
+            fprintf(file, "v %f %f %f\n", x / (float)n, 0.001f * ((x * 7 + y * 13) % 17), y / (float)n);
+    for (int y = 0; y <= n; y++)
+        for (int x = 0; x <= n; x++)
+            fprintf(file, "vt %f %f\n", x / (float)n, y / (float)n);
+    fprintf(file, "vn 0.000000 1.000000 0.000000\n");
+
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            int a = y * (n + 1) + x + 1;
+            int b = a + 1;
+            int c = a + n + 1;
+            int d = c + 1;
+            fprintf(file, "f %d/%d/1 %d/%d/1 %d/%d/1\n", a, a, c, c, b, b);
+            fprintf(file, "f %d/%d/1 %d/%d/1 %d/%d/1\n", b, b, c, c, d, d);
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool loadObjMapped(const char* path, ObjData& out)
+{
+    return ObjParser::parseFile(path, out, 1);
+}
+
+static bool loadObjParallel(const char* path, ObjData& out)
+{
+    return ObjParser::parseFile(path, out, 0);
+}
+
+typedef bool (*LoadFunction)(const char*, ObjData&);
+
+static void run(const char* name, LoadFunction load, const char* path,
+                size_t fileSize, int iterations, ObjData& data)
+{
+    double best = 1e30;
+    for (int i = 0; i < iterations; i++)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        if (!load(path, data))
+        {
+            printf("%-8s failed to load %s\n", name, path);
+            return;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        if (elapsed.count() < best)
+            best = elapsed.count();
+    }
+
+    double megabytes = fileSize / (1024.0 * 1024.0);
+    printf("%-8s %8.3f s  %9.1f MB/s  %12.0f faces/s\n",
+           name, best, megabytes / best, data.faceCount / best);
+}
+
+static bool sameData(const ObjData& a, const ObjData& b)
+{
+    return a.positions == b.positions && a.uvs == b.uvs && a.normals == b.normals &&
+           a.vertexIndices == b.vertexIndices && a.uvIndices == b.uvIndices &&
+           a.normalIndices == b.normalIndices;
+}
+
+int main(int argc, char** argv)
+{
+    std::string path;
+    if (argc > 1)
+    {
+        path = argv[1];
+    }
+    else
+    {
+        path = "cg_objbench_grid.obj";
+        printf("Writing synthetic mesh %s\n", path.c_str());
+        if (!writeGridObj(path.c_str(), 700))
+        {
+            printf("Could not write %s\n", path.c_str());
+            return 1;
+        }
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : 3;
+    if (iterations < 1)
+        iterations = 1;
+
+    MappedFile file;
+    if (!file.open(path.c_str()))
+    {
+        printf("Impossible to open %s\n", path.c_str());
+        return 1;
+    }
+    size_t fileSize = file.size();
+    file.close();
+
+    printf("%s: %.1f MB, best of %d\n", path.c_str(), fileSize / (1024.0 * 1024.0), iterations);
+
+    ObjData scanned, mapped, parallel;
+    run("fscanf", loadObjScanf, path.c_str(), fileSize, iterations, scanned);
+    run("mapped", loadObjMapped, path.c_str(), fileSize, iterations, mapped);
+    run("parallel", loadObjParallel, path.c_str(), fileSize, iterations, parallel);
+
+    if (!sameData(scanned, mapped) || !sameData(mapped, parallel))
+        printf("warning: loaders disagree on %s\n", path.c_str());
+
+    if (argc <= 1)
+        remove(path.c_str());
+
+    return 0;
+}